@@ -0,0 +1,211 @@
+/*
+Allocator.cpp: Contains the implementation of the allocator hooks and of the HugePageArena (Allocator.h).
+
+Language: C++
+*/
+
+#include "Allocator.h"
+
+#include <cstdlib>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+using namespace uzLib;
+
+
+namespace
+{
+  void* DefaultAlloc(size_t Size, void* /*UserObj*/)
+  {
+    return malloc(Size > 0 ? Size : 1);
+  }
+
+  void DefaultFree(void* Ptr, size_t /*Size*/, void* /*UserObj*/)
+  {
+    free(Ptr);
+  }
+
+  std::mutex g_HooksMutex;
+  SAllocatorHooks g_Hooks = { &DefaultAlloc, &DefaultFree, NULL };
+
+  // Size of a mapped block for Size bytes.
+  size_t GetArenaBlockSize(size_t Size)
+  {
+    return (Size + HugePageArena::HUGE_PAGE_SIZE - 1) & ~(HugePageArena::HUGE_PAGE_SIZE - 1);
+  }
+
+#ifdef _WIN32
+  // No huge-page mappings: All blocks are passed to malloc and none is kept by the arena.
+  bool IsArenaBlock(size_t /*Size*/)
+  {
+    return false;
+  }
+
+  void* MapHugePageBlock(size_t /*BlockSize*/)
+  {
+    return NULL;
+  }
+
+  void UnmapHugePageBlock(void* /*Ptr*/, size_t /*BlockSize*/)
+  { }
+#else
+  // Returns whether a block of Size bytes is mapped by the arena (else it's passed to malloc).
+  bool IsArenaBlock(size_t Size)
+  {
+    return Size >= HugePageArena::MIN_ARENA_SIZE;
+  }
+
+  // Maps BlockSize bytes (a multiple of HUGE_PAGE_SIZE) at a huge page boundary; returns NULL if that fails.
+  void* MapHugePageBlock(size_t BlockSize)
+  {
+    // Map one huge page more and cut off the unaligned parts at both ends.
+    const size_t MapSize = BlockSize + HugePageArena::HUGE_PAGE_SIZE;
+    void* const pMapping = mmap(NULL, MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pMapping == MAP_FAILED)
+      return NULL;
+
+    unsigned char* const pBeg = static_cast<unsigned char*>(pMapping);
+    const uintptr_t Misalignment = reinterpret_cast<uintptr_t>(pBeg) & (HugePageArena::HUGE_PAGE_SIZE - 1);
+    const size_t HeadSize = (Misalignment == 0) ? 0 : HugePageArena::HUGE_PAGE_SIZE - Misalignment;
+    if (HeadSize > 0)
+      munmap(pBeg, HeadSize);
+    munmap(pBeg + HeadSize + BlockSize, MapSize - HeadSize - BlockSize);
+
+    void* const pBlock = pBeg + HeadSize;
+#ifdef MADV_HUGEPAGE
+    madvise(pBlock, BlockSize, MADV_HUGEPAGE); // Only a hint; the block works without huge pages as well.
+#endif
+    return pBlock;
+  }
+
+  void UnmapHugePageBlock(void* Ptr, size_t BlockSize)
+  {
+    munmap(Ptr, BlockSize);
+  }
+#endif
+}
+
+
+//============================================================================================================================
+// Allocator hooks
+//============================================================================================================================
+
+void uzLib::SetAllocator(pUzAllocFunc AllocFunc, pUzFreeFunc FreeFunc, void* UserObj)
+{
+  const std::lock_guard<std::mutex> Lock(g_HooksMutex);
+  if (AllocFunc == NULL || FreeFunc == NULL)
+  {
+    g_Hooks.AllocFunc = &DefaultAlloc;
+    g_Hooks.FreeFunc = &DefaultFree;
+    g_Hooks.UserObj = NULL;
+  }
+  else
+  {
+    g_Hooks.AllocFunc = AllocFunc;
+    g_Hooks.FreeFunc = FreeFunc;
+    g_Hooks.UserObj = UserObj;
+  }
+}
+
+SAllocatorHooks uzLib::GetAllocator()
+{
+  const std::lock_guard<std::mutex> Lock(g_HooksMutex);
+  return g_Hooks;
+}
+
+
+//============================================================================================================================
+// HugePageArena
+//============================================================================================================================
+
+uzLib::HugePageArena::HugePageArena(size_t MaxCachedBytes):
+  m_CachedBytes(0), m_MaxCachedBytes(MaxCachedBytes)
+{ }
+
+uzLib::HugePageArena::~HugePageArena()
+{
+  Trim();
+}
+
+void* uzLib::HugePageArena::Allocate(size_t Size)
+{
+  if (!IsArenaBlock(Size))
+    return malloc(Size > 0 ? Size : 1);
+
+  const size_t BlockSize = GetArenaBlockSize(Size);
+  {
+    // Reuse a kept block of the same size. The work buffers of consecutive files mostly have the same sizes.
+    const std::lock_guard<std::mutex> Lock(m_Mutex);
+    for (size_t i = 0; i < m_Cache.size(); ++i)
+    {
+      if (m_Cache[i].Size == BlockSize)
+      {
+        void* const pBlock = m_Cache[i].Ptr;
+        m_Cache[i] = m_Cache.back();
+        m_Cache.pop_back();
+        m_CachedBytes -= BlockSize;
+        return pBlock;
+      }
+    }
+  }
+
+  return MapHugePageBlock(BlockSize);
+}
+
+void uzLib::HugePageArena::Free(void* Ptr, size_t Size)
+{
+  if (Ptr == NULL)
+    return;
+
+  if (!IsArenaBlock(Size))
+  {
+    free(Ptr);
+    return;
+  }
+
+  const size_t BlockSize = GetArenaBlockSize(Size);
+  {
+    const std::lock_guard<std::mutex> Lock(m_Mutex);
+    if (m_CachedBytes + BlockSize <= m_MaxCachedBytes)
+    {
+      const SBlock Block = { Ptr, BlockSize };
+      m_Cache.push_back(Block);
+      m_CachedBytes += BlockSize;
+      return;
+    }
+  }
+
+  UnmapHugePageBlock(Ptr, BlockSize);
+}
+
+void uzLib::HugePageArena::Trim()
+{
+  std::vector<SBlock> Cache;
+  {
+    const std::lock_guard<std::mutex> Lock(m_Mutex);
+    Cache.swap(m_Cache);
+    m_CachedBytes = 0;
+  }
+
+  for (size_t i = 0; i < Cache.size(); ++i)
+    UnmapHugePageBlock(Cache[i].Ptr, Cache[i].Size);
+}
+
+size_t uzLib::HugePageArena::GetCachedBytes()const
+{
+  const std::lock_guard<std::mutex> Lock(m_Mutex);
+  return m_CachedBytes;
+}
+
+void* uzLib::HugePageArena::AllocFunc(size_t Size, void* UserObj)
+{
+  return static_cast<HugePageArena*>(UserObj)->Allocate(Size);
+}
+
+void uzLib::HugePageArena::FreeFunc(void* Ptr, size_t Size, void* UserObj)
+{
+  static_cast<HugePageArena*>(UserObj)->Free(Ptr, Size);
+}
@@ -0,0 +1,140 @@
+/*
+Allocator.h: Contains the allocator hooks for the big work buffers and an arena which backs them with huge pages.
+
+Language: C++
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <mutex>
+#include <type_traits>
+
+
+namespace uzLib
+{
+  // Allocates Size bytes (aligned for any type) or returns NULL if no memory is available.
+  typedef void* (*pUzAllocFunc)(size_t Size, void* UserObj);
+
+  // Frees memory returned by the pUzAllocFunc; Size is the size passed to it.
+  typedef void (*pUzFreeFunc)(void* Ptr, size_t Size, void* UserObj);
+
+  struct SAllocatorHooks
+  {
+    pUzAllocFunc AllocFunc;
+    pUzFreeFunc FreeFunc;
+    void* UserObj;
+  };
+
+  // Sets the functions which allocate the big work buffers (the index arrays of the BWT). Pass NULL for both functions
+  // to restore malloc/free. Each buffer keeps the functions it was created with, so the UserObj must stay valid until all
+  // buffers are freed (this includes the buffers of the codecs used by the buffer functions, which are kept per thread).
+  void SetAllocator(pUzAllocFunc AllocFunc, pUzFreeFunc FreeFunc, void* UserObj);
+
+  // Returns the current functions.
+  SAllocatorHooks GetAllocator();
+
+
+  //==================================================
+  // STL allocator which uses the functions set by SetAllocator. The functions are taken when the allocator is created
+  // and travel with the memory (on swap and assignment).
+  //==================================================
+  template <class T>
+  class HookAllocator
+  {
+    public:
+      typedef T value_type;
+      typedef std::true_type propagate_on_container_copy_assignment;
+      typedef std::true_type propagate_on_container_move_assignment;
+      typedef std::true_type propagate_on_container_swap;
+
+      HookAllocator(): m_Hooks(GetAllocator()) { }
+
+      template <class U>
+      HookAllocator(const HookAllocator<U>& Other): m_Hooks(Other.GetHooks()) { }
+
+      T* allocate(size_t Count)
+      {
+        if (Count > static_cast<size_t>(-1) / sizeof(T))
+          throw std::bad_alloc();
+
+        void* const Ptr = (*m_Hooks.AllocFunc)(Count * sizeof(T), m_Hooks.UserObj);
+        if (Ptr == NULL)
+          throw std::bad_alloc();
+        return static_cast<T*>(Ptr);
+      }
+
+      void deallocate(T* Ptr, size_t Count)
+      {
+        (*m_Hooks.FreeFunc)(Ptr, Count * sizeof(T), m_Hooks.UserObj);
+      }
+
+      const SAllocatorHooks& GetHooks()const { return m_Hooks; }
+
+    private:
+      SAllocatorHooks m_Hooks;
+  };
+
+  template <class T, class U>
+  bool operator==(const HookAllocator<T>& A, const HookAllocator<U>& B)
+  {
+    return A.GetHooks().AllocFunc == B.GetHooks().AllocFunc && A.GetHooks().FreeFunc == B.GetHooks().FreeFunc &&
+        A.GetHooks().UserObj == B.GetHooks().UserObj;
+  }
+
+  template <class T, class U>
+  bool operator!=(const HookAllocator<T>& A, const HookAllocator<U>& B) { return !(A == B); }
+
+
+  //==================================================
+  // Arena for big buffers: Blocks of at least MIN_ARENA_SIZE bytes are mapped separately, aligned to huge pages and marked
+  // for transparent huge pages (madvise), which reduces the TLB misses of the random accesses in the BWT. Freed blocks
+  // are kept (up to MaxCachedBytes) and handed out again for the next file. Smaller blocks are passed to malloc (on
+  // Windows, all blocks are, as the arena needs mmap). Thread-safe. Usage:
+  //   static uzLib::HugePageArena Arena;
+  //   uzLib::SetAllocator(&uzLib::HugePageArena::AllocFunc, &uzLib::HugePageArena::FreeFunc, &Arena);
+  //==================================================
+  class HugePageArena
+  {
+    public:
+      static const size_t HUGE_PAGE_SIZE = 0x200000; // 2 MiB (x86-64)
+      static const size_t MIN_ARENA_SIZE = 0x40000;
+
+      explicit HugePageArena(size_t MaxCachedBytes = 0x4000000);
+
+      // Unmaps the kept blocks. All blocks must have been freed before.
+      ~HugePageArena();
+
+      // Returns NULL if no memory is available.
+      void* Allocate(size_t Size);
+      void Free(void* Ptr, size_t Size);
+
+      // Unmaps the kept blocks.
+      void Trim();
+
+      // Returns the number of bytes of the kept blocks.
+      size_t GetCachedBytes()const;
+
+      // Functions for SetAllocator; UserObj is the arena.
+      static void* AllocFunc(size_t Size, void* UserObj);
+      static void FreeFunc(void* Ptr, size_t Size, void* UserObj);
+
+    private:
+      HugePageArena(const HugePageArena&); // Not copyable.
+      HugePageArena& operator=(const HugePageArena&);
+
+    private:
+      struct SBlock
+      {
+        void* Ptr;
+        size_t Size; // Mapped bytes (a multiple of HUGE_PAGE_SIZE).
+      };
+
+      mutable std::mutex m_Mutex;
+      std::vector<SBlock> m_Cache; // Freed blocks.
+      size_t m_CachedBytes;
+      const size_t m_MaxCachedBytes;
+  };
+}
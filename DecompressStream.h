@@ -0,0 +1,46 @@
+/*
+DecompressStream.h: Contains istreams, which decompress uz1, uz2 and uz3 data while it is read.
+
+Language: C++
+*/
+
+#pragma once
+
+#include "uz1Impl.h"
+#include "uz2Impl.h"
+#include "uz3Impl.h"
+
+
+namespace uzLib
+{
+  //==================================================
+  // istream which reads through one of the decompressing stream buffers (uz1DecompressStreamBuf, uz2DecompressStreamBuf
+  // or uz3DecompressStreamBuf). Only the part of the package which is read gets decompressed, e.g.:
+  //   std::ifstream File("CTF-Face.unr.uz", std::ios::binary);
+  //   uzLib::uz1DecompressStream Package(File);
+  //   Package.read(Buffer, HeaderSize);
+  // Errors of the stream buffer set the badbit; use exceptions() to get them thrown.
+  //==================================================
+  template <class StreamBufT>
+  class DecompressStream : public std::istream
+  {
+    public:
+      // Source is the compressed data; it must stay valid as long as the object is used. The stream buffer constructor
+      // might throw (e.g. if the header is invalid).
+      explicit DecompressStream(in_stream& Source):
+        std::istream(NULL), m_StreamBuf(Source)
+      {
+        rdbuf(&m_StreamBuf);
+      }
+      
+      // Returns the stream buffer (e.g. to get the original filename of a uz1 file).
+      StreamBufT& GetStreamBuf() { return m_StreamBuf; }
+    
+    private:
+      StreamBufT m_StreamBuf;
+  };
+  
+  typedef DecompressStream<uz1DecompressStreamBuf> uz1DecompressStream;
+  typedef DecompressStream<uz2DecompressStreamBuf> uz2DecompressStream;
+  typedef DecompressStream<uz3DecompressStreamBuf> uz3DecompressStream;
+}
@@ -0,0 +1,201 @@
+/*
+FileMapping.cpp: Contains the implementation of the classes in FileMapping.h.
+
+Language: C++
+*/
+
+#include "FileMapping.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace uzLib;
+
+
+namespace
+{
+  // Throws a std::runtime_error with the message and the description of errno.
+  void ThrowSystemError(const std::string& Msg, const std::string& Filename)
+  {
+    throw std::runtime_error(Msg + " '" + Filename + "': " + strerror(errno));
+  }
+}
+
+
+//============================================================================================================================
+// MappedInputFile
+//============================================================================================================================
+
+uzLib::MappedInputFile::MappedInputFile(const std::string& Filename, bool bSequential):
+  m_File(-1), m_pData(NULL), m_Size(0)
+{
+  m_File = open(Filename.c_str(), O_RDONLY);
+  if (m_File < 0)
+    ThrowSystemError("Couldn't open the input file", Filename);
+
+  struct stat FileStat;
+  if (fstat(m_File, &FileStat) != 0)
+  {
+    close(m_File);
+    ThrowSystemError("Couldn't get the size of the input file", Filename);
+  }
+
+  m_Size = static_cast<size_t>(FileStat.st_size);
+
+  // An empty file can't be mapped.
+  if (m_Size > 0)
+  {
+    void* const pMapping = mmap(NULL, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+    if (pMapping == MAP_FAILED)
+    {
+      close(m_File);
+      ThrowSystemError("Couldn't map the input file", Filename);
+    }
+
+    madvise(pMapping, m_Size, bSequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    m_pData = static_cast<const unsigned char*>(pMapping);
+  }
+}
+
+uzLib::MappedInputFile::~MappedInputFile()
+{
+  if (m_pData != NULL)
+    munmap(const_cast<unsigned char*>(m_pData), m_Size);
+
+  close(m_File);
+}
+
+
+//============================================================================================================================
+// MappedOutputFile
+//============================================================================================================================
+
+uzLib::MappedOutputFile::MappedOutputFile(const std::string& Filename, size_t InitialSize):
+  m_Filename(Filename), m_File(-1), m_pData(NULL), m_Size(0), m_Capacity(0)
+{
+  // O_RDWR: A shared writable mapping requires read access.
+  m_File = open(Filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (m_File < 0)
+    ThrowSystemError("Couldn't open the output file", Filename);
+
+  try
+  {
+    if (InitialSize > 0)
+      Remap(InitialSize);
+  }
+  catch (...)
+  {
+    close(m_File);
+    throw; // Rethrow
+  }
+}
+
+uzLib::MappedOutputFile::~MappedOutputFile()
+{
+  if (m_File < 0)
+    return;
+
+  if (m_pData != NULL)
+    munmap(m_pData, m_Capacity);
+
+  // Don't leave the unused part of the mapping at the end of the file.
+  if (ftruncate(m_File, static_cast<off_t>(m_Size)) != 0)
+  {
+    // Ignored; there's no way to report the error from a destructor.
+  }
+
+  close(m_File);
+}
+
+void uzLib::MappedOutputFile::AppendRun(size_t Count, unsigned char B)
+{
+  if (Count > 0)
+    memset(Extend(Count), B, Count);
+}
+
+void uzLib::MappedOutputFile::Append(const unsigned char* Data, size_t Length)
+{
+  if (Length > 0)
+    memcpy(Extend(Length), Data, Length);
+}
+
+void uzLib::MappedOutputFile::Close()
+{
+  if (m_pData != NULL && munmap(m_pData, m_Capacity) != 0)
+    ThrowSystemError("Couldn't unmap the output file", m_Filename);
+
+  m_pData = NULL;
+  m_Capacity = 0;
+
+  // Cut off the unused part at the end.
+  if (ftruncate(m_File, static_cast<off_t>(m_Size)) != 0)
+    ThrowSystemError("Couldn't resize the output file", m_Filename);
+
+  const int File = m_File;
+  m_File = -1;
+  if (close(File) != 0)
+    ThrowSystemError("Couldn't close the output file", m_Filename);
+}
+
+void uzLib::MappedOutputFile::Discard()
+{
+  if (m_File < 0)
+    return;
+
+  if (m_pData != NULL)
+    munmap(m_pData, m_Capacity);
+
+  m_pData = NULL;
+  m_Capacity = 0;
+  m_Size = 0;
+
+  close(m_File);
+  m_File = -1;
+  unlink(m_Filename.c_str());
+}
+
+void uzLib::MappedOutputFile::Grow(size_t MinCapacity)
+{
+  // Grow geometrically, so that appending byte by byte doesn't remap all the time.
+  const size_t MIN_GROW_SIZE = 0x100000;
+  size_t NewCapacity = m_Capacity + m_Capacity/2;
+  if (NewCapacity < m_Capacity + MIN_GROW_SIZE)
+    NewCapacity = m_Capacity + MIN_GROW_SIZE;
+  if (NewCapacity < MinCapacity)
+    NewCapacity = MinCapacity;
+
+  Remap(NewCapacity);
+}
+
+void uzLib::MappedOutputFile::Remap(size_t NewCapacity)
+{
+  if (ftruncate(m_File, static_cast<off_t>(NewCapacity)) != 0)
+    ThrowSystemError("Couldn't resize the output file", m_Filename);
+
+  void* pMapping = MAP_FAILED;
+  if (m_pData == NULL)
+    pMapping = mmap(NULL, NewCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+  else
+  {
+#ifdef __linux__
+    pMapping = mremap(m_pData, m_Capacity, NewCapacity, MREMAP_MAYMOVE);
+#else
+    munmap(m_pData, m_Capacity);
+    m_pData = NULL;
+    m_Capacity = 0;
+    pMapping = mmap(NULL, NewCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+#endif
+  }
+
+  if (pMapping == MAP_FAILED)
+    ThrowSystemError("Couldn't map the output file", m_Filename);
+
+  m_pData = static_cast<unsigned char*>(pMapping);
+  m_Capacity = NewCapacity;
+}
@@ -0,0 +1,112 @@
+/*
+FileMapping.h: Contains classes to map complete files into the memory (POSIX mmap).
+
+Language: C++
+*/
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+
+namespace uzLib
+{
+  //==================================================
+  // Read-only mapping of a complete file.
+  //==================================================
+  class MappedInputFile
+  {
+    public:
+      // Opens and maps the file. bSequential: The file is read from the front to the back (else it's read at random
+      // positions, which turns off the read-ahead). Throws a std::runtime_error in case of errors.
+      explicit MappedInputFile(const std::string& Filename, bool bSequential = true);
+
+      // Unmaps and closes the file.
+      ~MappedInputFile();
+
+      // Returns the content of the file (NULL for an empty file).
+      const unsigned char* GetData()const { return m_pData; }
+      size_t GetSize()const { return m_Size; }
+
+    private:
+      MappedInputFile(const MappedInputFile&); // Not copyable.
+      MappedInputFile& operator=(const MappedInputFile&);
+
+    private:
+      int m_File;
+      const unsigned char* m_pData;
+      size_t m_Size;
+  };
+
+
+  //==================================================
+  // Output file which is written through a shared mapping. The data is appended at the end; the file (and the mapping)
+  // grows if required. Close() truncates the file to the number of written bytes.
+  //==================================================
+  class MappedOutputFile
+  {
+    public:
+      // Creates (or truncates) the file and maps InitialSize bytes. If the size of the output is known, pass it as
+      // InitialSize, so that the file never needs to grow.
+      // Throws a std::runtime_error in case of errors.
+      MappedOutputFile(const std::string& Filename, size_t InitialSize);
+
+      // Unmaps and closes the file, if neither Close() nor Discard() was called. The file is truncated to the number of
+      // written bytes in that case, but errors are ignored.
+      ~MappedOutputFile();
+
+      // Returns a pointer to Length writable bytes at the end of the written data and counts them as written.
+      unsigned char* Extend(size_t Length)
+      {
+        if (m_Capacity - m_Size < Length)
+          Grow(m_Size + Length);
+
+        unsigned char* const ToReturn = m_pData + m_Size;
+        m_Size += Length;
+        return ToReturn;
+      }
+
+      // Appends a single byte.
+      void AppendByte(unsigned char B)
+      {
+        if (m_Size == m_Capacity)
+          Grow(m_Size + 1);
+
+        m_pData[m_Size++] = B;
+      }
+
+      // Appends Count copies of B.
+      void AppendRun(size_t Count, unsigned char B);
+
+      // Appends the data.
+      void Append(const unsigned char* Data, size_t Length);
+
+      // Returns the number of written bytes.
+      size_t GetSize()const { return m_Size; }
+
+      // Unmaps the file, truncates it to the number of written bytes and closes it. Throws a std::runtime_error in case of errors.
+      void Close();
+
+      // Unmaps, closes and removes the file, for example after a failed decoding. Never throws.
+      void Discard();
+
+    private:
+      // Resizes the file and the mapping so that at least MinCapacity bytes fit in.
+      void Grow(size_t MinCapacity);
+
+      // Resizes the file and (re)maps it with NewCapacity bytes.
+      void Remap(size_t NewCapacity);
+
+    private:
+      MappedOutputFile(const MappedOutputFile&); // Not copyable.
+      MappedOutputFile& operator=(const MappedOutputFile&);
+
+    private:
+      std::string m_Filename;
+      int m_File;
+      unsigned char* m_pData;
+      size_t m_Size; // Number of written bytes.
+      size_t m_Capacity; // Number of mapped bytes.
+  };
+}
@@ -0,0 +1,226 @@
+/*
+IndexedChunks.h: Contains the helpers of the indexed access to uz2 chunks and uz3 regions: The parallel loop over the
+chunks, the value I/O of the chunk headers, the header and the file I/O of the sidecar index files and the cache of
+decoded chunks.
+
+Language: C++
+*/
+
+#pragma once
+
+#include "uz1Impl.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+
+namespace uzLib
+{
+  // Calls Process(State, Index) for each Index in [0, NumItems) on NumThreads threads (the calling one included). Each
+  // thread default-constructs its own StateT (e.g. a codec, which isn't copyable) and takes the next index which isn't
+  // taken yet. The first error stops all threads and is rethrown.
+  template <class StateT, class ProcessFuncT>
+  void ProcessIndicesParallel(size_t NumItems, unsigned int NumThreads, ProcessFuncT Process)
+  {
+    std::atomic<size_t> NextIndex(0);
+    std::atomic<bool> bFailed(false);
+    std::mutex ErrorMutex;
+    std::exception_ptr Error;
+
+    auto Worker = [&]()
+    {
+      try
+      {
+        StateT State;
+        for (size_t CurIndex = NextIndex++; CurIndex < NumItems && !bFailed.load(std::memory_order_relaxed);
+            CurIndex = NextIndex++)
+          Process(State, CurIndex);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> Lock(ErrorMutex);
+        if (!Error)
+          Error = std::current_exception();
+        bFailed.store(true);
+      }
+    };
+
+    std::vector<std::thread> Threads;
+    try
+    {
+      for (unsigned int CurThread = 1; CurThread < NumThreads && CurThread < NumItems; ++CurThread)
+        Threads.push_back(std::thread(Worker));
+    }
+    catch (...)
+    {
+      bFailed.store(true);
+      for (size_t CurIndex = 0; CurIndex < Threads.size(); ++CurIndex)
+        Threads[CurIndex].join();
+      throw; // Rethrow
+    }
+
+    Worker();
+    for (size_t CurIndex = 0; CurIndex < Threads.size(); ++CurIndex)
+      Threads[CurIndex].join();
+
+    if (Error)
+      std::rethrow_exception(Error);
+  }
+
+
+  // Reads an int from the buffer (the byte order is the same as in the uz1-functions).
+  inline int GetInt(const unsigned char* Source)
+  {
+    int ToReturn;
+    memcpy(&ToReturn, Source, sizeof(int));
+    return ToReturn;
+  }
+
+  // Writes an int to the buffer.
+  inline void PutInt(unsigned char* Target, int ToWrite)
+  {
+    memcpy(Target, &ToWrite, sizeof(int));
+  }
+
+  // Appends the value to the buffer (in the byte order of the machine, as the ints of the uz-formats). Used for the
+  // sidecar index files.
+  template <class T>
+  void AppendValue(ByteVector& Target, T Value)
+  {
+    const unsigned char* const pValue = reinterpret_cast<const unsigned char*>(&Value);
+    Target.insert(Target.end(), pValue, pValue + sizeof(T));
+  }
+
+  // Reads the value at Pos and moves Pos behind it.
+  template <class T>
+  T ReadValue(const ByteVector& Source, size_t& Pos)
+  {
+    T ToReturn;
+    memcpy(&ToReturn, &Source[Pos], sizeof(T));
+    Pos += sizeof(T);
+    return ToReturn;
+  }
+
+
+  // Sidecar index files: Magic number, version, size of the indexed data (8 bytes) and number of entries, followed by the
+  // entries (all of the same size), whose encoding is up to the index of the format.
+  const size_t INDEX_FILE_HEADER_SIZE = 3*sizeof(uint32_t) + sizeof(uint64_t);
+
+  // Returns the header of an index file with NumEntries entries of EntrySize bytes, which are appended to it.
+  inline ByteVector BeginIndexFile(uint32_t MagicNumber, uint32_t Version, uint64_t DataSize, size_t NumEntries,
+      size_t EntrySize)
+  {
+    ByteVector Data;
+    Data.reserve(INDEX_FILE_HEADER_SIZE + NumEntries * EntrySize);
+    AppendValue<uint32_t>(Data, MagicNumber);
+    AppendValue<uint32_t>(Data, Version);
+    AppendValue<uint64_t>(Data, DataSize);
+    AppendValue<uint32_t>(Data, static_cast<uint32_t>(NumEntries));
+    return Data;
+  }
+
+  // Writes the index file. FormatName (e.g. "uz2") is used in the error messages.
+  inline void SaveIndexFile(const std::string& Filename, const ByteVector& Data, const char* FormatName)
+  {
+    std::ofstream OutFile(Filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!OutFile.is_open())
+      throw std::runtime_error(std::string("Couldn't create the ") + FormatName + " index file '" + Filename + "'.");
+
+    OutFile.write(reinterpret_cast<const char*>(&Data[0]), Data.size());
+    OutFile.close();
+    if (OutFile.fail())
+      throw std::runtime_error(std::string("Couldn't write the ") + FormatName + " index file '" + Filename + "'.");
+  }
+
+  // Reads the index file into Data and checks the header: The magic number, the version, the size of the indexed data and
+  // whether exactly NumEntries entries of EntrySize bytes follow. Returns false if the file can't be read or doesn't
+  // match; else Pos is the position of the first entry.
+  inline bool LoadIndexFile(const std::string& Filename, uint32_t MagicNumber, uint32_t Version, uint64_t DataSize,
+      size_t EntrySize, ByteVector& Data, size_t& Pos, uint32_t& NumEntries)
+  {
+    std::ifstream InFile(Filename.c_str(), std::ios::in | std::ios::binary);
+    if (!InFile.is_open())
+      return false;
+
+    Data.assign(std::istreambuf_iterator<char>(InFile), std::istreambuf_iterator<char>());
+    if (Data.size() < INDEX_FILE_HEADER_SIZE)
+      return false;
+
+    Pos = 0;
+    const uint32_t SavedMagicNumber = ReadValue<uint32_t>(Data, Pos);
+    const uint32_t SavedVersion = ReadValue<uint32_t>(Data, Pos);
+    const uint64_t SavedDataSize = ReadValue<uint64_t>(Data, Pos);
+    NumEntries = ReadValue<uint32_t>(Data, Pos);
+
+    const size_t EntriesSize = Data.size() - INDEX_FILE_HEADER_SIZE;
+    return SavedMagicNumber == MagicNumber && SavedVersion == Version && SavedDataSize == DataSize &&
+        EntriesSize % EntrySize == 0 && EntriesSize / EntrySize == NumEntries;
+  }
+
+
+  //==================================================
+  // Keeps the last decoded chunks (at least one); the least recently used one is replaced by a new chunk.
+  //==================================================
+  class ChunkCache
+  {
+    public:
+      explicit ChunkCache(size_t NumEntries):
+        m_Entries(std::max<size_t>(NumEntries, 1)), m_UseCounter(0)
+      { }
+
+      // Returns the chunk with the index. If it isn't cached, an entry gets Size bytes and Decode(unsigned char*) is
+      // called to decode the chunk into them.
+      template <class DecodeFuncT>
+      const ByteVector& Get(size_t ChunkIndex, size_t Size, DecodeFuncT Decode)
+      {
+        // Look for the chunk and for the least recently used entry, which is replaced otherwise.
+        SEntry* pOldest = &m_Entries[0];
+        for (size_t CurIndex = 0; CurIndex < m_Entries.size(); ++CurIndex)
+        {
+          SEntry& Entry = m_Entries[CurIndex];
+          if (Entry.ChunkIndex == ChunkIndex)
+          {
+            Entry.LastUse = ++m_UseCounter;
+            return Entry.Data;
+          }
+          else if (Entry.LastUse < pOldest->LastUse)
+            pOldest = &Entry;
+        }
+
+        pOldest->ChunkIndex = NO_CHUNK; // In case the decoding fails.
+        pOldest->Data.resize(Size);
+        Decode(pOldest->Data.empty() ? NULL : &pOldest->Data[0]);
+
+        pOldest->ChunkIndex = ChunkIndex;
+        pOldest->LastUse = ++m_UseCounter;
+        return pOldest->Data;
+      }
+
+    private:
+      static const size_t NO_CHUNK = static_cast<size_t>(-1);
+
+      struct SEntry
+      {
+        size_t ChunkIndex; // NO_CHUNK if unused.
+        unsigned long LastUse;
+        ByteVector Data;
+
+        SEntry(): ChunkIndex(NO_CHUNK), LastUse(0)
+        { }
+      };
+
+      std::vector<SEntry> m_Entries;
+      unsigned long m_UseCounter;
+  };
+}
@@ -0,0 +1,164 @@
+/*
+OrderedWorkers.h: Contains a pool of worker threads, which processes a sequence of chunks in parallel and hands them
+back in their order.
+
+Language: C++
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstddef>
+
+
+namespace uzLib
+{
+  //==================================================
+  // Processes a sequence of chunks on worker threads, while the calling thread fills the slots with the chunks and
+  // takes the processed chunks back in their order (see Run). The chunk with the sequence number Seq always uses the
+  // slot Seq % NumSlots, so the slots are handed out in the order of the output and a slot is only reused after its
+  // chunk was taken back; at most NumSlots chunks are in memory.
+  // Each worker thread has its own WorkerT object, whose Process(SlotT&) is called for the chunks. An exception of
+  // Process is rethrown by Run when its chunk is due. The destructor stops and joins the workers.
+  //==================================================
+  template <class SlotT, class WorkerT>
+  class OrderedWorkers
+  {
+    public:
+      OrderedWorkers(unsigned int NumThreads, size_t NumSlots):
+        m_Slots(NumSlots), m_NumFilled(0), m_NumTaken(0), m_bStop(false)
+      {
+        try
+        {
+          for (unsigned int CurThread = 0; CurThread < NumThreads; ++CurThread)
+            m_Threads.push_back(std::thread(&OrderedWorkers::WorkerMain, this));
+        }
+        catch (...)
+        {
+          Stop();
+          throw; // Rethrow
+        }
+      }
+
+      ~OrderedWorkers()
+      {
+        Stop();
+      }
+
+      // Calls Fill(SlotT&) for the free slots until it returns false (the end of the data; the slot is unused then) and
+      // Finish(SlotT&) for each processed chunk in the order of the chunks.
+      template <class FillFuncT, class FinishFuncT>
+      void Run(FillFuncT Fill, FinishFuncT Finish)
+      {
+        size_t NumFinished = 0;
+        bool bEnd = false;
+        for (;;)
+        {
+          // Fill all free slots.
+          while (!bEnd && m_NumFilled - NumFinished < m_Slots.size())
+          {
+            SSlot& Slot = m_Slots[m_NumFilled % m_Slots.size()];
+            if (!Fill(Slot.Data))
+            {
+              bEnd = true;
+              break;
+            }
+
+            Slot.bDone = false;
+            Slot.Error = std::exception_ptr();
+            {
+              std::lock_guard<std::mutex> Lock(m_Mutex);
+              ++m_NumFilled;
+            }
+            m_WorkCond.notify_one();
+          }
+
+          if (NumFinished == m_NumFilled)
+            return;
+
+          // Finish the oldest chunk as soon as it's processed.
+          SSlot& Slot = m_Slots[NumFinished % m_Slots.size()];
+          {
+            std::unique_lock<std::mutex> Lock(m_Mutex);
+            m_DoneCond.wait(Lock, [&Slot]() { return Slot.bDone; });
+          }
+
+          if (Slot.Error)
+            std::rethrow_exception(Slot.Error);
+
+          Finish(Slot.Data);
+          ++NumFinished;
+        }
+      }
+
+    private:
+      OrderedWorkers(const OrderedWorkers&); // Not copyable.
+      OrderedWorkers& operator=(const OrderedWorkers&);
+
+      // Processes the chunks in the order they were filled.
+      void WorkerMain()
+      {
+        WorkerT Worker;
+        std::unique_lock<std::mutex> Lock(m_Mutex);
+        for (;;)
+        {
+          m_WorkCond.wait(Lock, [this]() { return m_bStop || m_NumTaken < m_NumFilled; });
+          if (m_bStop)
+            return;
+
+          SSlot& Slot = m_Slots[m_NumTaken++ % m_Slots.size()];
+          Lock.unlock();
+
+          try
+          {
+            Worker.Process(Slot.Data);
+          }
+          catch (...)
+          {
+            Slot.Error = std::current_exception();
+          }
+
+          Lock.lock();
+          Slot.bDone = true;
+          m_DoneCond.notify_one();
+        }
+      }
+
+      void Stop()
+      {
+        {
+          std::lock_guard<std::mutex> Lock(m_Mutex);
+          m_bStop = true;
+        }
+        m_WorkCond.notify_all();
+
+        for (size_t CurIndex = 0; CurIndex < m_Threads.size(); ++CurIndex)
+          m_Threads[CurIndex].join();
+        m_Threads.clear();
+      }
+
+    private:
+      struct SSlot
+      {
+        SlotT Data;
+        bool bDone; // Processed (or failed). Protected by m_Mutex.
+        std::exception_ptr Error;
+
+        SSlot(): bDone(false)
+        { }
+      };
+
+      std::vector<SSlot> m_Slots;
+      std::vector<std::thread> m_Threads;
+      std::mutex m_Mutex;
+      std::condition_variable m_WorkCond; // A chunk was filled (or the workers shall stop).
+      std::condition_variable m_DoneCond; // A chunk was processed.
+      size_t m_NumFilled; // Number of filled chunks. Only changed by the calling thread.
+      size_t m_NumTaken; // Number of chunks taken by the workers.
+      bool m_bStop;
+  };
+}
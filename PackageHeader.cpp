@@ -0,0 +1,160 @@
+/*
+PackageHeader.cpp: Contains the implementation of the functions in PackageHeader.h.
+
+Language: C++
+*/
+
+#include "PackageHeader.h"
+#include "DecompressStream.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+
+using namespace uzLib;
+
+
+namespace
+{
+  // Max. size of the package header (the generations of UE2 packages are not read).
+  const size_t MAX_PACKAGE_HEADER_SIZE = 3*sizeof(int) + 6*sizeof(int) + 16 + sizeof(int);
+  
+  // Reads max. MaxLength bytes from the stream into OutData.
+  void ReadPrefix(in_stream& Stream, size_t MaxLength, ByteVector& OutData)
+  {
+    OutData.resize(MaxLength);
+    if (MaxLength > 0)
+      Stream.read(reinterpret_cast<char*>(&OutData[0]), MaxLength);
+    OutData.resize(static_cast<size_t>(Stream.gcount()));
+  }
+  
+  // Same as ReadPrefix, but for a decompressing stream: Errors of the stream buffer are thrown.
+  template <class StreamBufT>
+  void ReadDecompressedPrefix(in_stream& Source, size_t MaxLength, ByteVector& OutData)
+  {
+    DecompressStream<StreamBufT> Stream(Source);
+    Stream.exceptions(std::ios::badbit);
+    ReadPrefix(Stream, MaxLength, OutData);
+  }
+  
+  // Reads the ints of the header one after the other.
+  class HeaderReader
+  {
+    public:
+      explicit HeaderReader(const ByteVector& Data): m_Data(Data), m_Pos(0)
+      { }
+      
+      int GetInt()
+      {
+        if (m_Data.size() - m_Pos < sizeof(int))
+          throw std::runtime_error("The package ends inside its header.");
+        
+        int ToReturn;
+        memcpy(&ToReturn, &m_Data[m_Pos], sizeof(int));
+        m_Pos += sizeof(int);
+        return ToReturn;
+      }
+      
+      void GetBytes(unsigned char* Target, size_t Length)
+      {
+        if (m_Data.size() - m_Pos < Length)
+          throw std::runtime_error("The package ends inside its header.");
+        
+        memcpy(Target, &m_Data[m_Pos], Length);
+        m_Pos += Length;
+      }
+    
+    private:
+      const ByteVector& m_Data;
+      size_t m_Pos;
+  };
+  
+  // Returns true, if Str ends with Suffix (case insensitive).
+  bool EndsWithNoCase(const std::string& Str, const char* Suffix)
+  {
+    const size_t SuffixLength = strlen(Suffix);
+    if (Str.length() < SuffixLength)
+      return false;
+    
+    for (size_t CurIndex = 0; CurIndex < SuffixLength; ++CurIndex)
+    {
+      if (tolower(static_cast<unsigned char>(Str[Str.length() - SuffixLength + CurIndex])) != Suffix[CurIndex])
+        return false;
+    }
+    return true;
+  }
+}
+
+EUzFormat uzLib::GetUzFormatFromFilename(const std::string& Filename)
+{
+  if (EndsWithNoCase(Filename, ".uz"))
+    return UZF_UZ1;
+  else if (EndsWithNoCase(Filename, ".uz2"))
+    return UZF_UZ2;
+  else if (EndsWithNoCase(Filename, ".uz3"))
+    return UZF_UZ3;
+  else
+    return UZF_PACKAGE;
+}
+
+void uzLib::PeekPackageData(in_stream& Source, EUzFormat Format, size_t MaxLength, ByteVector& OutData)
+{
+  switch (Format)
+  {
+    case UZF_PACKAGE:
+      ReadPrefix(Source, MaxLength, OutData);
+      break;
+    case UZF_UZ1:
+      ReadDecompressedPrefix<uz1DecompressStreamBuf>(Source, MaxLength, OutData);
+      break;
+    case UZF_UZ2:
+      ReadDecompressedPrefix<uz2DecompressStreamBuf>(Source, MaxLength, OutData);
+      break;
+    case UZF_UZ3:
+      ReadDecompressedPrefix<uz3DecompressStreamBuf>(Source, MaxLength, OutData);
+      break;
+    default:
+      throw std::logic_error("Unknown format in PeekPackageData.");
+  }
+}
+
+SPackageHeader uzLib::PeekPackageHeader(in_stream& Source, EUzFormat Format)
+{
+  ByteVector Data;
+  PeekPackageData(Source, Format, MAX_PACKAGE_HEADER_SIZE, Data);
+  
+  SPackageHeader Header;
+  memset(&Header, 0, sizeof(Header));
+  
+  HeaderReader Reader(Data);
+  Header.Tag = static_cast<unsigned int>(Reader.GetInt());
+  if (Header.Tag != U_PKG_TAG)
+    throw std::runtime_error("The data is not an unreal package.");
+  
+  // The low word is the version of the engine, the high word the version of the licensee.
+  const int Version = Reader.GetInt();
+  Header.FileVersion = Version & 0xffff;
+  Header.LicenseeVersion = (Version >> 16) & 0xffff;
+  Header.PackageFlags = static_cast<unsigned int>(Reader.GetInt());
+  
+  Header.NameCount = Reader.GetInt();
+  Header.NameOffset = Reader.GetInt();
+  Header.ExportCount = Reader.GetInt();
+  Header.ExportOffset = Reader.GetInt();
+  Header.ImportCount = Reader.GetInt();
+  Header.ImportOffset = Reader.GetInt();
+  
+  // Older packages save the heritage table, newer ones a GUID and the generations.
+  if (Header.FileVersion < 68)
+  {
+    Header.HeritageCount = Reader.GetInt();
+    Header.HeritageOffset = Reader.GetInt();
+  }
+  else
+  {
+    Reader.GetBytes(Header.Guid, sizeof(Header.Guid));
+    Header.GenerationCount = Reader.GetInt();
+  }
+  
+  return Header;
+}
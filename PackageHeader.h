@@ -0,0 +1,66 @@
+/*
+PackageHeader.h: Contains functions to read the header of a (compressed) unreal package without decompressing the
+complete package.
+
+Language: C++
+*/
+
+#pragma once
+
+#include "uz1Impl.h"
+
+
+namespace uzLib
+{
+  // Format of a package file.
+  enum EUzFormat
+  {
+    UZF_PACKAGE, // Uncompressed unreal package.
+    UZF_UZ1,
+    UZF_UZ2,
+    UZF_UZ3
+  };
+  
+  // Returns the format according to the extension of the filename (.uz, .uz2, .uz3; UZF_PACKAGE for all others).
+  EUzFormat GetUzFormatFromFilename(const std::string& Filename);
+  
+  
+  //==================================================
+  // The header of an unreal package (UE1 and UE2). The name, export and import tables are found at the saved offsets
+  // (relative to the beginning of the uncompressed package).
+  //==================================================
+  struct SPackageHeader
+  {
+    unsigned int Tag; // Always U_PKG_TAG.
+    int FileVersion;
+    int LicenseeVersion;
+    unsigned int PackageFlags;
+    
+    int NameCount;
+    int NameOffset;
+    int ExportCount;
+    int ExportOffset;
+    int ImportCount;
+    int ImportOffset;
+    
+    // Only saved for FileVersion < 68 (0 otherwise).
+    int HeritageCount;
+    int HeritageOffset;
+    
+    // Only saved for FileVersion >= 68 (0 otherwise).
+    unsigned char Guid[16];
+    int GenerationCount;
+  };
+  
+  const unsigned int U_PKG_TAG = 0x9E2A83C1; // Every unreal package begins with this number.
+  
+  // Decompresses the first MaxLength bytes of the package in Source (less if the package is smaller) and stores them in
+  // OutData. Only as much is decompressed as needed: The first chunk(s) for uz2, a partial inflate for uz3 and the
+  // huffman/MTF decoding up to the end of the first BWT chunk(s) for uz1 (see DecompressStream.h).
+  // Source is read sequentially from its current position. Exceptions are thrown in case of errors.
+  void PeekPackageData(in_stream& Source, EUzFormat Format, size_t MaxLength, ByteVector& OutData);
+  
+  // Reads the header of the package in Source (see PeekPackageData). A std::runtime_error is thrown, if the data
+  // isn't an unreal package.
+  SPackageHeader PeekPackageHeader(in_stream& Source, EUzFormat Format);
+}
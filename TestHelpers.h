@@ -0,0 +1,46 @@
+/*
+TestHelpers.h: Contains the helpers shared by the regression tests (streamtest.cpp, indextest.cpp): Reporting of the
+results, test packages and whole-file reads and writes.
+
+Language: C++
+*/
+
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <cstdlib>
+
+
+// Each test is a program of its own, so the state lives in an unnamed namespace of the including file.
+namespace {
+    bool bAllPassed = true; // The exit code of the test.
+
+    // Prints the result and keeps track of failures in bAllPassed.
+    inline void Report(bool bPassed, const std::string& Name, const std::string& Detail = std::string()) {
+        std::cout << (bPassed ? "PASS " : "FAIL ") << Name << (Detail.empty() ? "" : ": ") << Detail << std::endl;
+        bAllPassed &= bPassed;
+    }
+
+    // Package-like data: Text of 10 letters, which compresses well, mixed with random blocks, which don't. (Without long
+    // repetitions, which make the BWT sort slow.)
+    inline std::string MakePackage(size_t Size, unsigned int Seed) {
+        std::string Data(Size, '\0');
+        srand(Seed);
+        for (size_t CurPos = 0; CurPos < Size; ++CurPos)
+            Data[CurPos] = ((CurPos / 5000) % 3 == 0) ? static_cast<char>(rand()) : "abcdefghij"[rand() % 10];
+        return Data;
+    }
+
+    inline std::string ReadFile(const std::string& Filename) {
+        std::ifstream In(Filename.c_str(), std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(In)), std::istreambuf_iterator<char>());
+    }
+
+    inline void WriteFile(const std::string& Filename, const std::string& Data) {
+        std::ofstream Out(Filename.c_str(), std::ios::binary | std::ios::trunc);
+        Out.write(Data.data(), Data.size());
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ZlibStream.cpp: Contains the implementation of the classes in ZlibStream.h.
+
+Language: C++
+*/
+
+#include "ZlibStream.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <new>
+
+using namespace uzLib;
+
+
+void uzLib::ThrowZlibError(const char* Msg, int StatusCode)
+{
+  if (StatusCode == Z_MEM_ERROR)
+    throw std::bad_alloc();
+  
+  std::ostringstream StrStream;
+  StrStream << Msg << " (zlib status code " << StatusCode << ").";
+  throw std::runtime_error(StrStream.str());
+}
+
+
+//============================================================================================================================
+// DeflateStream
+//============================================================================================================================
+
+uzLib::DeflateStream::DeflateStream(bool bRawDeflate):
+  m_bInitialized(false), m_bRawDeflate(bRawDeflate)
+{
+  memset(&m_ZStream, 0, sizeof(m_ZStream));
+}
+
+uzLib::DeflateStream::~DeflateStream()
+{
+  if (m_bInitialized)
+    deflateEnd(&m_ZStream);
+}
+
+int uzLib::DeflateStream::Reset()
+{
+  if (m_bInitialized)
+    return deflateReset(&m_ZStream);
+
+  // Same parameters as compress() (8: the default memory level).
+  const int StatusCode = deflateInit2(&m_ZStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, m_bRawDeflate ? -MAX_WBITS : MAX_WBITS, 
+      8, Z_DEFAULT_STRATEGY);
+  if (StatusCode == Z_OK)
+    m_bInitialized = true;
+  return StatusCode;
+}
+
+int uzLib::DeflateStream::Compress(unsigned char* Dest, uLongf* DestLen, const unsigned char* Source, uLong SourceLen)
+{
+  int StatusCode = Reset();
+  if (StatusCode != Z_OK)
+    return StatusCode;
+
+  m_ZStream.next_in = const_cast<unsigned char*>(Source);
+  m_ZStream.avail_in = static_cast<uInt>(SourceLen);
+  m_ZStream.next_out = Dest;
+  m_ZStream.avail_out = static_cast<uInt>(*DestLen);
+
+  StatusCode = deflate(&m_ZStream, Z_FINISH);
+  *DestLen = m_ZStream.total_out;
+  if (StatusCode == Z_STREAM_END)
+    return Z_OK;
+
+  // Z_OK: The output didn't fit (compress() reports this as Z_BUF_ERROR, too).
+  return StatusCode == Z_OK ? Z_BUF_ERROR : StatusCode;
+}
+
+
+//============================================================================================================================
+// InflateStream
+//============================================================================================================================
+
+uzLib::InflateStream::InflateStream(bool bRawInflate):
+  m_bInitialized(false), m_bRawInflate(bRawInflate)
+{
+  memset(&m_ZStream, 0, sizeof(m_ZStream));
+}
+
+uzLib::InflateStream::~InflateStream()
+{
+  if (m_bInitialized)
+    inflateEnd(&m_ZStream);
+}
+
+int uzLib::InflateStream::Reset()
+{
+  if (m_bInitialized)
+    return inflateReset(&m_ZStream);
+
+  const int StatusCode = inflateInit2(&m_ZStream, m_bRawInflate ? -MAX_WBITS : MAX_WBITS);
+  if (StatusCode == Z_OK)
+    m_bInitialized = true;
+  return StatusCode;
+}
+
+int uzLib::InflateStream::Decompress(unsigned char* Dest, uLongf* DestLen, const unsigned char* Source, uLong SourceLen)
+{
+  int StatusCode = Reset();
+  if (StatusCode != Z_OK)
+    return StatusCode;
+
+  m_ZStream.next_in = const_cast<unsigned char*>(Source);
+  m_ZStream.avail_in = static_cast<uInt>(SourceLen);
+  m_ZStream.next_out = Dest;
+  m_ZStream.avail_out = static_cast<uInt>(*DestLen);
+
+  StatusCode = inflate(&m_ZStream, Z_FINISH);
+  *DestLen = m_ZStream.total_out;
+  if (StatusCode == Z_STREAM_END)
+    return Z_OK;
+
+  // Like uncompress(): If output space is left, the input ended too early (damaged data), else Dest is too small.
+  if (StatusCode == Z_NEED_DICT || ((StatusCode == Z_BUF_ERROR || StatusCode == Z_OK) && m_ZStream.avail_out > 0))
+    return Z_DATA_ERROR;
+  return StatusCode == Z_OK ? Z_BUF_ERROR : StatusCode;
+}
@@ -0,0 +1,94 @@
+/*
+ZlibStream.h: Contains reusable zlib streams as replacement for compress() and uncompress().
+
+Language: C++
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <zlib.h>
+
+
+namespace uzLib
+{
+  // Throws a std::runtime_error with the zlib status code, or a std::bad_alloc for Z_MEM_ERROR.
+  void ThrowZlibError(const char* Msg, int StatusCode);
+
+  // Returns the codec (uz2Codec or uz3Codec) of the calling thread, which is used by the buffer functions.
+  template <class CodecT>
+  CodecT& GetThreadCodec()
+  {
+    thread_local CodecT Codec;
+    return Codec;
+  }
+
+
+  //==================================================
+  // Replacement for zlib's compress(): The deflate state is created by the first call and only reset (deflateReset) by
+  // the following ones, instead of being allocated and initialized for every call. The output is the same as compress()
+  // (level Z_DEFAULT_COMPRESSION, default window and memory level).
+  // An object must only be used by one thread at a time.
+  //==================================================
+  class DeflateStream
+  {
+    public:
+      // bRawDeflate: Without the zlib header and trailer (for the parts of a zlib stream, which are deflated separately).
+      explicit DeflateStream(bool bRawDeflate = false);
+      ~DeflateStream();
+
+      // Same as compress(): Compresses SourceLen bytes into Dest, which holds *DestLen bytes; *DestLen receives the
+      // compressed size. Returns Z_OK, Z_MEM_ERROR or Z_BUF_ERROR (Dest too small).
+      int Compress(unsigned char* Dest, uLongf* DestLen, const unsigned char* Source, uLong SourceLen);
+
+      // Same as compressBound().
+      static size_t GetBound(size_t SourceLen) { return compressBound(static_cast<uLong>(SourceLen)); }
+
+      // For streaming: Resets the stream (initializes it on the first call) with the same parameters as Compress and
+      // returns Z_OK or Z_MEM_ERROR. Afterwards, the data is passed through deflate() on GetZStream().
+      int Reset();
+      z_stream& GetZStream() { return m_ZStream; }
+
+    private:
+      DeflateStream(const DeflateStream&); // Not copyable.
+      DeflateStream& operator=(const DeflateStream&);
+
+    private:
+      z_stream m_ZStream;
+      bool m_bInitialized;
+      const bool m_bRawDeflate;
+  };
+
+
+  //==================================================
+  // Replacement for zlib's uncompress() with the same reuse of the inflate state (inflateReset) as DeflateStream.
+  // An object must only be used by one thread at a time.
+  //==================================================
+  class InflateStream
+  {
+    public:
+      // bRawInflate: Raw deflate data without the zlib header and trailer (e.g. a part of a zlib stream, which begins at
+      // a flush point).
+      explicit InflateStream(bool bRawInflate = false);
+      ~InflateStream();
+
+      // Same as uncompress(): Decompresses the zlib stream in Source into Dest, which holds *DestLen bytes; *DestLen
+      // receives the decompressed size. Returns Z_OK, Z_MEM_ERROR, Z_BUF_ERROR (Dest too small) or Z_DATA_ERROR
+      // (damaged or incomplete input).
+      int Decompress(unsigned char* Dest, uLongf* DestLen, const unsigned char* Source, uLong SourceLen);
+
+      // For streaming: Resets the stream (initializes it on the first call) and returns Z_OK or Z_MEM_ERROR. Afterwards,
+      // the data is passed through inflate() on GetZStream().
+      int Reset();
+      z_stream& GetZStream() { return m_ZStream; }
+
+    private:
+      InflateStream(const InflateStream&); // Not copyable.
+      InflateStream& operator=(const InflateStream&);
+
+    private:
+      z_stream m_ZStream;
+      bool m_bInitialized;
+      const bool m_bRawInflate;
+  };
+}
@@ -0,0 +1,115 @@
+#include "uz1Impl.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+using namespace std;
+
+// Measures how many small packages per second the uz1 functions handle: The stream versions (CompressToUz1,
+// DecompressFromUz1) against the buffer versions (CompressBufferToUz1, DecompressBufferFromUz1).
+// Usage: uzlib-bench [<minimum seconds per measurement>]
+
+namespace {
+    // Creates Size bytes of package-like data: Runs, repeated names and some noise. Always the same for the same size.
+    uzLib::ByteVector MakeInput(size_t Size) {
+        static const char* const Words[] = { "Engine", "Actor", "Texture", "Brush", "None", "Package", "Class", "Core" };
+
+        uzLib::ByteVector Data;
+        Data.reserve(Size);
+        unsigned int Seed = 12345;
+        while (Data.size() < Size) {
+            Seed = Seed * 1103515245 + 12345;
+            const unsigned int Rand = Seed >> 16;
+            switch (Rand % 4) {
+                case 0: // Run
+                    Data.insert(Data.end(), 4 + Rand % 12, static_cast<unsigned char>(Rand >> 8));
+                    break;
+                case 1: // Noise
+                    for (int i = 0; i < 8; ++i)
+                        Data.push_back(static_cast<unsigned char>((Rand >> i) * 31));
+                    break;
+                default: { // Name
+                    const char* Word = Words[(Rand >> 4) % 8];
+                    while (*Word != 0)
+                        Data.push_back(static_cast<unsigned char>(*Word++));
+                    Data.push_back(0);
+                }
+            }
+        }
+        Data.resize(Size);
+        return Data;
+    }
+
+    // Calls Func until MinSeconds passed and returns the number of calls per second.
+    template <class FuncT>
+    double Measure(double MinSeconds, FuncT Func) {
+        typedef chrono::steady_clock Clock;
+        const Clock::time_point Start = Clock::now();
+        long Calls = 0;
+        double Elapsed = 0;
+        do {
+            for (int i = 0; i < 16; ++i)
+                Func();
+            Calls += 16;
+            Elapsed = chrono::duration<double>(Clock::now() - Start).count();
+        } while (Elapsed < MinSeconds);
+        return Calls / Elapsed;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const double MinSeconds = argc > 1 ? atof(argv[1]) : 0.5;
+    const string PkgFilename("Bench.u");
+
+    cout << "files/sec     compress (stream)  compress (buffer)  decompress (stream)  decompress (buffer)" << endl;
+
+    try {
+        for (size_t Size = 1024; Size <= 64*1024; Size *= 2) {
+            const uzLib::ByteVector Input = MakeInput(Size);
+            const string InputString(Input.begin(), Input.end());
+
+            uzLib::ByteVector Compressed;
+            uzLib::CompressBufferToUz1(uzLib::SByteSpan(Input), Compressed, PkgFilename, uzLib::USIG_5678);
+            const string CompressedString(Compressed.begin(), Compressed.end());
+
+            // Make sure that both versions agree, before measuring them.
+            uzLib::ByteVector Decompressed;
+            uzLib::DecompressBufferFromUz1(uzLib::SByteSpan(Compressed), Decompressed);
+            ostringstream CheckStream;
+            istringstream CheckInput(InputString);
+            uzLib::CompressToUz1(CheckInput, CheckStream, PkgFilename, uzLib::USIG_5678);
+            if (Decompressed != Input || CheckStream.str() != CompressedString)
+                throw runtime_error("The stream and the buffer versions produce different results.");
+
+            const double StreamCompress = Measure(MinSeconds, [&]() {
+                istringstream In(InputString);
+                ostringstream Out;
+                uzLib::CompressToUz1(In, Out, PkgFilename, uzLib::USIG_5678);
+            });
+            const double BufferCompress = Measure(MinSeconds, [&]() {
+                uzLib::CompressBufferToUz1(uzLib::SByteSpan(Input), Compressed, PkgFilename, uzLib::USIG_5678);
+            });
+            const double StreamDecompress = Measure(MinSeconds, [&]() {
+                istringstream In(CompressedString);
+                ostringstream Out;
+                uzLib::DecompressFromUz1(In, Out);
+            });
+            const double BufferDecompress = Measure(MinSeconds, [&]() {
+                uzLib::DecompressBufferFromUz1(uzLib::SByteSpan(Compressed), Decompressed);
+            });
+
+            cout << setw(3) << Size / 1024 << " KiB " << fixed << setprecision(0)
+                 << setw(20) << StreamCompress << setw(19) << BufferCompress
+                 << setw(21) << StreamDecompress << setw(21) << BufferDecompress << endl;
+        }
+    }
+    catch (const std::exception& e) {
+        cout << "Benchmark failed: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
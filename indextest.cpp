@@ -0,0 +1,344 @@
+#include "uz2Impl.h"
+#include "uz3Impl.h"
+#include "TestHelpers.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <zlib.h>
+using namespace std;
+
+// Regression tests of the parallel uz2/uz3 functions, the sidecar index files and the random-access readers: Round trips
+// with several thread counts, and damaged or mismatching index files must be rejected (or the data must still decode).
+// The uz2 and uz3 output must be the same as the one of zlib's compress() (which the original tools use), and the
+// parallel uz3 output must be decodable with uncompress().
+// POSIX only (the file functions map the files). Usage: uzlib-indextest (make check)
+
+namespace {
+    // The uz2 data of the original tools: Each chunk of 32 KiB compressed with zlib's compress(), behind its compressed
+    // and uncompressed size.
+    string CompressUz2Reference(const string& Package) {
+        string Uz2;
+        for (size_t CurPos = 0; CurPos < Package.size(); CurPos += uzLib::UZ2_UNCOMPR_BLOCK_SIZE) {
+            const uLong UnComprSize = static_cast<uLong>(min(uzLib::UZ2_UNCOMPR_BLOCK_SIZE, Package.size() - CurPos));
+            vector<Bytef> Chunk(compressBound(UnComprSize));
+            uLongf ComprSize = static_cast<uLongf>(Chunk.size());
+            if (compress(&Chunk[0], &ComprSize, reinterpret_cast<const Bytef*>(Package.data() + CurPos), UnComprSize) != Z_OK)
+                throw runtime_error("compress() failed.");
+
+            const int Sizes[] = { static_cast<int>(ComprSize), static_cast<int>(UnComprSize) };
+            Uz2.append(reinterpret_cast<const char*>(Sizes), sizeof(Sizes));
+            Uz2.append(reinterpret_cast<const char*>(&Chunk[0]), ComprSize);
+        }
+        return Uz2;
+    }
+
+    // The uz3 data of the original tools: The magic number and the size of the package, followed by the output of zlib's
+    // compress() for the complete package.
+    string CompressUz3Reference(const string& Package) {
+        const uLong PackageSize = static_cast<uLong>(Package.size());
+        vector<Bytef> Compressed(compressBound(PackageSize));
+        uLongf ComprSize = static_cast<uLongf>(Compressed.size());
+        if (compress(&Compressed[0], &ComprSize, reinterpret_cast<const Bytef*>(Package.data()), PackageSize) != Z_OK)
+            throw runtime_error("compress() failed.");
+
+        const int Header[] = { uzLib::UZ3_MAGIC_NUMBER, static_cast<int>(PackageSize) };
+        return string(reinterpret_cast<const char*>(Header), sizeof(Header)) +
+            string(reinterpret_cast<const char*>(&Compressed[0]), ComprSize);
+    }
+
+    // Decompresses the zlib stream of the uz3 data with zlib's uncompress() (as the games do). Returns an empty string if
+    // uncompress() fails.
+    string UncompressUz3(const string& Uz3) {
+        int PackageSize;
+        memcpy(&PackageSize, Uz3.data() + sizeof(int), sizeof(int));
+        vector<Bytef> Package(PackageSize);
+        uLongf DestLen = static_cast<uLongf>(PackageSize);
+        if (uncompress(&Package[0], &DestLen, reinterpret_cast<const Bytef*>(Uz3.data() + uzLib::UZ3_HEADER_SIZE),
+                static_cast<uLong>(Uz3.size() - uzLib::UZ3_HEADER_SIZE)) != Z_OK)
+            return string();
+        return string(reinterpret_cast<const char*>(&Package[0]), DestLen);
+    }
+
+    // Reads NumReads ranges at pseudo-random offsets (some beyond the end) and compares them with the package.
+    template <class ReaderT>
+    bool CheckRandomReads(ReaderT& Reader, const string& Package, int NumReads, string& Detail) {
+        vector<unsigned char> Buffer(300000);
+        for (int CurRead = 0; CurRead < NumReads; ++CurRead) {
+            const size_t Offset = static_cast<size_t>(rand()) % (Package.size() + 10);
+            const size_t Length = static_cast<size_t>(rand()) % (CurRead % 10 == 0 ? Buffer.size() : 100);
+            const size_t Expected = (Offset >= Package.size()) ? 0 : min(Length, Package.size() - Offset);
+            const size_t Read = Reader.ReadAt(Offset, &Buffer[0], Length);
+            if (Read != Expected || (Read > 0 && memcmp(&Buffer[0], Package.data() + Offset, Read) != 0)) {
+                ostringstream Msg;
+                Msg << "mismatch at offset " << Offset << ", length " << Length;
+                Detail = Msg.str();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Saves the damaged index (Patch is applied to a copy of the saved one) and returns true, if Load rejects it.
+    template <class IndexT, class PatchFuncT>
+    bool LoadRejects(const string& IndexFilename, const string& DamagedFilename, size_t DataSize, PatchFuncT Patch) {
+        string Data = ReadFile(IndexFilename);
+        Patch(Data);
+        WriteFile(DamagedFilename, Data);
+        IndexT Index;
+        return !Index.Load(DamagedFilename, DataSize);
+    }
+
+    void TestUz2(const string& Dir, const string& Package) {
+        const string Uz2Filename = Dir + "/test.uz2";
+        const string IndexFilename = Dir + "/test.uz2i";
+        const string DamagedFilename = Dir + "/damaged.uz2i";
+        const string OutFilename = Dir + "/test.out";
+
+        uzLib::ByteVector Uz2Data;
+        uzLib::CompressBufferToUz2(uzLib::SByteSpan(reinterpret_cast<const unsigned char*>(Package.data()), Package.size()),
+            Uz2Data);
+        const string Uz2(Uz2Data.begin(), Uz2Data.end());
+        WriteFile(Uz2Filename, Uz2);
+        const string Reference = CompressUz2Reference(Package);
+        Report(Uz2 == Reference, "uz2, CompressBufferToUz2 (same as compress() per chunk)");
+
+        const unsigned int THREAD_COUNTS[] = { 1, 3, 0 };
+        for (size_t CurIndex = 0; CurIndex < sizeof(THREAD_COUNTS)/sizeof(THREAD_COUNTS[0]); ++CurIndex) {
+            const unsigned int NumThreads = THREAD_COUNTS[CurIndex];
+            ostringstream Name;
+            Name << "NumThreads " << NumThreads;
+
+            istringstream In(Package);
+            ostringstream Out;
+            uzLib::CompressToUz2Parallel(In, Out, NumThreads);
+            Report(Out.str() == Reference, "uz2, CompressToUz2Parallel, " + Name.str() + " (same as compress() per chunk)");
+
+            uzLib::DecompressFileFromUz2Parallel(Uz2Filename, OutFilename, NumThreads);
+            Report(ReadFile(OutFilename) == Package, "uz2, DecompressFileFromUz2Parallel, " + Name.str());
+        }
+
+        // The first reader builds and saves the index, the second one loads it.
+        remove(IndexFilename.c_str());
+        for (int CurPass = 0; CurPass < 2; ++CurPass) {
+            uzLib::uz2RandomAccessFile Reader(Uz2Filename, IndexFilename, 3);
+            string Detail;
+            const bool bPassed = Reader.GetPackageSize() == Package.size() && CheckRandomReads(Reader, Package, 2000, Detail);
+            Report(bPassed, CurPass == 0 ? "uz2, uz2RandomAccessFile, built index" : "uz2, uz2RandomAccessFile, loaded index",
+                Detail);
+        }
+
+        uzLib::uz2ChunkIndex Index;
+        Report(Index.Load(IndexFilename, Uz2.size()) && Index.GetPackageSize() == Package.size(), "uz2, index loaded");
+        Report(!Index.Load(Dir + "/missing.uz2i", Uz2.size()), "uz2, missing index rejected");
+        Report(!Index.Load(IndexFilename, Uz2.size() - 1), "uz2, index of another size rejected");
+
+        // Header: Magic number, version, size of the uz2 data, number of chunks; entries of 2*2 bytes from byte 20 on.
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data[0] ^= 1; }), "uz2, index with a wrong magic number rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data[4] ^= 1; }), "uz2, index with a wrong version rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data.resize(Data.size() - 1); }), "uz2, truncated index rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data.resize(10); }), "uz2, index without a complete header rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data.push_back(0); }), "uz2, index with trailing bytes rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data[20] = 0; Data[21] = 0; }), "uz2, index with an empty chunk rejected");
+        Report(LoadRejects<uzLib::uz2ChunkIndex>(IndexFilename, DamagedFilename, Uz2.size(),
+            [](string& Data) { Data[20] ^= 1; }), "uz2, index with a wrong chunk size rejected");
+
+        // A damaged index in the sidecar file is replaced by a built one.
+        string Damaged = ReadFile(IndexFilename);
+        Damaged[20] ^= 1;
+        WriteFile(IndexFilename, Damaged);
+        {
+            uzLib::uz2RandomAccessFile Reader(Uz2Filename, IndexFilename);
+            string Detail;
+            Report(CheckRandomReads(Reader, Package, 200, Detail), "uz2, uz2RandomAccessFile, damaged index rebuilt", Detail);
+        }
+        Report(Index.Load(IndexFilename, Uz2.size()), "uz2, rebuilt index saved");
+
+        remove(Uz2Filename.c_str());
+        remove(IndexFilename.c_str());
+        remove(DamagedFilename.c_str());
+        remove(OutFilename.c_str());
+    }
+
+    void TestUz3(const string& Dir, const string& Package) {
+        const string Uz3Filename = Dir + "/test.uz3";
+        const string IndexFilename = Dir + "/test.uz3i";
+        const string DamagedFilename = Dir + "/damaged.uz3i";
+        const string OutFilename = Dir + "/test.out";
+
+        const string Reference = CompressUz3Reference(Package);
+        {
+            uzLib::ByteVector Uz3Data;
+            uzLib::CompressBufferToUz3(uzLib::SByteSpan(reinterpret_cast<const unsigned char*>(Package.data()), Package.size()),
+                Uz3Data);
+            Report(string(Uz3Data.begin(), Uz3Data.end()) == Reference, "uz3, CompressBufferToUz3 (same as compress())");
+
+            istringstream In(Package);
+            ostringstream Out;
+            uzLib::CompressToUz3(In, Out);
+            Report(Out.str() == Reference, "uz3, CompressToUz3 (same as compress())");
+        }
+
+        const unsigned int THREAD_COUNTS[] = { 1, 3, 0 };
+        for (size_t CurIndex = 0; CurIndex < sizeof(THREAD_COUNTS)/sizeof(THREAD_COUNTS[0]); ++CurIndex) {
+            const unsigned int NumThreads = THREAD_COUNTS[CurIndex];
+            ostringstream Name;
+            Name << "NumThreads " << NumThreads;
+
+            // Without flush points the output is still a single zlib stream.
+            {
+                istringstream In(Package);
+                ostringstream Out;
+                uzLib::CompressToUz3Parallel(In, Out, NumThreads);
+                const string Uz3 = Out.str();
+                uzLib::ByteVector Decoded;
+                uzLib::DecompressBufferFromUz3(uzLib::SByteSpan(reinterpret_cast<const unsigned char*>(Uz3.data()), Uz3.size()),
+                    Decoded);
+                Report(string(Decoded.begin(), Decoded.end()) == Package, "uz3, CompressToUz3Parallel, " + Name.str());
+                Report(UncompressUz3(Uz3) == Package, "uz3, CompressToUz3Parallel, " + Name.str() + " (uncompress())");
+            }
+
+            istringstream In(Package);
+            ostringstream Out;
+            uzLib::uz3FlushIndex Index;
+            uzLib::CompressToUz3Parallel(In, Out, NumThreads, 1, &Index);
+            const string Uz3 = Out.str();
+            WriteFile(Uz3Filename, Uz3);
+            Index.Save(IndexFilename);
+            Report(Index.GetNumRegions() == (Package.size() + 0xFFFFF) / 0x100000,
+                "uz3, CompressToUz3Parallel, flush every MiB, " + Name.str() + " (one region per MiB)");
+
+            uzLib::ByteVector Decoded;
+            uzLib::DecompressBufferFromUz3(uzLib::SByteSpan(reinterpret_cast<const unsigned char*>(Uz3.data()), Uz3.size()),
+                Decoded);
+            Report(string(Decoded.begin(), Decoded.end()) == Package,
+                "uz3, CompressToUz3Parallel, flush every MiB, " + Name.str() + " (decoded as one stream)");
+            Report(UncompressUz3(Uz3) == Package,
+                "uz3, CompressToUz3Parallel, flush every MiB, " + Name.str() + " (uncompress())");
+
+            uzLib::DecompressFileFromUz3Parallel(Uz3Filename, IndexFilename, OutFilename, NumThreads);
+            Report(ReadFile(OutFilename) == Package, "uz3, DecompressFileFromUz3Parallel, indexed, " + Name.str());
+            uzLib::DecompressFileFromUz3Parallel(Uz3Filename, "", OutFilename, NumThreads);
+            Report(ReadFile(OutFilename) == Package, "uz3, DecompressFileFromUz3Parallel, no index, " + Name.str());
+        }
+
+        const size_t Uz3Size = ReadFile(Uz3Filename).size();
+        {
+            uzLib::uz3RandomAccessFile Reader(Uz3Filename, IndexFilename);
+            string Detail;
+            const bool bPassed = Reader.GetIndex().GetNumRegions() > 1 && CheckRandomReads(Reader, Package, 300, Detail);
+            Report(bPassed, "uz3, uz3RandomAccessFile, indexed", Detail);
+        }
+        {
+            uzLib::uz3RandomAccessFile Reader(Uz3Filename);
+            string Detail;
+            const bool bPassed = Reader.GetIndex().GetNumRegions() == 1 && CheckRandomReads(Reader, Package, 300, Detail);
+            Report(bPassed, "uz3, uz3RandomAccessFile, no index", Detail);
+        }
+
+        uzLib::uz3FlushIndex Index;
+        Report(Index.Load(IndexFilename, Uz3Size) && Index.GetPackageSize() == Package.size(), "uz3, index loaded");
+        Report(!Index.Load(Dir + "/missing.uz3i", Uz3Size), "uz3, missing index rejected");
+        Report(!Index.Load(IndexFilename, Uz3Size + 1), "uz3, index of another size rejected");
+
+        // Header: Magic number, version, size of the uz3 data, number of flush points; entries of 2*8 bytes from byte 20
+        // on (the offset in the uz3 data, then in the package).
+        Report(LoadRejects<uzLib::uz3FlushIndex>(IndexFilename, DamagedFilename, Uz3Size,
+            [](string& Data) { Data[0] ^= 1; }), "uz3, index with a wrong magic number rejected");
+        Report(LoadRejects<uzLib::uz3FlushIndex>(IndexFilename, DamagedFilename, Uz3Size,
+            [](string& Data) { Data[4] ^= 1; }), "uz3, index with a wrong version rejected");
+        Report(LoadRejects<uzLib::uz3FlushIndex>(IndexFilename, DamagedFilename, Uz3Size,
+            [](string& Data) { Data.resize(Data.size() - 8); }), "uz3, truncated index rejected");
+        Report(LoadRejects<uzLib::uz3FlushIndex>(IndexFilename, DamagedFilename, Uz3Size,
+            [](string& Data) { Data[20] ^= 1; }), "uz3, index with a wrong first flush point rejected");
+        Report(LoadRejects<uzLib::uz3FlushIndex>(IndexFilename, DamagedFilename, Uz3Size,
+            [](string& Data) { memcpy(&Data[52], &Data[36], 2*sizeof(uint64_t)); }),
+            "uz3, index with flush points out of order rejected");
+
+        // An index which passes Load, but whose flush point is in the middle of a region: The inflate fails.
+        string Shifted = ReadFile(IndexFilename);
+        uint64_t ComprOffset;
+        memcpy(&ComprOffset, &Shifted[36], sizeof(ComprOffset));
+        ComprOffset += 3;
+        memcpy(&Shifted[36], &ComprOffset, sizeof(ComprOffset));
+        WriteFile(DamagedFilename, Shifted);
+        string Error;
+        try {
+            uzLib::DecompressFileFromUz3Parallel(Uz3Filename, DamagedFilename, OutFilename, 3);
+        }
+        catch (const std::exception& e) {
+            Error = e.what();
+        }
+        Report(!Error.empty(), "uz3, DecompressFileFromUz3Parallel, shifted flush point rejected", Error);
+
+        // An index which passes Load, but belongs to a package of another size: Ignored, the file is inflated on one
+        // thread.
+        string Foreign = ReadFile(IndexFilename);
+        uint64_t PackageSize;
+        memcpy(&PackageSize, &Foreign[Foreign.size() - sizeof(PackageSize)], sizeof(PackageSize));
+        ++PackageSize;
+        memcpy(&Foreign[Foreign.size() - sizeof(PackageSize)], &PackageSize, sizeof(PackageSize));
+        WriteFile(DamagedFilename, Foreign);
+        Error.clear();
+        try {
+            uzLib::DecompressFileFromUz3Parallel(Uz3Filename, DamagedFilename, OutFilename, 3);
+        }
+        catch (const std::exception& e) {
+            Error = e.what();
+        }
+        Report(Error.empty() && ReadFile(OutFilename) == Package, "uz3, DecompressFileFromUz3Parallel, foreign index ignored",
+            Error);
+
+        // A damaged region: The Adler-32 of the package doesn't match.
+        string Damaged = ReadFile(Uz3Filename);
+        Damaged[Damaged.size() - 2] ^= 1;
+        WriteFile(Uz3Filename, Damaged);
+        Error.clear();
+        try {
+            uzLib::DecompressFileFromUz3Parallel(Uz3Filename, IndexFilename, OutFilename, 3);
+        }
+        catch (const std::exception& e) {
+            Error = e.what();
+        }
+        Report(!Error.empty(), "uz3, DecompressFileFromUz3Parallel, wrong Adler-32 rejected", Error);
+
+        remove(Uz3Filename.c_str());
+        remove(IndexFilename.c_str());
+        remove(DamagedFilename.c_str());
+        remove(OutFilename.c_str());
+    }
+}
+
+int main() {
+    char DirTemplate[] = "/tmp/uzlib-indextest-XXXXXX";
+    if (mkdtemp(DirTemplate) == NULL) {
+        cout << "FAIL Couldn't create the temporary directory." << endl;
+        return 1;
+    }
+    const string Dir = DirTemplate;
+
+    try {
+        // 3.5 MB: Many uz2 chunks, and four uz3 regions with a flush point every MiB.
+        const string Package = MakePackage(3500000, 7);
+        TestUz2(Dir, Package);
+        TestUz3(Dir, Package);
+    }
+    catch (const std::exception& e) {
+        Report(false, "Unexpected exception", e.what());
+    }
+
+    remove(Dir.c_str());
+    return bAllPassed ? 0 : 1;
+}
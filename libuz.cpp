@@ -0,0 +1,409 @@
+/*
+libuz.cpp: Contains the implementation of the C interface in libuz.h.
+
+Language: C++
+*/
+
+#include "libuz.h"
+#include "uz1Impl.h"
+#include "uz2Impl.h"
+#include "uz3Impl.h"
+
+#include <stdexcept>
+#include <system_error>
+#include <new>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+#include <unistd.h>
+
+using namespace uzLib;
+
+
+struct uz_ctx
+{
+  uz1Codec Uz1Codec;
+  uz2Codec Uz2Codec;
+  uz3Codec Uz3Codec;
+  ByteVector InBuffer; // Content of the input descriptor.
+  ByteVector OutBuffer; // Result of the last call.
+  std::string LastError;
+  std::chrono::milliseconds Timeout; // Of the uz1 operations; 0 for none.
+
+  uz_ctx(): Timeout(0) { }
+};
+
+
+namespace
+{
+  // Error of read() or write(); mapped to UZ_ERR_IO.
+  class IOError: public std::runtime_error
+  {
+    public:
+      explicit IOError(const std::string& Msg): std::runtime_error(Msg + ": " + strerror(errno)) { }
+  };
+
+  // A uz1 operation was cancelled by the timeout of the context; mapped to UZ_ERR_TIMEOUT.
+  class TimeoutError: public std::runtime_error
+  {
+    public:
+      TimeoutError(): std::runtime_error("The operation took longer than the timeout of the context.") { }
+  };
+
+
+  // Decodes the UTF-8 string. Invalid sequences (including overlong forms and surrogates) and characters beyond U+FFFF,
+  // which don't fit into the 2-byte chars of the uz1 header, are rejected with a std::invalid_argument.
+  std::wstring DecodeUTF8(const char* Str)
+  {
+    std::wstring ToReturn;
+    const unsigned char* Cur = reinterpret_cast<const unsigned char*>(Str);
+    while (*Cur != 0)
+    {
+      unsigned int CodePoint = *Cur++;
+      int NumFollowing = 0;
+      unsigned int MinCodePoint = 0; // Smaller code points are overlong forms.
+      if (CodePoint >= 0xF8)
+        throw std::invalid_argument("The package name is not valid UTF-8.");
+      else if (CodePoint >= 0xF0)
+      {
+        CodePoint &= 0x07;
+        NumFollowing = 3;
+        MinCodePoint = 0x10000;
+      }
+      else if (CodePoint >= 0xE0)
+      {
+        CodePoint &= 0x0F;
+        NumFollowing = 2;
+        MinCodePoint = 0x800;
+      }
+      else if (CodePoint >= 0xC0)
+      {
+        CodePoint &= 0x1F;
+        NumFollowing = 1;
+        MinCodePoint = 0x80;
+      }
+      else if (CodePoint >= 0x80)
+        throw std::invalid_argument("The package name is not valid UTF-8.");
+
+      for (; NumFollowing > 0; --NumFollowing, ++Cur)
+      {
+        if ((*Cur & 0xC0) != 0x80) // Also stops at the terminating 0.
+          throw std::invalid_argument("The package name is not valid UTF-8.");
+        CodePoint = (CodePoint << 6) | (*Cur & 0x3F);
+      }
+
+      if (CodePoint < MinCodePoint || (CodePoint >= 0xD800 && CodePoint <= 0xDFFF) || CodePoint > 0x10FFFF)
+        throw std::invalid_argument("The package name is not valid UTF-8.");
+      if (CodePoint > 0xFFFF)
+        throw std::invalid_argument("The package name contains a character beyond U+FFFF, which can't be saved in a uz1 file.");
+
+      ToReturn += static_cast<wchar_t>(CodePoint);
+    }
+    return ToReturn;
+  }
+
+  // Returns true if the string only contains ASCII chars.
+  bool IsASCII(const char* Str)
+  {
+    for (; *Str != 0; ++Str)
+    {
+      if (static_cast<unsigned char>(*Str) > 0x7F)
+        return false;
+    }
+    return true;
+  }
+
+  // Reads the complete content of the descriptor into Target.
+  void ReadFd(int Fd, ByteVector& Target)
+  {
+    const size_t READ_SIZE = 0x10000;
+
+    Target.clear();
+    for (;;)
+    {
+      const size_t OldSize = Target.size();
+      Target.resize(OldSize + READ_SIZE);
+      const ssize_t NumRead = read(Fd, &Target[OldSize], READ_SIZE);
+      if (NumRead < 0)
+      {
+        Target.resize(OldSize);
+        if (errno == EINTR)
+          continue;
+        throw IOError("Couldn't read the input");
+      }
+
+      Target.resize(OldSize + NumRead);
+      if (NumRead == 0)
+        return;
+    }
+  }
+
+  // Writes the complete data to the descriptor.
+  void WriteFd(int Fd, const ByteVector& Data)
+  {
+    size_t NumWritten = 0;
+    while (NumWritten < Data.size())
+    {
+      const ssize_t Result = write(Fd, &Data[NumWritten], Data.size() - NumWritten);
+      if (Result < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        throw IOError("Couldn't write the output");
+      }
+      NumWritten += Result;
+    }
+  }
+
+  // Compresses InData into Ctx.OutBuffer.
+  void Compress(uz_ctx& Ctx, int Format, const SByteSpan& InData, const char* PkgName)
+  {
+    switch (Format)
+    {
+      case UZ_FORMAT_UZ1:
+      case UZ_FORMAT_UZ1_5678:
+      {
+        if (PkgName == NULL)
+          throw std::invalid_argument("The package name is missing.");
+
+        const EUz1Signature Uz1Sig = Format == UZ_FORMAT_UZ1 ? USIG_UT99 : USIG_5678;
+        SUz1Progress Progress;
+        if (Ctx.Timeout.count() > 0)
+          Progress.SetTimeout(Ctx.Timeout);
+        bool bCompleted = false;
+        if (IsASCII(PkgName))
+          bCompleted = Ctx.Uz1Codec.Compress(InData, Ctx.OutBuffer, std::string(PkgName), Uz1Sig, Progress);
+        else
+          bCompleted = Ctx.Uz1Codec.Compress(InData, Ctx.OutBuffer, DecodeUTF8(PkgName), Uz1Sig, Progress);
+        if (!bCompleted)
+          throw TimeoutError();
+        break;
+      }
+      case UZ_FORMAT_UZ2:
+        Ctx.Uz2Codec.Compress(InData, Ctx.OutBuffer);
+        break;
+      case UZ_FORMAT_UZ3:
+        Ctx.Uz3Codec.Compress(InData, Ctx.OutBuffer);
+        break;
+      default:
+        throw std::invalid_argument("Unknown format.");
+    }
+  }
+
+  // Decompresses InData into Ctx.OutBuffer.
+  void Decompress(uz_ctx& Ctx, int Format, const SByteSpan& InData)
+  {
+    switch (Format)
+    {
+      case UZ_FORMAT_UZ1:
+      case UZ_FORMAT_UZ1_5678:
+      {
+        SUz1Progress Progress;
+        if (Ctx.Timeout.count() > 0)
+          Progress.SetTimeout(Ctx.Timeout);
+        if (!Ctx.Uz1Codec.Decompress(InData, Ctx.OutBuffer, Progress))
+          throw TimeoutError();
+        break;
+      }
+      case UZ_FORMAT_UZ2:
+        Ctx.Uz2Codec.Decompress(InData, Ctx.OutBuffer);
+        break;
+      case UZ_FORMAT_UZ3:
+        Ctx.Uz3Codec.Decompress(InData, Ctx.OutBuffer);
+        break;
+      default:
+        throw std::invalid_argument("Unknown format.");
+    }
+  }
+
+  // Calls Func and translates the exceptions into error codes; no exception must leave the library.
+  template <class FuncT>
+  int CallGuarded(uz_ctx* pCtx, FuncT Func)
+  {
+    if (pCtx == NULL)
+      return UZ_ERR_INVALID_ARG;
+
+    int ToReturn = UZ_OK;
+    try
+    {
+      pCtx->LastError.clear();
+      Func(*pCtx);
+      return UZ_OK;
+    }
+    catch (const std::bad_alloc&)
+    {
+      ToReturn = UZ_ERR_NO_MEMORY;
+    }
+    catch (const std::invalid_argument& e)
+    {
+      ToReturn = UZ_ERR_INVALID_ARG;
+      pCtx->LastError = e.what();
+    }
+    catch (const IOError& e)
+    {
+      ToReturn = UZ_ERR_IO;
+      pCtx->LastError = e.what();
+    }
+    catch (const TimeoutError& e)
+    {
+      ToReturn = UZ_ERR_TIMEOUT;
+      pCtx->LastError = e.what();
+    }
+    catch (const std::system_error& e) // E.g. a thread couldn't be created.
+    {
+      ToReturn = UZ_ERR_INTERNAL;
+      pCtx->LastError = e.what();
+    }
+    catch (const std::runtime_error& e) // The codecs report invalid data with a std::runtime_error.
+    {
+      ToReturn = UZ_ERR_DATA;
+      pCtx->LastError = e.what();
+    }
+    catch (const std::exception& e)
+    {
+      ToReturn = UZ_ERR_INTERNAL;
+      pCtx->LastError = e.what();
+    }
+    catch (...)
+    {
+      ToReturn = UZ_ERR_INTERNAL;
+    }
+
+    // Assigning the message might throw as well.
+    try
+    {
+      if (pCtx->LastError.empty())
+        pCtx->LastError = uz_strerror(ToReturn);
+    }
+    catch (...)
+    {
+    }
+    return ToReturn;
+  }
+}
+
+
+//============================================================================================================================
+// C interface
+//============================================================================================================================
+
+int uz_abi_version(void)
+{
+  return UZ_ABI_VERSION;
+}
+
+uz_ctx* uz_ctx_new(void)
+{
+  try
+  {
+    return new uz_ctx;
+  }
+  catch (...)
+  {
+    return NULL;
+  }
+}
+
+void uz_ctx_free(uz_ctx* ctx)
+{
+  delete ctx;
+}
+
+const char* uz_ctx_last_error(const uz_ctx* ctx)
+{
+  return ctx != NULL ? ctx->LastError.c_str() : "";
+}
+
+int uz_ctx_set_limits(uz_ctx* ctx, size_t max_output, int max_huffman_depth, int max_huffman_nodes,
+    int max_bwt_blocks, long max_cpu_ms)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    if (max_huffman_depth < 0 || max_huffman_nodes < 0 || max_bwt_blocks < 0 || max_cpu_ms < 0)
+      throw std::invalid_argument("Negative limit passed.");
+
+    SUz1DecodeLimits Limits;
+    Limits.MaxOutputBytes = max_output;
+    Limits.MaxHuffmanDepth = max_huffman_depth;
+    Limits.MaxHuffmanNodes = max_huffman_nodes;
+    Limits.MaxBWTBlocks = max_bwt_blocks;
+    Limits.MaxCPUTime = std::chrono::milliseconds(max_cpu_ms);
+    Ctx.Uz1Codec.SetDecodeLimits(Limits);
+  });
+}
+
+int uz_ctx_set_timeout(uz_ctx* ctx, long timeout_ms)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    if (timeout_ms < 0)
+      throw std::invalid_argument("Negative timeout passed.");
+
+    Ctx.Timeout = std::chrono::milliseconds(timeout_ms);
+  });
+}
+
+const char* uz_strerror(int code)
+{
+  switch (code)
+  {
+    case UZ_OK: return "No error";
+    case UZ_ERR_INVALID_ARG: return "Invalid argument";
+    case UZ_ERR_NO_MEMORY: return "Out of memory";
+    case UZ_ERR_IO: return "Read or write error";
+    case UZ_ERR_DATA: return "Invalid or damaged data";
+    case UZ_ERR_INTERNAL: return "Internal error";
+    case UZ_ERR_TIMEOUT: return "Timeout";
+    default: return "Unknown error code";
+  }
+}
+
+int uz_compress(uz_ctx* ctx, int format, const unsigned char* in, size_t in_size, const char* pkg_name,
+    const unsigned char** out, size_t* out_size)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    if ((in == NULL && in_size > 0) || out == NULL || out_size == NULL)
+      throw std::invalid_argument("NULL pointer passed.");
+
+    Compress(Ctx, format, SByteSpan(in, in_size), pkg_name);
+    *out = Ctx.OutBuffer.empty() ? NULL : &Ctx.OutBuffer[0];
+    *out_size = Ctx.OutBuffer.size();
+  });
+}
+
+int uz_decompress(uz_ctx* ctx, int format, const unsigned char* in, size_t in_size,
+    const unsigned char** out, size_t* out_size)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    if ((in == NULL && in_size > 0) || out == NULL || out_size == NULL)
+      throw std::invalid_argument("NULL pointer passed.");
+
+    Decompress(Ctx, format, SByteSpan(in, in_size));
+    *out = Ctx.OutBuffer.empty() ? NULL : &Ctx.OutBuffer[0];
+    *out_size = Ctx.OutBuffer.size();
+  });
+}
+
+int uz_compress_fd(uz_ctx* ctx, int format, int in_fd, int out_fd, const char* pkg_name)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    ReadFd(in_fd, Ctx.InBuffer);
+    Compress(Ctx, format, SByteSpan(Ctx.InBuffer), pkg_name);
+    WriteFd(out_fd, Ctx.OutBuffer);
+  });
+}
+
+int uz_decompress_fd(uz_ctx* ctx, int format, int in_fd, int out_fd)
+{
+  return CallGuarded(ctx, [=](uz_ctx& Ctx)
+  {
+    ReadFd(in_fd, Ctx.InBuffer);
+    Decompress(Ctx, format, SByteSpan(Ctx.InBuffer));
+    WriteFd(out_fd, Ctx.OutBuffer);
+  });
+}
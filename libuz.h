@@ -0,0 +1,104 @@
+/*
+libuz.h: Contains the C interface of the shared library (libuz.so) for the uz1, uz2 and uz3 formats.
+
+Language: C
+*/
+
+#ifndef LIBUZ_H
+#define LIBUZ_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+  #define UZ_API __attribute__((visibility("default")))
+#else
+  #define UZ_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Version of the interface. Increased on incompatible changes (the soname is libuz.so.<UZ_ABI_VERSION>). */
+#define UZ_ABI_VERSION 1
+
+/* Formats. The uz1 signature and the uz3 magic number overlap (5678), so the decompression functions
+   can't detect the format and it must be passed. UZ_FORMAT_UZ1 decompresses both uz1 signatures. */
+enum
+{
+  UZ_FORMAT_UZ1 = 1,      /* uz1 with the signature 1234 (e.g. UT99) */
+  UZ_FORMAT_UZ1_5678 = 2, /* uz1 with the signature 5678 (e.g. Postal) */
+  UZ_FORMAT_UZ2 = 3,
+  UZ_FORMAT_UZ3 = 4
+};
+
+/* Error codes, returned by all functions which return an int. */
+enum
+{
+  UZ_OK = 0,
+  UZ_ERR_INVALID_ARG = -1, /* NULL pointer or unknown format */
+  UZ_ERR_NO_MEMORY = -2,
+  UZ_ERR_IO = -3,          /* read() or write() failed on a file descriptor */
+  UZ_ERR_DATA = -4,        /* The input is damaged or not in the given format */
+  UZ_ERR_INTERNAL = -5,    /* Any other error, e.g. a thread couldn't be created */
+  UZ_ERR_TIMEOUT = -6      /* The uz1 operation took longer than the timeout of the context */
+};
+
+/* Context: Owns the work buffers (which are reused by the following calls) and the output of the buffer
+   functions. A context must only be used by one thread at a time; different contexts are independent. */
+typedef struct uz_ctx uz_ctx;
+
+/* Returns UZ_ABI_VERSION of the library. */
+UZ_API int uz_abi_version(void);
+
+/* Creates a context; returns NULL if no memory is available. */
+UZ_API uz_ctx* uz_ctx_new(void);
+
+/* Frees the context and all its buffers. ctx may be NULL. */
+UZ_API void uz_ctx_free(uz_ctx* ctx);
+
+/* Returns the description of the error of the last call with this context ("" after a successful call).
+   Valid until the next call with this context. */
+UZ_API const char* uz_ctx_last_error(const uz_ctx* ctx);
+
+/* Sets the limits for the decompression of untrusted uz1 data with this context (see SUz1DecodeLimits in
+   uz1Impl.h): The size of the package, the max. code length and the number of nodes of the huffman tree,
+   the number of BWT blocks and the CPU time in milliseconds. 0 means no limit, which is the default of a
+   new context; negative values give UZ_ERR_INVALID_ARG. Data which exceeds a limit gives UZ_ERR_DATA.
+   The limits don't apply to uz2 and uz3. */
+UZ_API int uz_ctx_set_limits(uz_ctx* ctx, size_t max_output, int max_huffman_depth, int max_huffman_nodes,
+    int max_bwt_blocks, long max_cpu_ms);
+
+/* Sets the timeout in milliseconds for each following uz1 compression or decompression with this context:
+   An operation which runs longer is cancelled and gives UZ_ERR_TIMEOUT (the output of the buffer functions
+   is invalid then and nothing is written to the output descriptor). The time is measured from the start of
+   the operation on, i.e. without reading the input descriptor, and is checked between the slices of the
+   work, so it can be exceeded by a few milliseconds. 0 means no timeout, which is the default of a new
+   context; a negative value gives UZ_ERR_INVALID_ARG.
+   uz2 and uz3 can't be cancelled: The timeout doesn't apply to them. */
+UZ_API int uz_ctx_set_timeout(uz_ctx* ctx, long timeout_ms);
+
+/* Returns a static description of the error code. */
+UZ_API const char* uz_strerror(int code);
+
+/* Compresses in_size bytes at in. pkg_name is the name of the package, which is saved in uz1 files
+   (UTF-8; ignored for uz2 and uz3). Invalid UTF-8 and characters beyond U+FFFF (the uz1 header only has
+   2-byte chars) give UZ_ERR_INVALID_ARG. *out and *out_size receive the compressed data, which is owned by
+   the context and stays valid until the next call with it. */
+UZ_API int uz_compress(uz_ctx* ctx, int format, const unsigned char* in, size_t in_size, const char* pkg_name,
+    const unsigned char** out, size_t* out_size);
+
+/* Decompresses in_size bytes at in. *out and *out_size receive the package (same lifetime as above). */
+UZ_API int uz_decompress(uz_ctx* ctx, int format, const unsigned char* in, size_t in_size,
+    const unsigned char** out, size_t* out_size);
+
+/* Same as the buffer functions, but reads in_fd up to its end and writes the result to out_fd. Neither
+   descriptor is closed. Nothing is written if the input couldn't be read or processed. */
+UZ_API int uz_compress_fd(uz_ctx* ctx, int format, int in_fd, int out_fd, const char* pkg_name);
+UZ_API int uz_decompress_fd(uz_ctx* ctx, int format, int in_fd, int out_fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBUZ_H */
@@ -0,0 +1,234 @@
+#include "uz1Impl.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+using namespace std;
+
+// Regression tests for SUz1DecodeLimits: Hostile uz1 files must be rejected right away, instead of being decoded up to
+// the limit (or allocating memory for their header values).
+// Usage: uzlib-limitstest (make check)
+
+namespace {
+    // A 14-byte uz1 file: Signature, the name "ab", the huffman Total and a tree which only consists of the root (the
+    // symbols don't use any input bits, so nothing but the limits bounds the decoding).
+    string MakeRootOnlyFile(int Signature, unsigned int Total, unsigned char Symbol) {
+        unsigned char Data[] = { 0, 0, 0, 0, 3, 'a', 'b', 0, 0, 0, 0, 0, 0, 0 };
+        memcpy(Data, &Signature, sizeof(int));
+        memcpy(Data + 8, &Total, sizeof(int));
+        Data[12] = static_cast<unsigned char>(Symbol << 1); // Bit 0: Leaf; bits 1-8: The symbol.
+        Data[13] = static_cast<unsigned char>(Symbol >> 7);
+        return string(reinterpret_cast<const char*>(Data), sizeof(Data));
+    }
+
+    // The decoders which accept limits.
+    typedef void (*DecodeFunc)(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits);
+
+    void DecodeDefault(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::DecompressFromUz1(In, Out, OrigFilename, Limits);
+    }
+
+    void DecodePipelined(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::DecompressFromUz1Pipelined(In, Out, OrigFilename, Limits);
+    }
+
+    void DecodeSequential(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::DecompressFromUz1Sequential(In, Out, OrigFilename, Limits);
+    }
+
+    // The same with SUz1Progress instead of the update function.
+    void DecodeDefaultProgress(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::SUz1Progress Progress;
+        uzLib::DecompressFromUz1(In, Out, OrigFilename, Limits, Progress);
+    }
+
+    void DecodePipelinedProgress(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::SUz1Progress Progress;
+        uzLib::DecompressFromUz1Pipelined(In, Out, OrigFilename, Limits, Progress);
+    }
+
+    void DecodeSequentialProgress(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::SFilename OrigFilename;
+        uzLib::SUz1Progress Progress;
+        uzLib::DecompressFromUz1Sequential(In, Out, OrigFilename, Limits, Progress);
+    }
+
+    void DecodeStreamBuf(istream& In, ostream& Out, const uzLib::SUz1DecodeLimits& Limits) {
+        uzLib::uz1DecompressStreamBuf StreamBuf(In, Limits);
+        istream Package(&StreamBuf);
+        Package.exceptions(ios::badbit);
+
+        // Not Out << rdbuf(), which would catch the exceptions of the stream buffer.
+        char Buffer[0x10000];
+        while (Package.read(Buffer, sizeof(Buffer)) || Package.gcount() > 0)
+            Out.write(Buffer, Package.gcount());
+    }
+
+    const struct {
+        const char* Name;
+        DecodeFunc Decode;
+    } DECODERS[] = {
+        { "DecompressFromUz1", DecodeDefault },
+        { "DecompressFromUz1Pipelined", DecodePipelined },
+        { "DecompressFromUz1Sequential", DecodeSequential },
+        { "DecompressFromUz1 (SUz1Progress)", DecodeDefaultProgress },
+        { "DecompressFromUz1Pipelined (SUz1Progress)", DecodePipelinedProgress },
+        { "DecompressFromUz1Sequential (SUz1Progress)", DecodeSequentialProgress },
+        { "uz1DecompressStreamBuf", DecodeStreamBuf },
+    };
+
+    // Decodes the file with the limits through each decoder and returns true, if it's always rejected with ExpectedLimit
+    // within a second.
+    bool ExpectRejected(const char* Name, const string& File, const uzLib::SUz1DecodeLimits& Limits, const char* ExpectedLimit) {
+        bool bAllPassed = true;
+        for (size_t CurIndex = 0; CurIndex < sizeof(DECODERS)/sizeof(DECODERS[0]); ++CurIndex) {
+            const chrono::steady_clock::time_point Start = chrono::steady_clock::now();
+            string Error;
+            try {
+                istringstream In(File);
+                ostringstream Out;
+                DECODERS[CurIndex].Decode(In, Out, Limits);
+            }
+            catch (const std::exception& e) {
+                Error = e.what();
+            }
+            const double Seconds = chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+
+            const bool bPassed = Error.find(ExpectedLimit) != string::npos && Seconds < 1.0;
+            cout << (bPassed ? "PASS " : "FAIL ") << Name << ", " << DECODERS[CurIndex].Name << " (" << Seconds << "s): "
+                 << (Error.empty() ? "not rejected" : Error) << endl;
+            bAllPassed &= bPassed;
+        }
+        return bAllPassed;
+    }
+
+#ifndef _WIN32
+    // Cancels the decoding as soon as the second step (which writes the output file) reports its progress.
+    void CancelSecondStep(unsigned int, unsigned int, const wstring& Msg, bool& bCancel, void*) {
+        if (Msg.find(L"Burrows Wheeler") != wstring::npos)
+            bCancel = true;
+    }
+
+    // Decodes InFilename with DecompressFileFromUz1 (with pProgress instead of UpdateFunc, if it isn't NULL) and returns
+    // true, if it fails (with an exception containing ExpectedError, or by cancellation if ExpectedError is empty) and
+    // doesn't leave OutFilename behind.
+    bool ExpectFileRemoved(const char* Name, const string& InFilename, const string& OutFilename,
+        const uzLib::SUz1DecodeLimits& Limits, uzLib::pUz1UpdateFunc UpdateFunc, uzLib::SUz1Progress* pProgress,
+        const char* ExpectedError) {
+        string Error;
+        bool bResult = true;
+        try {
+            uzLib::SFilename OrigFilename;
+            if (pProgress != NULL)
+                bResult = uzLib::DecompressFileFromUz1(InFilename, OutFilename, OrigFilename, Limits, *pProgress);
+            else
+                bResult = uzLib::DecompressFileFromUz1(InFilename, OutFilename, OrigFilename, Limits, UpdateFunc);
+        }
+        catch (const std::exception& e) {
+            Error = e.what();
+        }
+        const bool bFailed = *ExpectedError == '\0' ? (!bResult && Error.empty()) : Error.find(ExpectedError) != string::npos;
+        const bool bRemoved = !ifstream(OutFilename.c_str()).is_open();
+
+        const bool bPassed = bFailed && bRemoved;
+        cout << (bPassed ? "PASS " : "FAIL ") << Name << ", DecompressFileFromUz1: "
+             << (Error.empty() ? (bResult ? "not rejected" : "cancelled") : Error)
+             << (bRemoved ? ", output file removed" : ", output file left behind") << endl;
+        remove(OutFilename.c_str());
+        return bPassed;
+    }
+#endif
+}
+
+int main() {
+    bool bPassed = true;
+
+    // Took 37s and 1.47 GB before the huffman Total was checked against MaxOutputBytes.
+    uzLib::SUz1DecodeLimits OutputLimit;
+    OutputLimit.MaxOutputBytes = 1024*1024;
+    bPassed &= ExpectRejected("1234, root-only tree, huge Total", MakeRootOnlyFile(uzLib::USIG_UT99, 1500000000, 0), OutputLimit,
+        "MaxOutputBytes");
+
+    // Total + Total/4 overflowed an int in the reservation of the 5678 path.
+    bPassed &= ExpectRejected("5678, root-only tree, Total > 1.7e9", MakeRootOnlyFile(uzLib::USIG_5678, 2000000000, 0xFF),
+        OutputLimit, "MaxOutputBytes");
+
+    uzLib::SUz1DecodeLimits BlockLimit;
+    BlockLimit.MaxBWTBlocks = 4;
+    bPassed &= ExpectRejected("5678, root-only tree, block limit", MakeRootOnlyFile(uzLib::USIG_5678, 2000000000, 0xFF),
+        BlockLimit, "MaxBWTBlocks");
+
+    // The class API allocated the huffman Total without looking at the limits.
+    {
+        const string File = MakeRootOnlyFile(uzLib::USIG_UT99, 1500000000, 0);
+        const size_t HUFFMAN_DATA_POS = 8; // Behind the signature and the name.
+        uzLib::uz1HuffmanAlgorithm Huffman;
+        Huffman.SetDecodeLimits(OutputLimit);
+
+        const chrono::steady_clock::time_point Start = chrono::steady_clock::now();
+        string Error;
+        try {
+            uzLib::ByteVector Out;
+            Huffman.Decompress(uzLib::SByteSpan(reinterpret_cast<const unsigned char*>(File.data()) + HUFFMAN_DATA_POS,
+                File.size() - HUFFMAN_DATA_POS), Out);
+        }
+        catch (const std::exception& e) {
+            Error = e.what();
+        }
+        const double Seconds = chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+
+        const bool bClassPassed = Error.find("MaxOutputBytes") != string::npos && Seconds < 1.0;
+        cout << (bClassPassed ? "PASS " : "FAIL ") << "1234, root-only tree, huge Total, uz1HuffmanAlgorithm::Decompress ("
+             << Seconds << "s): " << (Error.empty() ? "not rejected" : Error) << endl;
+        bPassed &= bClassPassed;
+    }
+
+#ifndef _WIN32
+    // A failed or cancelled file decompression left an output file of the estimated size behind, padded with zeros.
+    {
+        char DirTemplate[] = "/tmp/uzlib-limitstest-XXXXXX";
+        if (mkdtemp(DirTemplate) == NULL) {
+            cout << "FAIL Couldn't create the temporary directory." << endl;
+            return 1;
+        }
+        const string InFilename = string(DirTemplate) + "/test.uz";
+        const string OutFilename = string(DirTemplate) + "/test.u";
+
+        try {
+            // Long runs: The BWT data is tiny, so only the second step exceeds the output limit.
+            istringstream Package(string(1000000, 'a'));
+            ofstream Out(InFilename.c_str(), ios::binary | ios::trunc);
+            uzLib::CompressToUz1(Package, Out, string("Test.u"), uzLib::USIG_UT99);
+        }
+        catch (const std::exception& e) {
+            cout << "FAIL Couldn't create the test file: " << e.what() << endl;
+            bPassed = false;
+        }
+
+        uzLib::SUz1DecodeLimits FileLimit;
+        FileLimit.MaxOutputBytes = 100000;
+        bPassed &= ExpectFileRemoved("1234, output limit in the second step", InFilename, OutFilename, FileLimit, NULL,
+            NULL, "MaxOutputBytes");
+        bPassed &= ExpectFileRemoved("1234, cancelled in the second step", InFilename, OutFilename,
+            uzLib::SUz1DecodeLimits(), CancelSecondStep, NULL, "");
+        uzLib::SUz1Progress Progress;
+        bPassed &= ExpectFileRemoved("1234, output limit in the second step (SUz1Progress)", InFilename, OutFilename,
+            FileLimit, NULL, &Progress, "MaxOutputBytes");
+
+        remove(InFilename.c_str());
+        remove(DirTemplate);
+    }
+#endif
+
+    return bPassed ? 0 : 1;
+}
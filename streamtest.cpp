@@ -0,0 +1,91 @@
+#include "uz1Impl.h"
+#include "TestHelpers.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+using namespace std;
+
+// Regression tests of the uz1 compression variants: CompressToUz1Streaming and CompressFileToUz1 (POSIX only) must write
+// the same bytes as CompressToUz1, for both signatures, ASCII and Unicode package names, an empty package and packages of
+// several BWT blocks.
+// Usage: uzlib-streamtest (make check)
+
+namespace {
+#ifndef _WIN32
+    string g_Dir; // Temporary directory of the files of CompressFileToUz1.
+#endif
+
+    template <class T>
+    void TestPackage(const string& Package, const T& PkgFilename, uzLib::EUz1Signature Uz1Sig, const string& Name) {
+        istringstream In(Package);
+        ostringstream Expected;
+        uzLib::CompressToUz1(In, Expected, PkgFilename, Uz1Sig);
+
+        istringstream StreamingIn(Package);
+        ostringstream Streaming;
+        uzLib::CompressToUz1Streaming(StreamingIn, Streaming, PkgFilename, Uz1Sig);
+        Report(Streaming.str() == Expected.str(), "CompressToUz1Streaming, " + Name + " (same as CompressToUz1)");
+
+#ifndef _WIN32
+        const string InFilename = g_Dir + "/test.u";
+        const string OutFilename = g_Dir + "/test.uz";
+        WriteFile(InFilename, Package);
+        uzLib::CompressFileToUz1(InFilename, OutFilename, PkgFilename, Uz1Sig);
+        Report(ReadFile(OutFilename) == Expected.str(), "CompressFileToUz1, " + Name + " (same as CompressToUz1)");
+        remove(InFilename.c_str());
+        remove(OutFilename.c_str());
+#endif
+    }
+}
+
+int main() {
+    const struct {
+        const char* Name;
+        size_t Size;
+    } PACKAGES[] = {
+        { "empty", 0 },
+        { "1 byte", 1 },
+        { "100 KB", 100000 },
+        { "1.1 MB (several BWT blocks)", 1100000 },
+    };
+    const struct {
+        const char* Name;
+        uzLib::EUz1Signature Uz1Sig;
+    } SIGNATURES[] = {
+        { "1234", uzLib::USIG_UT99 },
+        { "5678", uzLib::USIG_5678 },
+    };
+
+#ifndef _WIN32
+    char DirTemplate[] = "/tmp/uzlib-streamtest-XXXXXX";
+    if (mkdtemp(DirTemplate) == NULL) {
+        cout << "FAIL Couldn't create the temporary directory." << endl;
+        return 1;
+    }
+    g_Dir = DirTemplate;
+#endif
+
+    try {
+        for (size_t CurPackage = 0; CurPackage < sizeof(PACKAGES)/sizeof(PACKAGES[0]); ++CurPackage) {
+            const string Package = MakePackage(PACKAGES[CurPackage].Size, 11);
+            for (size_t CurSig = 0; CurSig < sizeof(SIGNATURES)/sizeof(SIGNATURES[0]); ++CurSig) {
+                const string Name = string(SIGNATURES[CurSig].Name) + ", " + PACKAGES[CurPackage].Name;
+                TestPackage(Package, string("Test.u"), SIGNATURES[CurSig].Uz1Sig, Name + ", ASCII name");
+                TestPackage(Package, wstring(L"T\u00E4st\u4E2D.u"), SIGNATURES[CurSig].Uz1Sig, Name + ", Unicode name");
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        Report(false, "Unexpected exception", e.what());
+    }
+
+#ifndef _WIN32
+    remove(g_Dir.c_str());
+#endif
+
+    return bAllPassed ? 0 : 1;
+}
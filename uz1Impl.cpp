@@ -7,6 +7,9 @@ Created by Gugi, 2010-2011
 */
 
 #include "uz1Impl.h"
+#ifndef _WIN32
+  #include "FileMapping.h" // POSIX only; used by the file versions (CompressFileToUz1 and DecompressFileFromUz1).
+#endif
 
 #include <vector>
 #include <algorithm>
@@ -14,8 +17,21 @@ Created by Gugi, 2010-2011
 #include <cassert>
 #include <sstream>
 #include <stdexcept>
-
-#include <boost/dynamic_bitset.hpp>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <cstdio>
+#include <limits>
+#include <cstdint>
+#ifdef _WIN32
+  #define NOMINMAX // Keeps std::numeric_limits<>::max() usable.
+  #include <windows.h> // GetThreadTimes
+#else
+  #include <ctime> // clock_gettime
+#endif
 
 #if (BWT_SORT_TYPE == BWT_EXT_SORT)
   #include "bwtsort.h"
@@ -138,32 +154,6 @@ namespace
 #endif
   }
   
-  // Tries to read the next byte from the stream. Returns false on failure.
-  inline bool TryReadNextByte(uzLib::in_stream& InStream, BYTE& OutByte)
-  {
-#ifdef AGRESSIVE_OPTIMIZATION
-
-    const in_stream::int_type ReadByte = InStream.rdbuf()->sbumpc();
-    
-    // Check if the byte is valid.
-    if (!in_stream::traits_type::eq_int_type(ReadByte, in_stream::traits_type::eof()))
-    {
-      OutByte = static_cast<BYTE>(ReadByte);
-      return true;
-    }
-    
-    InStream.setstate(ios::eofbit);
-    return false;
-    
-#else
-
-    if (IsEOF(InStream)) // Call this first so that failbit isn't set (which causes an exception).
-      return false;
-    OutByte = ReadByte(InStream);
-    return InStream.good();   
-#endif
-  }
-    
   // Returns the total size of the stream. This should be a slow function as several seeking-operations are required.
   int GetTotalStreamLength(uzLib::in_stream& InStream)
   {
@@ -195,33 +185,39 @@ namespace
     return static_cast<int>(EndPos - BegPos);
   }
   
-  // Copies max. the specified number of bytes into the destination vector (at the end) and returns the number of copied bytes.
-  int CopyDataToVector(uzLib::in_stream& InStream, vector<unsigned char>& Destination, const size_t Count)
+  // Reads the remaining data of the stream (i.e. from the current position up to the end) in one go into the buffer.
+  // The buffer is resized accordingly.
+  void ReadStreamToBuffer(uzLib::in_stream& InStream, ByteVector& Destination)
   {
-    // Faster version (at least in aggressive-optimization mode, the other one I did not test).
-    size_t NumExtractedBytes = 0;
-    BYTE CurByte;
-    while (NumExtractedBytes < Count && TryReadNextByte(InStream, CurByte))
-    {
-      Destination.push_back((unsigned char)CurByte);
-      ++NumExtractedBytes;
-    }
-    return NumExtractedBytes;
+    const int CurPos = static_cast<int>(InStream.tellg());
+    const int StreamLength = GetTotalStreamLength(InStream);
+    if (CurPos < 0 || CurPos > StreamLength)
+      throw std::logic_error("Invalid stream position in ReadStreamToBuffer.");
     
-    // Slower version.
-    
-    //std::istreambuf_iterator<BYTE> InIter(InStream);
-    //const std::istreambuf_iterator<BYTE> EndIter;
-    //
-    //size_t NumExtractedBytes = 0;
-    //for (; 
-    //    NumExtractedBytes < Count && InIter != EndIter; 
-    //    ++NumExtractedBytes, ++InIter)
-    //{
-    //  Destination.push_back(*InIter);
-    //}
-    //
-    //return NumExtractedBytes;
+    Destination.resize(StreamLength - CurPos);
+    if (!Destination.empty())
+      InStream.read(reinterpret_cast<BYTE*>(&Destination[0]), Destination.size());
+  }
+  
+  // Writes the complete buffer in one go to the stream.
+  void WriteBufferToStream(uzLib::out_stream& OutStream, const SByteSpan& Source)
+  {
+    if (Source.Length > 0)
+      OutStream.write(reinterpret_cast<const BYTE*>(Source.Data), Source.Length);
+  }
+  
+  // Reads an int from the buffer (same byte order as ReadInt()).
+  inline int GetInt(const unsigned char* Source)
+  {
+    int ToReturn;
+    memcpy(&ToReturn, Source, sizeof(int));
+    return ToReturn;
+  }
+  
+  // Writes an int to the buffer (same byte order as WriteInt()).
+  inline void PutInt(unsigned char* Target, int ToWrite)
+  {
+    memcpy(Target, &ToWrite, sizeof(int));
   }
   
   // Reads a compact index (compressed int) from the stream.
@@ -263,45 +259,93 @@ namespace
     return ToReturn;
   }
   
-  // Writes the specified integer in a compressed format to the stream.
-  void WriteCompactIndex(out_stream& OutStream, int ToWrite)
+  // Writes the specified integer in a compressed format to the buffer (max. MAX_COMPACT_INDEX_SIZE bytes) and returns
+  // the number of written bytes.
+  const size_t MAX_COMPACT_INDEX_SIZE = 5;
+  size_t PutCompactIndex(unsigned char* Target, int ToWrite)
   {
     unsigned int AbsIn = ::abs(ToWrite);
+    size_t NumBytes = 0;
     
-    BYTE FirstByte = ((ToWrite>=0) ? 0 : 0x80);
+    unsigned char FirstByte = ((ToWrite>=0) ? 0 : 0x80);
     if (AbsIn < 0x40)
-      FirstByte += static_cast<BYTE>(AbsIn);
+      FirstByte += static_cast<unsigned char>(AbsIn);
     else
       FirstByte += ((AbsIn & 0x3f) + 0x40);
     
-    WriteByte(OutStream, FirstByte);
+    Target[NumBytes++] = FirstByte;
     if ((FirstByte & 0x40) != 0)
     {
       AbsIn >>= 6;
-      const BYTE SecondByte = (AbsIn < 0x80) ? static_cast<BYTE>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
-      WriteByte(OutStream, SecondByte);
+      const unsigned char SecondByte = (AbsIn < 0x80) ? static_cast<unsigned char>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
+      Target[NumBytes++] = SecondByte;
       
       if ((SecondByte & 0x80) != 0)
       {
         AbsIn >>= 7;
-        const BYTE ThirdByte = (AbsIn < 0x80) ? static_cast<BYTE>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
-        WriteByte(OutStream, ThirdByte);
+        const unsigned char ThirdByte = (AbsIn < 0x80) ? static_cast<unsigned char>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
+        Target[NumBytes++] = ThirdByte;
         
         if ((ThirdByte & 0x80) != 0)
         {
           AbsIn >>= 7;
-          const BYTE FourthByte = (AbsIn < 0x80) ? static_cast<BYTE>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
-          WriteByte(OutStream, FourthByte);
+          const unsigned char FourthByte = (AbsIn < 0x80) ? static_cast<unsigned char>(AbsIn) : ((AbsIn & 0x7f) + 0x80);
+          Target[NumBytes++] = FourthByte;
           
           if ((FourthByte & 0x80) != 0)
           {
             AbsIn >>= 7;
-            BYTE FifthByte = static_cast<BYTE>(AbsIn);
-            WriteByte(OutStream, FifthByte);
+            Target[NumBytes++] = static_cast<unsigned char>(AbsIn);
+          }
+        }
+      }
+    }
+    
+    return NumBytes;
+  }
+  
+  // Returns the byte at Pos and advances Pos. A std::runtime_error is thrown if Pos is at the end of the buffer.
+  inline unsigned char GetByteChecked(const unsigned char*& Pos, const unsigned char* End)
+  {
+    if (Pos == End)
+      throw std::runtime_error("Reached the end of the data while reading the uz-header.");
+    
+    return *Pos++;
+  }
+  
+  // Reads a compact index from the buffer (see ReadCompactIndex); Pos is advanced.
+  int GetCompactIndex(const unsigned char*& Pos, const unsigned char* End)
+  {
+    int ToReturn = 0;
+  
+    const unsigned char FirstByte = GetByteChecked(Pos, End);
+    if ((FirstByte & 0x40) != 0)
+    {
+      const unsigned char SecondByte = GetByteChecked(Pos, End);
+      if ((SecondByte & 0x80) != 0)
+      {
+        const unsigned char ThirdByte = GetByteChecked(Pos, End);
+        if ((ThirdByte & 0x80) != 0)
+        {
+          const unsigned char FourthByte = GetByteChecked(Pos, End);
+          if ((FourthByte & 0x80) != 0)
+          {
+            const unsigned char FifthByte = GetByteChecked(Pos, End);
+            ToReturn = FifthByte;
           }
+          ToReturn = (ToReturn << 7) | (FourthByte & 0x7f);
         }
+        ToReturn = (ToReturn << 7) | (ThirdByte & 0x7f);
       }
+      ToReturn = (ToReturn << 7) | (SecondByte & 0x7f);
     }
+    
+    ToReturn = (ToReturn << 6) | (FirstByte & 0x3f);
+    
+    if ((FirstByte & 0x80) != 0)
+      ToReturn = -ToReturn;
+    
+    return ToReturn;
   }
   
   // Reads data as chars from the stream until it encounters a 0 byte; the data is returned as a string.
@@ -321,23 +365,182 @@ namespace
     return ToReturn;
   }
   
-  // Reads data as wchar_ts from the stream until it encounters a 0 byte; the data is returned as a string.
+  // Reads data as 2-byte chars from the stream until it encounters a 0 char; the data is returned as a string.
   std::wstring ReadUnicodeString(in_stream& InStream)
   {
     std::wstring ToReturn;
     
-    wchar_t LastChar = 0;
+    uint16_t LastChar = 0;
     do
     {
-      LastChar = ReadData<wchar_t>(InStream);
-      if (LastChar != L'\0')
-        ToReturn += LastChar;
+      LastChar = ReadData<uint16_t>(InStream);
+      if (LastChar != 0)
+        ToReturn += static_cast<wchar_t>(LastChar);
     } 
     while (LastChar != 0 && !IsEOF(InStream));
     
     return ToReturn;
   }
+  
+  // Progress policies of the compression/decompression steps: The steps are templates on the policy and call it between
+  // their slices (or chunks); true is returned, if the operation should be cancelled. NoProgress is used if no update
+  // function is passed, so that its instantiations don't contain any callback checks.
+  struct NoProgress
+  {
+    bool operator()(unsigned int /*CurStatus*/, unsigned int /*CompletedStatus*/, const std::wstring& /*Msg*/)const
+    {
+      return false;
+    }
+
+    void NextStep() { }
+  };
+
+  // Calls the update function (which must not be NULL).
+  class CallbackProgress
+  {
+    public:
+      CallbackProgress(pUz1UpdateFunc UpdateFunc, void* UserObj): m_UpdateFunc(UpdateFunc), m_pUserObj(UserObj)
+      { }
+
+      bool operator()(unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)const
+      {
+        bool bCancel = false;
+        (*m_UpdateFunc)(CurStatus, CompletedStatus, Msg, bCancel, m_pUserObj);
+        return bCancel;
+      }
+      
+      void NextStep() { }
+
+    private:
+      pUz1UpdateFunc m_UpdateFunc;
+      void* m_pUserObj;
+  };
+
+  // Calls the update function (which must not be NULL) with the number of the current step in front of the message,
+  // e.g. "(2/5) Msg" (as uz1AlgorithmBase does). NextStep() must be called at the beginning of each step; messages
+  // before the first step (e.g. "Initializing...") are passed as they are.
+  class StepProgress
+  {
+    public:
+      StepProgress(pUz1UpdateFunc UpdateFunc, void* UserObj, int NumSteps):
+        m_Callback(UpdateFunc, UserObj), m_ThisStepNum(0), m_NumSteps(NumSteps)
+      { }
+
+      bool operator()(unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)const
+      {
+        if (m_ThisStepNum == 0)
+          return m_Callback(CurStatus, CompletedStatus, Msg);
+        
+        // The message with the step number is only built if the message changes (see uz1AlgorithmBase).
+        if (Msg != m_LastMsg)
+        {
+          m_LastMsg = Msg;
+          m_StepMsg = m_StepPrefix + Msg;
+        }
+        return m_Callback(CurStatus, CompletedStatus, m_StepMsg);
+      }
+
+      void NextStep()
+      {
+        std::wstringstream StrStream;
+        StrStream << L"(" << ++m_ThisStepNum << L"/" << m_NumSteps << L") ";
+        m_StepPrefix = StrStream.str();
+        m_LastMsg.clear();
+        m_StepMsg = m_StepPrefix; // For an empty message.
+      }
+
+    private:
+      CallbackProgress m_Callback;
+      int m_ThisStepNum;
+      int m_NumSteps;
+      std::wstring m_StepPrefix; // E.g. "(2/5) ".
+      mutable std::wstring m_LastMsg;
+      mutable std::wstring m_StepMsg;
+  };
+
+  // Stores the progress in a SUz1Progress and returns its cancel flag. Only relaxed atomic loads and stores; the
+  // message is ignored.
+  class AtomicProgress
+  {
+    public:
+      AtomicProgress(SUz1Progress& Progress, int NumSteps): m_Progress(Progress), m_ThisStepNum(0)
+      {
+        m_Progress.Step.store(0, std::memory_order_relaxed);
+        m_Progress.NumSteps.store(NumSteps, std::memory_order_relaxed);
+      }
+
+      bool operator()(unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& /*Msg*/)const
+      {
+        m_Progress.CurStatus.store(CurStatus, std::memory_order_relaxed);
+        m_Progress.CompletedStatus.store(CompletedStatus, std::memory_order_relaxed);
+        return m_Progress.IsCancelled();
+      }
+
+      void NextStep() { m_Progress.Step.store(++m_ThisStepNum, std::memory_order_relaxed); }
+      
+      const SUz1Progress& GetProgress()const { return m_Progress; }
+
+    private:
+      SUz1Progress& m_Progress;
+      int m_ThisStepNum;
+  };
+  
+  // Returns the cancellation token, which is checked inside long-running loops (e.g. the BWT sort), or NULL.
+  template <class ProgressT>
+  const SUz1Progress* GetCancelToken(const ProgressT& /*Progress*/)
+  {
+    return NULL;
+  }
+  
+  const SUz1Progress* GetCancelToken(const AtomicProgress& Progress)
+  {
+    return &Progress.GetProgress();
+  }
+
+  // Receiver of the progress of an operation: The update function (if not NULL) or the SUz1Progress (if not NULL).
+  struct SProgressTarget
+  {
+    pUz1UpdateFunc UpdateFunc;
+    void* UserObj;
+    SUz1Progress* pProgress;
+  };
+
+  SProgressTarget MakeProgressTarget(pUz1UpdateFunc UpdateFunc, void* UserObj)
+  {
+    const SProgressTarget Target = { UpdateFunc, UserObj, NULL };
+    return Target;
+  }
+
+  SProgressTarget MakeProgressTarget(SUz1Progress& Progress)
+  {
+    const SProgressTarget Target = { NULL, NULL, &Progress };
+    return Target;
+  }
 
+  // Calls Func with the progress policy of the target (NoProgress, if there is none) and returns its result.
+  // NumSteps is 0 for the functions without steps (the messages of the update function are passed as they are then).
+  template <class FuncT>
+  bool RunWithProgress(const SProgressTarget& Target, int NumSteps, FuncT Func)
+  {
+    if (Target.UpdateFunc != NULL && NumSteps == 0)
+    {
+      CallbackProgress Progress(Target.UpdateFunc, Target.UserObj);
+      return Func(Progress);
+    }
+    else if (Target.UpdateFunc != NULL)
+    {
+      StepProgress Progress(Target.UpdateFunc, Target.UserObj, NumSteps);
+      return Func(Progress);
+    }
+    else if (Target.pProgress != NULL)
+    {
+      AtomicProgress Progress(*Target.pProgress, NumSteps);
+      return Func(Progress);
+    }
+    
+    NoProgress Progress;
+    return Func(Progress);
+  }
 }
 
 
@@ -362,61 +565,48 @@ namespace
     assert(!InStream.fail());
   }*/
 
-  // Removes the content from the specified str-stream and resets the object.
-  bool ResetBuffer(std::basic_stringstream<BYTE>& ToReset, const std::basic_string<BYTE>& EmptyBufferValue)
-  {  
-    ToReset.clear();
-    ToReset.seekg(0, std::ios::beg);
-    ToReset.seekp(0, std::ios::beg);
-    ToReset.str(EmptyBufferValue);
-    
-    if (!ToReset.good())
-      throw std::runtime_error("Failed reseting buffer.");
-    
-    //return (ToReset.good());
-    return true;
-  }
-  
-  // Does the decompressing of the input buffer, and sets the buffers up for the next decompressing step.
-  bool DoDecompressing(uzLib::uz1AlgorithmBase& Algorithm, 
-      std::basic_stringstream<BYTE>*& pInBuffer, std::basic_stringstream<BYTE>*& pOutBuffer, 
-      const std::basic_string<BYTE>& EmptyBufferValue)
+  // Appends the signature and the length of the filename (including the terminating 0 char) to the buffer.
+  // FilenameLen is negative for a unicode filename.
+  void AppendUz1HeaderStart(ByteVector& Target, int Uz1Signature, int FilenameLen)
   {
-    if (!Algorithm.Decompress(*pInBuffer, *pOutBuffer))
-      return false;
-    
-    std::swap(pInBuffer, pOutBuffer);
-    return ResetBuffer(*pOutBuffer, EmptyBufferValue);    
+    const size_t OldSize = Target.size();
+    Target.resize(OldSize + sizeof(int) + MAX_COMPACT_INDEX_SIZE);
+    PutInt(&Target[OldSize], Uz1Signature);
+    Target.resize(OldSize + sizeof(int) + PutCompactIndex(&Target[OldSize + sizeof(int)], FilenameLen));
   }
   
-  // Does the cmpressing of the input buffer, and sets the buffers up for the next compressing step.
-  bool DoCompressing(uzLib::uz1AlgorithmBase& Algorithm, 
-      std::basic_stringstream<BYTE>*& pInBuffer, std::basic_stringstream<BYTE>*& pOutBuffer, 
-      const std::basic_string<BYTE>& EmptyBufferValue)
-  {
-    if (!Algorithm.Compress(*pInBuffer, *pOutBuffer))
-      return false;
-    
-    std::swap(pInBuffer, pOutBuffer);
-    return ResetBuffer(*pOutBuffer, EmptyBufferValue);    
-  }
-
-  // Writes the filename to the stream (including length); in ASCII chars.
-  void WriteFilename(out_stream& OutStream, const std::string& PkgFilename)
+  // Appends the header of the uz1-file (signature and filename including length) to the buffer; in ASCII chars.
+  void AppendUz1Header(ByteVector& Target, int Uz1Signature, const std::string& PkgFilename)
   {
     const int FilenameLen = PkgFilename.length()+1; // +1: Include terminating 0 char.
   
-    WriteCompactIndex(OutStream, FilenameLen); // positive, to indicate an unicode string.
-    OutStream.write(reinterpret_cast<const BYTE*>(PkgFilename.c_str()), FilenameLen);
+    AppendUz1HeaderStart(Target, Uz1Signature, FilenameLen); // positive, to indicate an ASCII string.
+    Target.insert(Target.end(), PkgFilename.c_str(), PkgFilename.c_str() + FilenameLen);
   }
   
-  // Writes the filename to the stream (including length); in Unicode chars.
-  void WriteFilename(out_stream& OutStream, const std::wstring& PkgFilename)
+  // Appends the header of the uz1-file (signature and filename including length) to the buffer; in Unicode chars.
+  void AppendUz1Header(ByteVector& Target, int Uz1Signature, const std::wstring& PkgFilename)
   {
     const int FilenameLen = PkgFilename.length()+1; // +1: Include terminating 0 char.
   
-    WriteCompactIndex(OutStream, -FilenameLen); // "-" to indicate an unicode string.
-    OutStream.write(reinterpret_cast<const BYTE*>(PkgFilename.c_str()), FilenameLen*2); // 2: sizeof(wchar_t)
+    AppendUz1HeaderStart(Target, Uz1Signature, -FilenameLen); // "-" to indicate an unicode string.
+    
+    // The chars are saved with 2 bytes each, independent of sizeof(wchar_t).
+    const wchar_t* const Chars = PkgFilename.c_str();
+    for (int CurCharIndex = 0; CurCharIndex < FilenameLen; ++CurCharIndex)
+    {
+      Target.push_back(static_cast<unsigned char>(Chars[CurCharIndex] & 0xFF));
+      Target.push_back(static_cast<unsigned char>((Chars[CurCharIndex] >> 8) & 0xFF));
+    }
+  }
+  
+  // Writes the header of the uz1-file (signature and filename including length) to the stream.
+  template <class T>
+  void WriteUz1Header(out_stream& OutStream, int Uz1Signature, const T& PkgFilename)
+  {
+    ByteVector Header;
+    AppendUz1Header(Header, Uz1Signature, PkgFilename);
+    WriteBufferToStream(OutStream, Header);
   }
   
   // In case the unicode string only contains ASCII chars (i.e. chars <= 0x7F), the string is converted and
@@ -434,205 +624,476 @@ namespace
     
     return true;
   }
-}
-
-namespace
-{
-  // Compression (ASCII or Unicode package name); basically the reverse of the decompression algorithm.
-  template <class T>
-  bool CompressToUz1_Templ(in_stream& InStream, out_stream& OutStream, const T& PkgFilename, EUz1Signature Uz1Sig, 
-      uzLib::pUz1UpdateFunc UpdateFunc, void* UserObj)
+  
+  // Reads the header of the uz1-file (signature and original filename) and returns the signature.
+  // Afterwards the stream points to the beginning of the compressed data.
+  int ReadUz1Header(in_stream& InStream, SFilename& OrigFilename)
   {
-    // Send an initial update.
-    if (UpdateFunc != NULL)
-    {
-      bool bCancel = false;
-      (*UpdateFunc)(0, 1, L"Initializing...", bCancel, UserObj);
-      if (bCancel)
-        return false;
-    }
-    
-    InStream.clear(); // Clear any bad-flags.
-    InStream.seekg(0, ios_base::beg); // Move the in-pointer to the beginning.
-    InStream.exceptions(std::ios::badbit | std::ios::failbit);
+    // uz file format
+    // 1) DWORD: Sig
+    // 2) FCompactIndex: StrLen Incl 0 char
+    // 3) char-array: Orig filename (ends with \0).
+    // 4) File data
     
-    const int Uz1Signature = static_cast<int>(Uz1Sig);
+    // Check if it is a valid uz1 file.
+    const int Uz1Signature = ReadInt(InStream);
+    if (Uz1Signature != 1234 && Uz1Signature != 5678)
+      throw runtime_error("Input stream is not a valid uz-file.");
     
-    // Write signature
-    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
-    WriteInt(OutStream, Uz1Signature);
+    // Read the length of the saved original filename. Includes the terminating 0 character.
+    const int OrigFilenameLen = ReadCompactIndex(InStream);
+    if (OrigFilenameLen == 0)
+      throw runtime_error("Original filename length is 0.");
     
-    // Write the filename (including length).
-    WriteFilename(OutStream, PkgFilename);
+    // Read the original filename.
+    if (OrigFilenameLen > 0) // > 0: ASCII string.
+    {
+      OrigFilename.FilenameType = FT_ASCII;
+      OrigFilename.ASCIIStr = ReadASCIIString(InStream);
+      
+      if (static_cast<int>(OrigFilename.ASCIIStr.length()) != OrigFilenameLen-1) // -1: terminating 0 byte
+        throw runtime_error("Original filename and its saved length are different.");
+    }
+    else // < 0: Unicode string.
+    {
+      OrigFilename.FilenameType = FT_UNICODE;
+      OrigFilename.UnicodeStr = ReadUnicodeString(InStream);
+      
+      if (static_cast<int>(OrigFilename.UnicodeStr.length()) != (-OrigFilenameLen)-1) // -1: terminating 0 byte
+        throw runtime_error("Original filename and its saved length are different.");
+    }
     
-    // Create buffer 1.
-    std::basic_stringstream<BYTE> Buffer1(std::ios::binary | std::ios::in | std::ios::out);
-    const std::basic_string<BYTE> EmptyBufferValue = Buffer1.str();
-    Buffer1.exceptions(std::ios::badbit | std::ios::failbit);
+    return Uz1Signature;
+  }
+  
+  // Buffer version of ReadUz1Header: Parses the header at the beginning of InData and returns the signature.
+  // HeaderSize is set to the size of the header, i.e. to the offset of the compressed data.
+  int ParseUz1Header(const SByteSpan& InData, SFilename& OrigFilename, size_t& HeaderSize)
+  {
+    const unsigned char* Pos = InData.Data;
+    const unsigned char* const End = InData.Data + InData.Length;
     
-    // Create second buffer.
-    std::basic_stringstream<BYTE> Buffer2(std::ios::binary | std::ios::in | std::ios::out);
-    Buffer2.exceptions(std::ios::badbit | std::ios::failbit);
+    // Check if it is a valid uz1 file.
+    if (InData.Length < sizeof(int))
+      throw runtime_error("Input stream is not a valid uz-file.");
+    const int Uz1Signature = GetInt(Pos);
+    if (Uz1Signature != 1234 && Uz1Signature != 5678)
+      throw runtime_error("Input stream is not a valid uz-file.");
+    Pos += sizeof(int);
     
-    // Pointers used to access always the correct stream easily
-    std::basic_stringstream<BYTE>* pInBuffer = &Buffer1;
-    std::basic_stringstream<BYTE>* pOutBuffer = &Buffer2;
+    // Read the length of the saved original filename. Includes the terminating 0 character.
+    const int OrigFilenameLen = GetCompactIndex(Pos, End);
+    if (OrigFilenameLen == 0)
+      throw runtime_error("Original filename length is 0.");
     
+    // Read the original filename (up to the 0 char or the end of the data).
+    if (OrigFilenameLen > 0) // > 0: ASCII string.
+    {
+      OrigFilename.FilenameType = FT_ASCII;
+      OrigFilename.ASCIIStr.clear();
+      
+      unsigned char CurChar = 0;
+      do
+      {
+        CurChar = GetByteChecked(Pos, End);
+        if (CurChar != 0)
+          OrigFilename.ASCIIStr += static_cast<char>(CurChar);
+      }
+      while (CurChar != 0 && Pos != End);
+      
+      if (static_cast<int>(OrigFilename.ASCIIStr.length()) != OrigFilenameLen-1) // -1: terminating 0 byte
+        throw runtime_error("Original filename and its saved length are different.");
+    }
+    else // < 0: Unicode string.
+    {
+      OrigFilename.FilenameType = FT_UNICODE;
+      OrigFilename.UnicodeStr.clear();
+      
+      for (;;)
+      {
+        if (End - Pos < 2)
+          throw runtime_error("Reached the end of the data while reading the uz-header.");
+        
+        const wchar_t CurChar = static_cast<wchar_t>(Pos[0] | (Pos[1] << 8));
+        Pos += 2;
+        if (CurChar == 0)
+          break;
+        
+        OrigFilename.UnicodeStr += CurChar;
+        if (Pos == End)
+          break;
+      }
+      
+      if (static_cast<int>(OrigFilename.UnicodeStr.length()) != (-OrigFilenameLen)-1) // -1: terminating 0 byte
+        throw runtime_error("Original filename and its saved length are different.");
+    }
     
-    // Compress the data from here on.
-    const int NumSteps = (Uz1Sig == USIG_5678) ? 5 : 4; // The number of compression steps.
-    int CurStep = 0;
+    HeaderSize = Pos - InData.Data;
+    return Uz1Signature;
+  }
+}
+
+namespace
+{
+  // Kernels of the compression steps; defined in the algorithm implementations below.
+  template <class ProgressT>
+  bool EncodeRLEStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress);
+  template <class ProgressT>
+  bool EncodeBWTStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress);
+  template <class ProgressT>
+  bool EncodeMTFStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress);
+  template <class ProgressT>
+  bool EncodeHuffmanStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress);
+  
+  // Runs the compression step on the input buffer and sets the buffers up for the next step.
+  template <class ProgressT>
+  bool DoCompressing(bool (*Step)(const SByteSpan&, ByteVector&, const ProgressT&), ByteVector*& pInBuffer, 
+      ByteVector*& pOutBuffer, ProgressT& Progress)
+  {
+    Progress.NextStep();
+    if (!(*Step)(SByteSpan(*pInBuffer), *pOutBuffer, Progress))
+      return false;
     
+    std::swap(pInBuffer, pOutBuffer);
+    return true;
+  }
+  
+  // Runs all compression steps except the huffman encoding on InData. The buffers are swapped after each step, so that
+  // the output of one step is the input of the next one; pResult points to the buffer with the result afterwards.
+  // InData may refer to the content of Buffer2 (but not of Buffer1).
+  // The steps are chosen at compile time from the signature; see the progress policies for ProgressT.
+  template <EUz1Signature Uz1Sig, class ProgressT>
+  bool EncodeUz1StepsBeforeHuffman_Templ(const SByteSpan& InData, ByteVector& Buffer1, ByteVector& Buffer2, 
+      ByteVector*& pResult, ProgressT& Progress)
+  {
     // RLE encoding.
-    uz1RLEAlgorithm RLE(UpdateFunc, UserObj, ++CurStep, NumSteps);
-    if (!RLE.Compress(InStream, *pInBuffer))
+    Progress.NextStep();
+    if (!EncodeRLEStep(InData, Buffer1, Progress))
       return false;
+    
+    ByteVector* pInBuffer = &Buffer1;
+    ByteVector* pOutBuffer = &Buffer2;
   
     // BW encoding.
-    uz1BurrowsWheelerAlgorithm BW(UpdateFunc, UserObj, ++CurStep, NumSteps);
-    if (!DoCompressing(BW, pInBuffer, pOutBuffer, EmptyBufferValue))
+    if (!DoCompressing(&EncodeBWTStep<ProgressT>, pInBuffer, pOutBuffer, Progress))
       return false;
   
     // MTF encoding.
-    uz1MoveToFrontAlgorithm MTF(UpdateFunc, UserObj, ++CurStep, NumSteps);
-    if (!DoCompressing(MTF, pInBuffer, pOutBuffer, EmptyBufferValue))
+    if (!DoCompressing(&EncodeMTFStep<ProgressT>, pInBuffer, pOutBuffer, Progress))
       return false;
 
     // RLE encoding.
-    if (Uz1Sig == USIG_5678)
-    {
-      uz1RLEAlgorithm RLE(UpdateFunc, UserObj, ++CurStep, NumSteps);
-      if (!DoCompressing(RLE, pInBuffer, pOutBuffer, EmptyBufferValue))
-        return false;
-    }
-    
-    // Huffman encoding.
-    uz1HuffmanAlgorithm Huffman(UpdateFunc, UserObj, ++CurStep, NumSteps);
-    if (!Huffman.Compress(*pInBuffer, OutStream))
+    if (Uz1Sig == USIG_5678 && !DoCompressing(&EncodeRLEStep<ProgressT>, pInBuffer, pOutBuffer, Progress))
       return false;
-   
+    
+    pResult = pInBuffer;
     return true;
   }
-}
-
-// Compression (ASCII)
-bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
-    EUz1Signature Uz1Sig, uzLib::pUz1UpdateFunc UpdateFunc, void* UserObj)
-{
-  return CompressToUz1_Templ(InStream, OutStream, PkgFilename, Uz1Sig, UpdateFunc, UserObj);
-}
-
-// Compression (Unicode)
-bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
-    EUz1Signature Uz1Sig, uzLib::pUz1UpdateFunc UpdateFunc, void* UserObj)
-{
-  // Try to convert the filename to ASCII. If it fails, we need to use unicode.
-  std::string ConvFilename;
-  if (TryConvertUnicodeToASCII(PkgFilename, ConvFilename))
-    return CompressToUz1_Templ(InStream, OutStream, ConvFilename, Uz1Sig, UpdateFunc, UserObj);
-  else
-    return CompressToUz1_Templ(InStream, OutStream, PkgFilename, Uz1Sig, UpdateFunc, UserObj);
-}
-
-
-// Decompression: See USetupDefinition.cpp from the UT99 public source or the UTPackage delphi library.
-bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, pUz1UpdateFunc UpdateFunc, void* UserObj)
-{
-  // Send an initial update.
-  if (UpdateFunc != NULL)
+  
+  // Selects the instantiation of EncodeUz1StepsBeforeHuffman_Templ for the signature.
+  template <class ProgressT>
+  bool EncodeUz1StepsBeforeHuffman(const SByteSpan& InData, EUz1Signature Uz1Sig, ByteVector& Buffer1, 
+      ByteVector& Buffer2, ByteVector*& pResult, ProgressT& Progress)
   {
-    bool bCancel = false;
-    (*UpdateFunc)(0, 1, L"Initializing...", bCancel, UserObj);
-    if (bCancel)
-      return false;
+    if (Uz1Sig == USIG_5678)
+      return EncodeUz1StepsBeforeHuffman_Templ<USIG_5678>(InData, Buffer1, Buffer2, pResult, Progress);
+    else
+      return EncodeUz1StepsBeforeHuffman_Templ<USIG_UT99>(InData, Buffer1, Buffer2, pResult, Progress);
   }
-
-  InStream.clear(); // Clear any bad-flags.
-  InStream.seekg(0, ios_base::beg); // Move the in-pointer to the beginning.
-  InStream.exceptions(std::ios::badbit | std::ios::failbit);
-
-  // uz file format
-  // 1) DWORD: Sig
-  // 2) FCompactIndex: StrLen Incl 0 char
-  // 3) char-array: Orig filename (ends with \0).
-  // 4) File data
-  
-  // Check if it is a valid uz1 file.
-  const int Uz1Signature = ReadInt(InStream);
-  if (Uz1Signature != 1234 && Uz1Signature != 5678)
-    throw runtime_error("Input stream is not a valid uz-file.");
-  
-  // Read the length of the saved original filename. Includes the terminating 0 character.
-  const int OrigFilenameLen = ReadCompactIndex(InStream);
-  if (OrigFilenameLen == 0)
-    throw runtime_error("Original filename length is 0.");
   
-  // Read the original filename.
-  if (OrigFilenameLen > 0) // > 0: ASCII string.
+  // Runs all compression steps on InData (see EncodeUz1StepsBeforeHuffman); pResult points to the buffer with the
+  // final result afterwards.
+  template <class ProgressT>
+  bool EncodeUz1Steps(const SByteSpan& InData, EUz1Signature Uz1Sig, ByteVector& Buffer1, ByteVector& Buffer2, 
+      ByteVector*& pResult, ProgressT& Progress)
   {
-    OrigFilename.FilenameType = FT_ASCII;
-    OrigFilename.ASCIIStr = ReadASCIIString(InStream);
+    ByteVector* pHuffmanInput = NULL;
+    if (!EncodeUz1StepsBeforeHuffman(InData, Uz1Sig, Buffer1, Buffer2, pHuffmanInput, Progress))
+      return false;
     
-    if (static_cast<int>(OrigFilename.ASCIIStr.length()) != OrigFilenameLen-1) // -1: terminating 0 byte
-      throw runtime_error("Original filename and its saved length are different.");
+    // Huffman encoding.
+    pResult = (pHuffmanInput == &Buffer1) ? &Buffer2 : &Buffer1;
+    Progress.NextStep();
+    return EncodeHuffmanStep(SByteSpan(*pHuffmanInput), *pResult, Progress);
   }
-  else // < 0: Unicode string.
+  
+  // Returns the number of compression steps.
+  int GetNumEncodeSteps(EUz1Signature Uz1Sig)
   {
-    OrigFilename.FilenameType = FT_UNICODE;
-    OrigFilename.UnicodeStr = ReadUnicodeString(InStream);
-    
-    if (static_cast<int>(OrigFilename.UnicodeStr.length()) != (-OrigFilenameLen)-1) // -1: terminating 0 byte
-      throw runtime_error("Original filename and its saved length are different.");
+    return (Uz1Sig == USIG_5678) ? 5 : 4;
   }
+  
+  // Compression (ASCII or Unicode package name); basically the reverse of the decompression algorithm.
+  template <class T, class ProgressT>
+  bool CompressToUz1_Impl(in_stream& InStream, out_stream& OutStream, const T& PkgFilename, EUz1Signature Uz1Sig, 
+      ProgressT& Progress)
+  {
+    static const std::wstring INIT_MSG = L"Initializing...";
+    
+    // Send an initial update.
+    if (Progress(0, 1, INIT_MSG))
+      return false;
+    
+    InStream.clear(); // Clear any bad-flags.
+    InStream.seekg(0, ios_base::beg); // Move the in-pointer to the beginning.
+    InStream.exceptions(std::ios::badbit | std::ios::failbit);
+    
+    const int Uz1Signature = static_cast<int>(Uz1Sig);
+    
+    // Write signature and filename (including length).
+    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+    WriteUz1Header(OutStream, Uz1Signature, PkgFilename);
+    
+    // Read the complete package into buffer 2 (the first step writes to buffer 1) and compress it.
+    ByteVector Buffer1;
+    ByteVector Buffer2;
+    ReadStreamToBuffer(InStream, Buffer2);
+    
+    ByteVector* pResult = NULL;
+    if (!EncodeUz1Steps(SByteSpan(Buffer2), Uz1Sig, Buffer1, Buffer2, pResult, Progress))
+      return false;
     
-  // Create buffer 1.
-  std::basic_stringstream<BYTE> Buffer1(std::ios::binary | std::ios::in | std::ios::out);
-  const std::basic_string<BYTE> EmptyBufferValue = Buffer1.str();
-  Buffer1.exceptions(std::ios::badbit | std::ios::failbit);
+    WriteBufferToStream(OutStream, *pResult);
+   
+    return true;
+  }
   
-  // Create second buffer.
-  std::basic_stringstream<BYTE> Buffer2(std::ios::binary | std::ios::in | std::ios::out);
-  Buffer2.exceptions(std::ios::badbit | std::ios::failbit);
+  template <class T>
+  bool CompressToUz1_Templ(in_stream& InStream, out_stream& OutStream, const T& PkgFilename, EUz1Signature Uz1Sig, 
+      const SProgressTarget& Target)
+  {
+    return RunWithProgress(Target, GetNumEncodeSteps(Uz1Sig), [&](auto& Progress) {
+      return CompressToUz1_Impl(InStream, OutStream, PkgFilename, Uz1Sig, Progress);
+    });
+  }
   
-  // Pointers used to access always the correct stream easily.
-  std::basic_stringstream<BYTE>* pInBuffer = &Buffer1;
-  std::basic_stringstream<BYTE>* pOutBuffer = &Buffer2;
+  // Converts the package name to ASCII if possible and calls CompressToUz1_Templ.
+  bool CompressToUz1_Conv(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, const SProgressTarget& Target)
+  {
+    // Try to convert the filename to ASCII. If it fails, we need to use unicode.
+    std::string ConvFilename;
+    if (TryConvertUnicodeToASCII(PkgFilename, ConvFilename))
+      return CompressToUz1_Templ(InStream, OutStream, ConvFilename, Uz1Sig, Target);
+    else
+      return CompressToUz1_Templ(InStream, OutStream, PkgFilename, Uz1Sig, Target);
+  }
+}
+
+// Compression (ASCII)
+bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, uzLib::pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressToUz1_Templ(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressToUz1_Templ(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+// Compression (Unicode)
+bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, uzLib::pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressToUz1_Conv(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressToUz1_Conv(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+
+namespace
+{
+  // Number of decompression steps: The huffman, the 5678 RLE and the MTF decoding are done in the first step, the inverse
+  // BWT and the final RLE decoding in the second one.
+  const int NUM_DECODE_STEPS = 2;
   
+  // Update messages of the decompression steps.
+  const std::wstring DECODE_INIT_MSG = L"Initializing...";
+  const std::wstring DECODE_STEP1_MSG = L"Huffman/MTF-Decoding";
+  const std::wstring DECODE_STEP2_MSG = L"Burrows Wheeler/RLE-Decoding";
   
-  // Decompress the data from here on.
-  const int NumSteps = (Uz1Signature == 5678) ? 5 : 4; // The number of decompression steps.
-  int CurStep = 0;
+  // Returns the CPU time (user and kernel) used by the calling thread so far.
+  std::chrono::nanoseconds GetThreadCPUTime()
+  {
+#ifdef _WIN32
+    FILETIME CreationTime, ExitTime, KernelTime, UserTime;
+    if (!GetThreadTimes(GetCurrentThread(), &CreationTime, &ExitTime, &KernelTime, &UserTime))
+      throw std::runtime_error("Couldn't get the CPU time of the thread.");
+    
+    // The FILETIMEs count 100 ns intervals.
+    const uint64_t Kernel = (uint64_t(KernelTime.dwHighDateTime) << 32) | KernelTime.dwLowDateTime;
+    const uint64_t User = (uint64_t(UserTime.dwHighDateTime) << 32) | UserTime.dwLowDateTime;
+    return std::chrono::nanoseconds((Kernel + User) * 100);
+#else
+    timespec Time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time) != 0)
+      throw std::runtime_error("Couldn't get the CPU time of the thread.");
+    
+    return std::chrono::seconds(Time.tv_sec) + std::chrono::nanoseconds(Time.tv_nsec);
+#endif
+  }
   
-  // Huffman decoding.
-  uz1HuffmanAlgorithm Huffman(UpdateFunc, UserObj, ++CurStep, NumSteps);
-  if (!Huffman.Decompress(InStream, *pInBuffer, InStream.tellg())) // tellg(): The data starts at the current position.
-    return false;
+  // Checks the SUz1DecodeLimits during one decompression (see there) and throws a std::runtime_error, if one is exceeded.
+  // The CPU time of the thread counts from the construction on. If pSharedCPUTime is not NULL, the CPU time (in ns) is
+  // added to it on each check and MaxCPUTime applies to the sum, i.e. to all threads which share the counter.
+  class DecodeBudget
+  {
+    public:
+      explicit DecodeBudget(const SUz1DecodeLimits& Limits, std::atomic<int64_t>* pSharedCPUTime = NULL):
+        m_Limits(Limits), m_pSharedCPUTime(pSharedCPUTime), 
+        m_LastCPUTime(Limits.MaxCPUTime.count() != 0 ? GetThreadCPUTime() : std::chrono::nanoseconds(0)), m_OwnCPUTime(0), 
+        m_NumBWTBlocks(0), m_MaxBWTDataSize(0), m_pBWTDataLimitName(NULL)
+      {
+        const size_t MaxBlockSize = uz1BurrowsWheelerAlgorithm::GetEncodedChunkSize(uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE);
+        if (Limits.MaxBWTBlocks > 0)
+        {
+          m_MaxBWTDataSize = MaxBlockSize * Limits.MaxBWTBlocks;
+          m_pBWTDataLimitName = "MaxBWTBlocks";
+        }
+        
+        // The final RLE expands the package by at most 6/5 (a run of RLE_LEAD bytes gets a run-length), so the size of
+        // the package also limits the BWT blocks.
+        if (Limits.MaxOutputBytes != 0 && Limits.MaxOutputBytes < std::numeric_limits<size_t>::max() / 4)
+        {
+          const size_t NumBlocks = (Limits.MaxOutputBytes + Limits.MaxOutputBytes/4) / uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE + 1;
+          if (m_MaxBWTDataSize == 0 || NumBlocks * MaxBlockSize < m_MaxBWTDataSize)
+          {
+            m_MaxBWTDataSize = NumBlocks * MaxBlockSize;
+            m_pBWTDataLimitName = "MaxOutputBytes";
+          }
+        }
+      }
+      
+      const SUz1DecodeLimits& GetLimits()const { return m_Limits; }
+      
+      // Returns the max. size of the BWT blocks (including the headers) as given by MaxBWTBlocks and MaxOutputBytes, or 0
+      // if neither is set.
+      size_t GetMaxBWTDataSize()const { return m_MaxBWTDataSize; }
+      
+      // Size is the number of bytes of the BWT blocks (including the headers) so far or in total.
+      void CheckBWTDataSize(size_t Size)const
+      {
+        if (m_MaxBWTDataSize != 0 && Size > m_MaxBWTDataSize)
+          ThrowExceeded(m_pBWTDataLimitName);
+      }
+      
+      // Total is the number of huffman symbols (as saved in the header). Without the RLE step (1234) it's the size of the
+      // BWT blocks; the RLE step of 5678 expands them by at most 6/5.
+      void CheckHuffmanTotal(size_t Total, bool bWithRLE)const
+      {
+        if (m_MaxBWTDataSize != 0 && Total > (bWithRLE ? m_MaxBWTDataSize + m_MaxBWTDataSize/4 : m_MaxBWTDataSize))
+          ThrowExceeded(m_pBWTDataLimitName);
+      }
+      
+      // Called before each BWT block is decoded.
+      void AddBWTBlock()
+      {
+        if (m_Limits.MaxBWTBlocks > 0 && ++m_NumBWTBlocks > m_Limits.MaxBWTBlocks)
+          ThrowExceeded("MaxBWTBlocks");
+      }
+      
+      // Size is the number of package bytes written so far.
+      void CheckOutputSize(size_t Size)const
+      {
+        if (m_Limits.MaxOutputBytes != 0 && Size > m_Limits.MaxOutputBytes)
+          ThrowExceeded("MaxOutputBytes");
+      }
+      
+      void CheckCPUTime()
+      {
+        if (m_Limits.MaxCPUTime.count() == 0)
+          return;
+        
+        const std::chrono::nanoseconds CurTime = GetThreadCPUTime();
+        const int64_t Delta = (CurTime - m_LastCPUTime).count();
+        m_LastCPUTime = CurTime;
+        
+        const int64_t UsedTime = (m_pSharedCPUTime != NULL) ? m_pSharedCPUTime->fetch_add(Delta) + Delta : (m_OwnCPUTime += Delta);
+        if (std::chrono::nanoseconds(UsedTime) > m_Limits.MaxCPUTime)
+          ThrowExceeded("MaxCPUTime");
+      }
+    
+    private:
+      static void ThrowExceeded(const char* LimitName)
+      {
+        throw std::runtime_error(std::string("The uz1-file exceeds the decoding limit SUz1DecodeLimits::") + LimitName + ".");
+      }
+    
+    private:
+      const SUz1DecodeLimits m_Limits;
+      std::atomic<int64_t>* const m_pSharedCPUTime;
+      std::chrono::nanoseconds m_LastCPUTime; // CPU time of the thread at the last check.
+      int64_t m_OwnCPUTime; // Used instead of *m_pSharedCPUTime if that's NULL.
+      int m_NumBWTBlocks;
+      size_t m_MaxBWTDataSize; // 0 for no limit.
+      const char* m_pBWTDataLimitName; // The limit which gives m_MaxBWTDataSize.
+  };
   
-  // RLE decoding.
-  if (Uz1Signature == 5678)
+  // Runs the huffman, the RLE (if bWithRLE is true) and the MTF decoding in one go and stores the result (i.e. the input
+  // of the inverse BWT) in OutData. Defined in the "Fused huffman/MTF decoding" section.
+  template <class ProgressT>
+  bool DecodeHuffmanMTF(const SByteSpan& Payload, bool bWithRLE, ByteVector& OutData, const ProgressT& Progress, 
+      const std::wstring& UpdateMsg, DecodeBudget& Budget);
+  
+  // Runs the inverse BWT and the final RLE decoding in one go and appends the result (i.e. the package) to OutData
+  // (a ByteVector, an out_stream or a MappedOutputFile). Defined in the "Fused inverse BWT/RLE decoding" section.
+  // Temp is used as scratch memory.
+  template <class OutputT, class ProgressT>
+  bool DecodeBWTRLE(const SByteSpan& InData, OutputT& OutData, IndexVector& Temp, const ProgressT& Progress, 
+      const std::wstring& UpdateMsg, DecodeBudget& Budget);
+  
+  // Decompression: See USetupDefinition.cpp from the UT99 public source or the UTPackage delphi library.
+  template <class ProgressT>
+  bool DecompressFromUz1_Impl(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, ProgressT& Progress, 
+      const SUz1DecodeLimits& Limits)
   {
-    uz1RLEAlgorithm RLE(UpdateFunc, UserObj, ++CurStep, NumSteps);
-    if (!DoDecompressing(RLE, pInBuffer, pOutBuffer, EmptyBufferValue))
+    DecodeBudget Budget(Limits);
+    
+    // Send an initial update.
+    if (Progress(0, 1, DECODE_INIT_MSG))
       return false;
-  }
-  
-  // MTF decoding.
-  uz1MoveToFrontAlgorithm MTF(UpdateFunc, UserObj, ++CurStep, NumSteps);
-  if (!DoDecompressing(MTF, pInBuffer, pOutBuffer, EmptyBufferValue))
-    return false;
+
+    InStream.clear(); // Clear any bad-flags.
+    InStream.seekg(0, ios_base::beg); // Move the in-pointer to the beginning.
+    InStream.exceptions(std::ios::badbit | std::ios::failbit);
+
+    const int Uz1Signature = ReadUz1Header(InStream, OrigFilename);
+    
+    // Read the compressed data (starts at the current position).
+    ByteVector Payload;
+    ReadStreamToBuffer(InStream, Payload);
   
-  // BW decoding.
-  uz1BurrowsWheelerAlgorithm BW(UpdateFunc, UserObj, ++CurStep, NumSteps);
-  if (!DoDecompressing(BW, pInBuffer, pOutBuffer, EmptyBufferValue))
-    return false;
+    // Huffman, RLE (5678 only) and MTF decoding.
+    ByteVector BWTData;
+    Progress.NextStep();
+    if (!DecodeHuffmanMTF(SByteSpan(Payload), Uz1Signature == 5678, BWTData, Progress, DECODE_STEP1_MSG, Budget))
+      return false;
   
-  // RLE decoding.
-  OutStream.exceptions(std::ios::badbit | std::ios::failbit);
-  uz1RLEAlgorithm RLE(UpdateFunc, UserObj, ++CurStep, NumSteps);
-  if (!RLE.Decompress(*pInBuffer, OutStream))
-    return false;
+    // BW and RLE decoding. The package is written directly to the stream.
+    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+    IndexVector Temp;
+    Progress.NextStep();
+    return DecodeBWTRLE(SByteSpan(BWTData), OutStream, Temp, Progress, DECODE_STEP2_MSG, Budget);
+  }
   
-  return true;
+  bool DecompressFromUz1_Templ(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SProgressTarget& Target, const SUz1DecodeLimits& Limits = SUz1DecodeLimits())
+  {
+    return RunWithProgress(Target, NUM_DECODE_STEPS, [&](auto& Progress) {
+      return DecompressFromUz1_Impl(InStream, OutStream, OrigFilename, Progress, Limits);
+    });
+  }
+}
+
+bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj));
 }
 
 bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc, void* UserObj)
@@ -641,6 +1102,29 @@ bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, pUz1Up
   return DecompressFromUz1(InStream, OutStream, TempFilename, UpdateFunc, UserObj);
 }
 
+bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, SUz1Progress& Progress)
+{
+  return DecompressFromUz1_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1(InStream, OutStream, TempFilename, Progress);
+}
+
+bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj), Limits);
+}
+
+bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, SUz1Progress& Progress)
+{
+  return DecompressFromUz1_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress), Limits);
+}
+
 
 //============================================================================================================================
 //============================================================================================================================
@@ -652,22 +1136,50 @@ bool uzLib::DecompressFromUz1(in_stream& InStream, out_stream& OutStream, pUz1Up
 //============================================================================================================================
 // uz1AlgorithmBase
 //============================================================================================================================
+const int uzLib::uz1AlgorithmBase::BYTE_UPDATE_INTERVALL;
+
 uzLib::uz1AlgorithmBase::uz1AlgorithmBase(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
   m_UpdateFunc(UpdateFunc), m_pUserObj(UserObj), m_ThisStepNum(ThisStepNum)
 { 
   if (ThisStepNum >= 0)
   {
     std::wstringstream StrStream;
-    StrStream << NumSteps;
-    m_NumStepsStr = StrStream.str();
+    StrStream << L"(" << ThisStepNum << L"/" << NumSteps << L") ";
+    m_StepPrefix = StrStream.str();
+    m_StepMsg = m_StepPrefix; // For an empty message.
   }
 }
 
-int uzLib::uz1AlgorithmBase::AlgorithmPreamble(in_stream& InStream, out_stream&, ios::pos_type InStreamStartPos)
+bool uzLib::uz1AlgorithmBase::Compress(in_stream& InStream, out_stream& OutStream, ios::pos_type InStreamBeg)
+{
+  InStream.clear(); // Clear any bad-flags.
+  InStream.seekg(InStreamBeg, ios_base::beg); // Move the in-pointer to the desired position.
+  
+  ByteVector InData;
+  ReadStreamToBuffer(InStream, InData);
+  
+  ByteVector OutData;
+  if (!Compress(SByteSpan(InData), OutData))
+    return false;
+  
+  WriteBufferToStream(OutStream, OutData);
+  return true;
+}
+
+bool uzLib::uz1AlgorithmBase::Decompress(in_stream& InStream, out_stream& OutStream, ios::pos_type InStreamBeg)
 {
   InStream.clear(); // Clear any bad-flags.
-  InStream.seekg(InStreamStartPos, ios_base::beg); // Move the in-pointer to the desired position.
-  return GetTotalStreamLength(InStream);
+  InStream.seekg(InStreamBeg, ios_base::beg); // Move the in-pointer to the desired position.
+  
+  ByteVector InData;
+  ReadStreamToBuffer(InStream, InData);
+  
+  ByteVector OutData;
+  if (!Decompress(SByteSpan(InData), OutData))
+    return false;
+  
+  WriteBufferToStream(OutStream, OutData);
+  return true;
 }
 
 bool uzLib::uz1AlgorithmBase::CallUpdateFunction(unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)
@@ -675,17 +1187,16 @@ bool uzLib::uz1AlgorithmBase::CallUpdateFunction(unsigned int CurStatus, unsigne
   if (m_UpdateFunc == NULL)
     return false;
   
-  std::wstring TheMessage = Msg;
-  if (m_ThisStepNum >= 0)
+  // The messages are static strings, which mostly stay the same between the calls, so the one with the step number is
+  // only built if the message changes.
+  if (m_ThisStepNum >= 0 && Msg != m_LastMsg)
   {
-    std::wstringstream StrStream;
-    StrStream << m_ThisStepNum;
-    
-    TheMessage = L"(" + StrStream.str() + L"/" + m_NumStepsStr + L") " + TheMessage;
+    m_LastMsg = Msg;
+    m_StepMsg = m_StepPrefix + Msg;
   }
 
   bool bCancel = false;
-  (*m_UpdateFunc)(CurStatus, CompletedStatus, TheMessage, bCancel, m_pUserObj);
+  (*m_UpdateFunc)(CurStatus, CompletedStatus, (m_ThisStepNum >= 0) ? m_StepMsg : Msg, bCancel, m_pUserObj);
   return bCancel;
 }
 
@@ -745,19 +1256,212 @@ namespace
   };
 #endif
 
+  // Size of the header (Length, First and Last ints) in front of each BWT chunk.
+  const int BWT_CHUNK_HEADER_SIZE = 3*sizeof(int);
+  
+  // Header of a BWT chunk. The chunk data following the header is Length+1 bytes long and decodes to Length bytes.
+  struct SBWTChunkHeader
+  {
+    int Length;
+    int First;
+    int Last;
+  };
+  
+  // Reads the header of a BWT chunk from InData (BWT_CHUNK_HEADER_SIZE bytes) and validates it.
+  SBWTChunkHeader ParseBWTChunkHeader(const unsigned char* InData)
+  {
+    // UTPackages-delphi-library reads 2 compact indices in the decompress function, but UT99 seems to use 2 ints.
+    SBWTChunkHeader Header;
+    Header.Length = GetInt(InData);
+    Header.First = GetInt(InData + sizeof(int));
+    Header.Last = GetInt(InData + 2*sizeof(int));
+    
+    if (Header.Length < 0 || Header.Length > static_cast<int>(uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE))
+      throw std::runtime_error("Invalid DecompressLength in uz1BurrowsWheelerAlgorithm::Decompress.");
+    else if (Header.First < 0 || Header.First > Header.Length || Header.Last < 0 || Header.Last > Header.Length)
+      throw std::runtime_error("Invalid First or Last index in uz1BurrowsWheelerAlgorithm::Decompress.");
+    
+    return Header;
+  }
+  
+  // Prepares the decoding of one BWT chunk: Stores the successor of each position in Temp. ChunkData holds the
+  // Header.Length+1 bytes following the header, Temp must have room for Header.Length+1 ints.
+  void BuildBWTChunkLinks(const SBWTChunkHeader& Header, const unsigned char* ChunkData, int* Temp)
+  {
+    const int DecompressLength = Header.Length+1;
+    const int Last = Header.Last;
+  
+    int DecompressCount[256+1];
+    int RunningTotal[256+1];
+    
+    for (int i = 0; i < 257; ++i)
+      DecompressCount[i] = 0;
+    
+    for (int i = 0; i < DecompressLength; ++i)
+      DecompressCount[ (i!=Last) ? ChunkData[i] : 256]++;
+    
+    int Sum = 0;
+    for (int i = 0; i < 257; ++i)
+    {
+      RunningTotal[i] = Sum;
+      Sum += DecompressCount[i];
+      DecompressCount[i] = 0;
+    }
+    
+    for (int i = 0; i < DecompressLength; ++i)
+    {
+      const int Index = ( (i != Last) ? ChunkData[i] : 256);
+      Temp[RunningTotal[Index] + DecompressCount[Index]++] = i;
+    }
+  }
+  
+  // Sorts Positions[0..Count-1] with a (stable) merge sort. Scratch must have room for Count ints.
+  template <class CompareT>
+  void MergeSortPositions(int* Positions, int* Scratch, int Count, const CompareT& Less)
+  {
+    // Sort short runs with insertion sort.
+    const int RUN_LENGTH = 16;
+    for (int RunBeg = 0; RunBeg < Count; RunBeg += RUN_LENGTH)
+    {
+      const int RunEnd = std::min(RunBeg + RUN_LENGTH, Count);
+      for (int i = RunBeg + 1; i < RunEnd; ++i)
+      {
+        const int Value = Positions[i];
+        int j = i;
+        for (; j > RunBeg && Less(Value, Positions[j-1]); --j)
+          Positions[j] = Positions[j-1];
+        Positions[j] = Value;
+      }
+    }
+    
+    // Merge the runs, alternating between Positions and Scratch.
+    int* pFrom = Positions;
+    int* pTo = Scratch;
+    for (int Width = RUN_LENGTH; Width < Count; Width *= 2)
+    {
+      for (int Beg = 0; Beg < Count; Beg += 2*Width)
+      {
+        const int Mid = std::min(Beg + Width, Count);
+        const int End = std::min(Beg + 2*Width, Count);
+        std::merge(pFrom + Beg, pFrom + Mid, pFrom + Mid, pFrom + End, pTo + Beg, Less);
+      }
+      std::swap(pFrom, pTo);
+    }
+    
+    if (pFrom != Positions)
+      memcpy(Positions, pFrom, Count * sizeof(int));
+  }
+  
+  // Thrown by CancellableCompare to leave the sort.
+  struct SSortCancelled
+  { };
+  
+  // Comparison function, which checks the cancellation token every CHECK_INTERVAL compared bytes and throws
+  // SSortCancelled if it is set. A single comparison can scan a large part of the chunk (periodic data), so the bytes are
+  // counted instead of the comparisons. The counter is shared by all copies of the object (the STL algorithms copy it).
+  template <class CompareT>
+  class CancellableCompare
+  {
+    public:
+      static const int CHECK_INTERVAL = 0x10000;
+      
+      CancellableCompare(const CompareT& Compare, const SUz1Progress& Cancel, int& Counter):
+        m_Compare(Compare), m_pCancel(&Cancel), m_pCounter(&Counter)
+      { }
+      
+      bool operator()(int P1, int P2)const
+      {
+        int NumCompared;
+        const bool bLess = m_Compare.Compare(P1, P2, NumCompared);
+        
+        *m_pCounter += NumCompared + 1;
+        if (*m_pCounter >= CHECK_INTERVAL)
+        {
+          *m_pCounter = 0;
+          if (m_pCancel->IsCancelled())
+            throw SSortCancelled();
+        }
+        
+        return bLess;
+      }
+    
+    private:
+      CompareT m_Compare;
+      const SUz1Progress* m_pCancel;
+      int* m_pCounter;
+  };
+  
+  // Decodes one BWT chunk (see BuildBWTChunkLinks). Header.Length bytes are written to OutData.
+  void DecodeBWTChunk(const SBWTChunkHeader& Header, const unsigned char* ChunkData, int* Temp, unsigned char* OutData)
+  {
+    BuildBWTChunkLinks(Header, ChunkData, Temp);
+    
+    // All indices in Temp are smaller than DecompressLength, so the walk stays inside the chunk.
+    for (int i = Header.First, j = 0; j < Header.Length; i = Temp[i], ++j)
+      *OutData++ = ChunkData[i];
+  }
+
 }
 
 //-----------------------------------------------------------------------------------------
 // Static data definition.
 //-----------------------------------------------------------------------------------------
-#if (BWT_SORT_TYPE == BWT_STD_SORT)
-  std::vector<unsigned char>* uzLib::uz1BurrowsWheelerAlgorithm::Temp_CompressBuffer = NULL;
-  int uzLib::uz1BurrowsWheelerAlgorithm::Temp_CompressLength = 0;
-#elif (BWT_SORT_TYPE == BWT_C_SORT)
-  unsigned char* uzLib::uz1BurrowsWheelerAlgorithm::Temp_CStyle_CompressBuffer = NULL;
+#if (BWT_SORT_TYPE == BWT_C_SORT)
+  const unsigned char* uzLib::uz1BurrowsWheelerAlgorithm::Temp_CStyle_CompressBuffer = NULL;
   int uzLib::uz1BurrowsWheelerAlgorithm::Temp_CStyle_CompressLength = 0;
 #endif
 
+const unsigned int uzLib::uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE;
+
+namespace
+{
+  // Kernel of uz1BurrowsWheelerAlgorithm::Compress (see the progress policies). CompressPosition is the scratch memory
+  // of the sort.
+  template <class ProgressT>
+  bool EncodeBWTStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress, IndexVector& CompressPosition)
+  {
+    static const std::wstring UPDATE_MSG = L"Burrows Wheeler Encoding";
+
+    const int InStreamLength = static_cast<int>(InData.Length);
+    
+    if (Progress(0, InStreamLength, UPDATE_MSG))
+      return false;
+
+    // Each chunk is saved as: Length, First, Last (ints) followed by Length+1 bytes. So the output size is known in advance.
+    const size_t NumChunks = (InData.Length + uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE - 1) / uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE;
+    OutData.resize(InData.Length + NumChunks * (BWT_CHUNK_HEADER_SIZE + 1));
+    unsigned char* pOut = OutData.empty() ? NULL : &OutData[0];
+  
+    // Loop through all the bytes in the input.
+    int ProcessedBytes = 0;
+    while (ProcessedBytes < InStreamLength)
+    {
+      if (Progress(ProcessedBytes, InStreamLength, UPDATE_MSG))
+        return false;
+
+      // The next data-chunk is sorted directly in the input buffer.
+      const int CompressLength = std::min<int>(InStreamLength - ProcessedBytes, uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE);
+      if (!uz1BurrowsWheelerAlgorithm::EncodeChunk(InData.Data + ProcessedBytes, CompressLength, pOut, CompressPosition, 
+          GetCancelToken(Progress)))
+        return false;
+    
+      ProcessedBytes += CompressLength;
+      pOut += uz1BurrowsWheelerAlgorithm::GetEncodedChunkSize(CompressLength);
+    }
+    assert(pOut == (OutData.empty() ? NULL : &OutData[0] + OutData.size()));
+  
+    return true;
+  }
+  
+  template <class ProgressT>
+  bool EncodeBWTStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress)
+  {
+    // Scratch memory for the sorting.
+    IndexVector CompressPosition;
+    return EncodeBWTStep(InData, OutData, Progress, CompressPosition);
+  }
+}
+
 //-----------------------------------------------------------------------------------------
 // Function implementation
 //-----------------------------------------------------------------------------------------
@@ -767,23 +1471,23 @@ uzLib::uz1BurrowsWheelerAlgorithm::uz1BurrowsWheelerAlgorithm(pUz1UpdateFunc Upd
     uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
 { }
 
-bool uzLib::uz1BurrowsWheelerAlgorithm::Compress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+bool uzLib::uz1BurrowsWheelerAlgorithm::Compress(const SByteSpan& InData, ByteVector& OutData)
 {
-  static const std::wstring UPDATE_MSG = L"Burrows Wheeler Encoding";
-
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
-    
-  if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
-    return false;
-
-  // CompressBuffer will hold the data-chunks from the file.
-  vector<unsigned char> CompressBuffer(MAX_BUFFER_SIZE);
+  if (GetUpdateFunc() == NULL)
+    return EncodeBWTStep(InData, OutData, NoProgress());
   
+  return EncodeBWTStep(InData, OutData, [this](unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)
+      { return CallUpdateFunction(CurStatus, CompletedStatus, Msg); });
+}
+
+bool uzLib::uz1BurrowsWheelerAlgorithm::EncodeChunk(const unsigned char* CompressBuffer, const int CompressLength, 
+    unsigned char* pOut, IndexVector& CompressPositionScratch, const SUz1Progress* pCancel)
+{
   // CompressPosition will point to or is the index-array which is used to rearange the data.
 #if (BWT_SORT_TYPE == BWT_EXT_SORT)
   KeyPrefixPtr CompressPosition;
 #else
-  vector<int> CompressPosition(MAX_BUFFER_SIZE+1);
+  IndexVector& CompressPosition = CompressPositionScratch;
 #endif
 
 #if (BWT_SORT_TYPE == BWT_7Z_SORT)
@@ -792,242 +1496,211 @@ bool uzLib::uz1BurrowsWheelerAlgorithm::Compress(uzLib::in_stream& InStream, uzL
   const UInt32 kBlockSizeMax = kBlockSizeMultMax * kBlockSizeStep;
 
   // "Temporary" array which is required by the 7zip-style.
+  // I know, a memory leak can occur if an exception is thrown in the below code.
+  // 7-zip version isn't used anyway and was only for testing, so I don't care to use a smart-pointer or whatever.
   UInt32* pBlockSorterIndex = new UInt32[BLOCK_SORT_BUF_SIZE(kBlockSizeMax) * sizeof(UInt32)];
 #endif
+
+  // The following step is the time-expensive one. It sorts an index-array (CompressPosition) with the help of the CompressBuffer-data.
+  // CompressPosition has to have a length of CompressLength+1. The last element is always CompressLength
+  // (i.e. CompressPosition[CompressLength] == CompressLength).
+  // - Reason (for the std or c-style): CompressPosition[CompressLength] is after the initialization set to CompressLength. If you look at the
+  //   ClampedBufferCompare-operator, you realize that in case P2 points to that last element, the for-loop is never executed, 
+  //   because P2 > CompressLength. So always the last return-statement is executed, so that last element stays in that position.
+  // - bwtsort (i.e. BWT_EXT_SORT) returns an array which is identical to the std and c styles, but the last element (i.e. with the index
+  //   CompressLength) needs to be set manually.
+  // - BlockSort (i.e. BWT_7Z_SORT) returns an array which is ALMOST identical. I haven't explored it further as bwtsort is faster anyway.
   
+  // Required time: STD > C > 7z > Ext
+  // Speed tests (Normal AS-HiSpeed.unr; complete BWT):
+  //    STD: 416.43s
+  //    C: 235.195s
+  //    EXT: 1.68164s
+  //    7Z: 1.97155s
+  // STD is so slow, I guess, because of the overhead of the STL (even when everything "suitable" is inlined). This is missing in the C-style, so
+  // that one is faster. The problem with these two approaches is that it is the straight-forward way to sort the CompressPosition using
+  // a quick-sort, which is slow for large data amounts. 7z and "Ext" use an optimized algorithm of BWT.
   
-  // Loop through all the bytes in the input.
-  int ProcessedBytes = 0;
-  while (!IsEOF(InStream))
-  {
-    if (CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
-      return false;
-
-    // Copy the next data-chunk into the buffer.
-    CompressBuffer.clear();
-    const int CompressLength = CopyDataToVector(InStream, CompressBuffer, MAX_BUFFER_SIZE);
-    if (CompressLength <= 0 || CompressBuffer.empty()) // Shouldn't happen as there should always be something to copy.
-      throw std::logic_error("Couldn't read next chunk into the buffer in uz1BurrowsWheelerAlgorithm::Compress.");
-    ProcessedBytes += CompressLength;
-    
-    
-    // The following step is the time-expensive one. It sorts an index-array (CompressPosition) with the help of the CompressBuffer-data.
-    // CompressPosition has to have a length of CompressLength+1. The last element is always CompressLength
-    // (i.e. CompressPosition[CompressLength] == CompressLength).
-    // - Reason (for the std or c-style): CompressPosition[CompressLength] is after the initialization set to CompressLength. If you look at the
-    //   ClampedBufferCompare()-function, you realize that in case P2 points to that last element, the for-loop is never executed, 
-    //   because P2 > Temp_CompressLength. So always the last return-statement is executed, so that last element stays in that position.
-    // - bwtsort (i.e. BWT_EXT_SORT) returns an array which is identical to the std and c styles, but the last element (i.e. with the index
-    //   CompressLength) needs to be set manually.
-    // - BlockSort (i.e. BWT_7Z_SORT) returns an array which is ALMOST identical. I haven't explored it further as bwtsort is faster anyway.
-    
-    // Required time: STD > C > 7z > Ext
-    // Speed tests (Normal AS-HiSpeed.unr; complete BWT):
-    //    STD: 416.43s
-    //    C: 235.195s
-    //    EXT: 1.68164s
-    //    7Z: 1.97155s
-    // STD is so slow, I guess, because of the overhead of the STL (even when everything "suitable" is inlined). This is missing in the C-style, so
-    // that one is faster. The problem with these two approaches is that it is the straight-forward way to sort the CompressPosition using
-    // a quick-sort, which is slow for large data amounts. 7z and "Ext" use an optimized algorithm of BWT.
-    
-    // C-Style: Basically the original UT-algorithm
-    // STD: My port to C++
-    // Ext: From http://sourceforge.net/projects/bwtcoder/files/bwtcoder/preliminary-2/
-    // 7zip: From the 7zip sources.
+  // C-Style: Basically the original UT-algorithm
+  // STD: My port to C++
+  // Ext: From http://sourceforge.net/projects/bwtcoder/files/bwtcoder/preliminary-2/
+  // 7zip: From the 7zip sources.
 
 #if (BWT_SORT_TYPE == BWT_STD_SORT)
 
-    // Init the position-vector with: { 0, 1, 2, 3, ..., CompressLength }
-    InitCompressPositionVector(CompressPosition, CompressLength);
-    
-    // Sort the position-vector.
-    // Don't use std::sort; std::stable_sort normally uses merge sort, which is in case of the BWT much faster than quicksort (normally used by std::sort)
-    // (also: http://stackoverflow.com/questions/810951/how-big-is-the-performance-gap-between-stdsort-and-stdstable-sort-in-practice).
-    // std::sort (Editor.u): ~40s
-    // std::stable_sort (Editor.u): ~15s
-    Temp_CompressBuffer = &CompressBuffer;
-    Temp_CompressLength = CompressLength;
-    std::stable_sort(CompressPosition.begin(), CompressPosition.end(), uz1BurrowsWheelerAlgorithm::ClampedBufferCompare);
+  // Init the position-vector with: { 0, 1, 2, 3, ..., CompressLength }
+  InitCompressPositionVector(CompressPosition, CompressLength);
+  
+  // Sort the position-vector.
+  // Don't use std::sort; std::stable_sort normally uses merge sort, which is in case of the BWT much faster than quicksort (normally used by std::sort)
+  // (also: http://stackoverflow.com/questions/810951/how-big-is-the-performance-gap-between-stdsort-and-stdstable-sort-in-practice).
+  // std::sort (Editor.u): ~40s
+  // std::stable_sort (Editor.u): ~15s
+  // MergeSortPositions is such a merge sort, but it uses the second half of CompressPosition as merge buffer instead of
+  // allocating one. The order of ClampedBufferCompare is total, so the result is the same as with std::stable_sort.
+  // A single chunk can take long (depending on the data), so the cancellation token is checked during the sort.
+  const ClampedBufferCompare Compare = { CompressBuffer, CompressLength };
+  if (pCancel == NULL)
+    MergeSortPositions(&CompressPosition[0], &CompressPosition[CompressLength+1], CompressLength+1, Compare);
+  else
+  {
+    int NumCompares = 0;
+    const CancellableCompare<ClampedBufferCompare> CancellableComp(Compare, *pCancel, NumCompares);
+    try
+    {
+      MergeSortPositions(&CompressPosition[0], &CompressPosition[CompressLength+1], CompressLength+1, CancellableComp);
+    }
+    catch (const SSortCancelled&)
+    {
+      return false;
+    }
+  }
 
 #elif (BWT_SORT_TYPE == BWT_C_SORT)
 
-    typedef int (__cdecl *CStyle_QSortFunc)(const void *,const void *);
+  typedef int (__cdecl *CStyle_QSortFunc)(const void *,const void *);
 
-    // Init the position-vector with: { 0, 1, 2, 3, ..., CompressLength }
-    InitCompressPositionVector(CompressPosition, CompressLength);
+  // Init the position-vector with: { 0, 1, 2, 3, ..., CompressLength }
+  InitCompressPositionVector(CompressPosition, CompressLength);
 
-    // Sort. std::vector gurantees that the array is saved in 1 continuous memory-chunk (unlike std::list),
-    // so &(CompressBuffer[0]) is legal (and because the vector isn't empty).
-    Temp_CStyle_CompressLength = CompressLength;
-    Temp_CStyle_CompressBuffer = &(CompressBuffer[0]);
-    ::qsort( &(CompressPosition[0]), CompressLength+1, sizeof(int), (CStyle_QSortFunc)uz1BurrowsWheelerAlgorithm::CStyle_ClampedBufferCompare );
-    
+  // Sort.
+  Temp_CStyle_CompressLength = CompressLength;
+  Temp_CStyle_CompressBuffer = CompressBuffer;
+  ::qsort( &(CompressPosition[0]), CompressLength+1, sizeof(int), (CStyle_QSortFunc)uz1BurrowsWheelerAlgorithm::CStyle_ClampedBufferCompare );
+  
 #elif (BWT_SORT_TYPE == BWT_EXT_SORT)
-    // Get the sorted position-array. std::vector gurantees that the array is saved in 1 continuous memory-chunk (unlike std::list),
-    // so &(CompressBuffer[0]) is legal (and because the vector isn't empty).
-    CompressPosition.Set(bwtsort(&(CompressBuffer[0]), CompressLength));
-    
-    // The length of the array returned by bwtsort() is CompressLength+1 (check the source). So this is legal.
-    CompressPosition[CompressLength] = CompressLength;
-        
+  // Get the sorted position-array. bwtsort() only reads the buffer.
+  CompressPosition.Set(bwtsort(const_cast<unsigned char*>(CompressBuffer), CompressLength));
+  
+  // The length of the array returned by bwtsort() is CompressLength+1 (check the source). So this is legal.
+  CompressPosition[CompressLength] = CompressLength;
+      
 
 #elif (BWT_SORT_TYPE == BWT_7Z_SORT)
-    {
-    #error BWT_SORT_TYPE == BWT_7Z_SORT
-    /*UInt32 Ret =*/ BlockSort(pBlockSorterIndex, &(CompressBuffer[0]), CompressLength);
-    
-    CompressPosition.clear();
-    for (int i = 0; i < CompressLength; ++i)
-      CompressPosition.push_back(pBlockSorterIndex[i]);
+  {
+  #error BWT_SORT_TYPE == BWT_7Z_SORT
+  /*UInt32 Ret =*/ BlockSort(pBlockSorterIndex, CompressBuffer, CompressLength);
+  
+  CompressPosition.clear();
+  for (int i = 0; i < CompressLength; ++i)
+    CompressPosition.push_back(pBlockSorterIndex[i]);
    
-    CompressPosition.push_back(CompressLength);
-    
-    }
+  CompressPosition.push_back(CompressLength);
+  
+  delete[] pBlockSorterIndex;
+  }
 
 #else
 
   #error Unknown Sort type
-    
+  
 #endif
-    
-    
-    // From here on the standard UT algorithm again.
-    int First = 0;
-    int Last = 0;
-    for (int i = 0; i < CompressLength+1; ++i)
-    {
-      if (CompressPosition[i] == 1)
-        First = i;
-      else if (CompressPosition[i] == 0)
-        Last = i;
-    }
-
-    WriteInt(OutStream, CompressLength);
-    
-    // UTPackages-delphi-library reads 2 compact indices in the decompress function, but UT99 seems to use 2 ints.
-    //WriteCompactIndex(OutStream, First);
-    //WriteCompactIndex(OutStream, Last);
-    WriteInt(OutStream, First);
-    WriteInt(OutStream, Last);
-    
-    // Write the data to the output.
-    for (int i = 0; i < CompressLength+1; ++i)
-    {
-      const int Index = CompressPosition[i];
-      WriteByte(OutStream, CompressBuffer[Index != 0 ? Index-1 : 0]);
-    }
-        
+  
+  
+  // From here on the standard UT algorithm again.
+  int First = 0;
+  int Last = 0;
+  for (int i = 0; i < CompressLength+1; ++i)
+  {
+    if (CompressPosition[i] == 1)
+      First = i;
+    else if (CompressPosition[i] == 0)
+      Last = i;
   }
+
+  PutInt(pOut, CompressLength);
   
-#if (BWT_SORT_TYPE == BWT_7Z_SORT)
-  // I know, a memory leak can occur if an exception is thrown in the above code.
-  // 7-zip version isn't used anyway and was only for testing, so I don't care to use a smart-pointer or whatever.
-  delete[] pBlockSorterIndex;
-#endif
+  // UTPackages-delphi-library reads 2 compact indices in the decompress function, but UT99 seems to use 2 ints.
+  //WriteCompactIndex(OutStream, First);
+  //WriteCompactIndex(OutStream, Last);
+  PutInt(pOut + sizeof(int), First);
+  PutInt(pOut + 2*sizeof(int), Last);
+  pOut += BWT_CHUNK_HEADER_SIZE;
+  
+  // Write the data to the output.
+  for (int i = 0; i < CompressLength+1; ++i)
+  {
+    const int Index = CompressPosition[i];
+    *pOut++ = CompressBuffer[Index != 0 ? Index-1 : 0];
+  }
   
   return true;
 }
 
-bool uzLib::uz1BurrowsWheelerAlgorithm::Decompress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+bool uzLib::uz1BurrowsWheelerAlgorithm::Decompress(const SByteSpan& InData, ByteVector& OutData)
 {
   static const std::wstring UPDATE_MSG = L"Burrows Wheeler Decoding";
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
+  const int InStreamLength = static_cast<int>(InData.Length);
   
   if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
     return false;
 
-  vector<unsigned char> DecompressBuffer(MAX_BUFFER_SIZE+1);
-  vector<int> Temp(MAX_BUFFER_SIZE+1);
-    
-  int DecompressCount[256+1];
-  int RunningTotal[256+1];
+  OutData.clear();
+  IndexVector Temp(MAX_BUFFER_SIZE+1);
   
   int ProcessedBytes = 0;
   
-  while (!IsEOF(InStream))
+  while (ProcessedBytes < InStreamLength)
   {
     if (CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
       return false;
 
-    int DecompressLength = ReadInt(InStream);
-    
-    // UTPackages-delphi-library reads 2 compact indices in the decompress function, but UT99 seems to use 2 ints.
-    //const int First = ReadCompactIndex(InStream);
-    //const int Last = ReadCompactIndex(InStream);
-    const int First = ReadInt(InStream);
-    const int Last = ReadInt(InStream);
-    if (!InStream.good())
+    if (InStreamLength - ProcessedBytes < BWT_CHUNK_HEADER_SIZE)
       throw std::runtime_error("Reached EOF too early in uz1BurrowsWheelerAlgorithm::Decompress.");
-    else if (DecompressLength > MAX_BUFFER_SIZE+1 || DecompressLength > InStreamLength-InStream.tellg())
-      throw std::runtime_error("Invalid DecompressLength in uz1BurrowsWheelerAlgorithm::Decompress.");
-        
-    DecompressBuffer.clear();
-    const int CopyCount = CopyDataToVector(InStream, DecompressBuffer, ++DecompressLength);
-    if (CopyCount != DecompressLength || DecompressBuffer.size() != static_cast<size_t>(DecompressLength))
-      throw std::runtime_error("Couldn't read the complete compressed chunk in uz1BurrowsWheelerAlgorithm::Decompress.");
-    
-    ProcessedBytes += CopyCount + 8; // +8: The First and Last integers.
-    
-    for (int i = 0; i < 257; ++i)
-      DecompressCount[i] = 0;
-    
-    for (int i = 0; i < DecompressLength; ++i)
-      DecompressCount[ (i!=Last) ? DecompressBuffer[i] : 256]++;
-    
-    int Sum = 0;
-    for (int i = 0; i < 257; ++i)
-    {
-      RunningTotal[i] = Sum;
-      Sum += DecompressCount[i];
-      DecompressCount[i] = 0;
-    }
     
-    for (int i = 0; i < DecompressLength; ++i)
-    {
-      const int Index = ( (i != Last) ? DecompressBuffer[i] : 256);
-      Temp.at(RunningTotal[Index] + DecompressCount[Index]++) = i;
-    }
+    const SBWTChunkHeader Header = ParseBWTChunkHeader(InData.Data + ProcessedBytes);
+    ProcessedBytes += BWT_CHUNK_HEADER_SIZE;
+    if (Header.Length >= InStreamLength-ProcessedBytes)
+      throw std::runtime_error("Invalid DecompressLength in uz1BurrowsWheelerAlgorithm::Decompress.");
     
-    for (int i = First, j = 0; j < DecompressLength-1; i = Temp.at(i), ++j)
-      WriteByte(OutStream, DecompressBuffer.at(i));
+    // The chunk is decoded directly from the input buffer.
+    const size_t OutPos = OutData.size();
+    OutData.resize(OutPos + Header.Length);
+    DecodeBWTChunk(Header, InData.Data + ProcessedBytes, &Temp[0], OutData.empty() ? NULL : &OutData[0] + OutPos);
+    ProcessedBytes += Header.Length+1;
   }
   
   return true;
 }
 
-void uzLib::uz1BurrowsWheelerAlgorithm::InitCompressPositionVector(vector<int>& CompressPositionVect, const int CompressLength)
+void uzLib::uz1BurrowsWheelerAlgorithm::InitCompressPositionVector(IndexVector& CompressPositionVect, const int CompressLength)
 {
-  CompressPositionVect.clear(); // Remove existing elements.
+  // The second half is the merge buffer of MergeSortPositions.
+  CompressPositionVect.resize(2 * (CompressLength + 1));
   for (int CurNum = 0; CurNum < CompressLength + 1; ++CurNum)
-    CompressPositionVect.push_back(CurNum);
+    CompressPositionVect[CurNum] = CurNum;
 }
 
 #if (BWT_SORT_TYPE == BWT_STD_SORT)
 
-  bool uzLib::uz1BurrowsWheelerAlgorithm::ClampedBufferCompare(int P1, int P2)
+  bool uzLib::uz1BurrowsWheelerAlgorithm::ClampedBufferCompare::operator()(int P1, int P2)const
+  {
+    int NumCompared;
+    return Compare(P1, P2, NumCompared);
+  }
+  
+  bool uzLib::uz1BurrowsWheelerAlgorithm::ClampedBufferCompare::Compare(int P1, int P2, int& NumCompared)const
   {
-    if (Temp_CompressBuffer == NULL || Temp_CompressLength < 0)
-      throw std::logic_error("Temp_CompressBuffer == NULL in uz1BurrowsWheelerAlgorithm::ClampedBufferCompare.");
-
     int B1Pos = P1;
     int B2Pos = P2;
     
-    for (int Count = Temp_CompressLength-std::max(P1, P2); Count > 0; --Count, ++B1Pos, ++B2Pos)
+    for (int Count = CompressLength-std::max(P1, P2); Count > 0; --Count, ++B1Pos, ++B2Pos)
     {
       // Note: This function and thus these lines below are called A LOT.
       // It happens to be faster to cache the values B1 and B2 (actually tested).
       // Also don't use the at() function, to gain another performance boost.
-      const BYTE B1 = (*Temp_CompressBuffer)[B1Pos];
-      const BYTE B2 = (*Temp_CompressBuffer)[B2Pos];
+      const unsigned char B1 = CompressBuffer[B1Pos];
+      const unsigned char B2 = CompressBuffer[B2Pos];
       
-      if (B1 < B2)
-        return true;
-      else if (B1 > B2)
-        return false;
+      if (B1 != B2)
+      {
+        NumCompared = B1Pos - P1 + 1;
+        return B1 < B2;
+      }
     }
 
+    NumCompared = B1Pos - P1;
     return ((P1 - P2) > 0 ? false : true);
   }
   
@@ -1035,8 +1708,8 @@ void uzLib::uz1BurrowsWheelerAlgorithm::InitCompressPositionVector(vector<int>&
 
   int uzLib::uz1BurrowsWheelerAlgorithm::CStyle_ClampedBufferCompare(const int* P1, const int* P2)
   {
-	  uzLib::BYTE* B1 = Temp_CStyle_CompressBuffer + *P1;
-	  uzLib::BYTE* B2 = Temp_CStyle_CompressBuffer + *P2;
+	  const unsigned char* B1 = Temp_CStyle_CompressBuffer + *P1;
+	  const unsigned char* B2 = Temp_CStyle_CompressBuffer + *P2;
 	  for( int Count=Temp_CStyle_CompressLength-std::max(*P1,*P2); Count>0; Count--,B1++,B2++ )
 	  {
 		  if( *B1 < *B2 )
@@ -1050,123 +1723,254 @@ void uzLib::uz1BurrowsWheelerAlgorithm::InitCompressPositionVector(vector<int>&
 #endif
 
 //============================================================================================================================
-// uz1BurrowsWheelerAlgorithm
+// uz1RLEAlgorithm
 //============================================================================================================================
 
+const BYTE uzLib::uz1RLEAlgorithm::RLE_LEAD;
+
 //-----------------------------------------------------------------------------------------
-// Function implementation
+// Helper classes
 //-----------------------------------------------------------------------------------------
-
-// Constructor
-uzLib::uz1RLEAlgorithm::uz1RLEAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
-    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
-{ }
-
-bool uzLib::uz1RLEAlgorithm::Compress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+namespace
 {
-  static const std::wstring UPDATE_MSG = L"Runtime-Length-Encoding";
-
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
-
-  if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
-    return false;
+  // Incremental RLE encoder. The current run is kept between the calls, so the input can be split at any position.
+  // Finish() needs to be called after the last input.
+  class RLEEncoder
+  {
+    public:
+      // Constructor
+      RLEEncoder(): m_PrevChar(0), m_PrevCount(0)
+      { }
+      
+      // Encodes the bytes and appends the result to OutData.
+      void Encode(const unsigned char* InData, size_t InLength, ByteVector& OutData)
+      {
+        for (const unsigned char* const InEnd = InData + InLength; InData != InEnd; ++InData)
+        {
+          const unsigned char B = *InData;
+          
+          // Check if we need to write the data to the output.
+          if (B != m_PrevChar || m_PrevCount == 255)
+          {
+            EmitRun(OutData);
+            m_PrevChar = B;
+            m_PrevCount = 0;
+          }
+          
+          ++m_PrevCount;
+        }
+      }
+      
+      // Writes the last run to the output.
+      void Finish(ByteVector& OutData)
+      {
+        EmitRun(OutData);
+        m_PrevCount = 0;
+      }
+    
+    private:
+      // If Count >= 5, the current byte is written 5 times and the length is appended.
+      // Else only the specified number of bytes are written.
+      // That means, a compressed block begins, if 5 identical characters appear back-to-back.
+      void EmitRun(ByteVector& OutData)
+      {
+        // Write max. 5 characters to the stream.
+        OutData.insert(OutData.end(), std::min<int>(m_PrevCount, uz1RLEAlgorithm::RLE_LEAD), m_PrevChar);
+        
+        // In case 5 or more characters where written, append the length.
+        if (m_PrevCount >= uz1RLEAlgorithm::RLE_LEAD)
+          OutData.push_back(m_PrevCount);
+      }
+    
+    private:
+      unsigned char m_PrevChar;
+      unsigned char m_PrevCount;
+  };
   
-  BYTE PrevChar = 0;
-  BYTE PrevCount = 0;  
+  // Output adapters of the RLE decoder: Append a single byte / a run of identical bytes to the output.
+  inline void AppendByte(ByteVector& OutData, unsigned char B) { OutData.push_back(B); }
+  inline void AppendRun(ByteVector& OutData, size_t Count, unsigned char B) { OutData.insert(OutData.end(), Count, B); }
+#ifndef _WIN32
+  inline void AppendByte(MappedOutputFile& OutData, unsigned char B) { OutData.AppendByte(B); }
+  inline void AppendRun(MappedOutputFile& OutData, size_t Count, unsigned char B) { OutData.AppendRun(Count, B); }
+#endif
   
-  int ProcessedBytes = 0;
+  inline void AppendByte(out_stream& OutData, unsigned char B)
+  {
+    if (out_stream::traits_type::eq_int_type(OutData.rdbuf()->sputc(static_cast<BYTE>(B)), out_stream::traits_type::eof()))
+      OutData.setstate(std::ios::badbit);
+  }
   
-  BYTE B;
-  while (TryReadNextByte(InStream, B))
+  inline void AppendRun(out_stream& OutData, size_t Count, unsigned char B)
   {
-    if ((ProcessedBytes % BYTE_UPDATE_INTERVALL == 0) && CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
-      return false;
+    for (; Count > 0; --Count)
+      AppendByte(OutData, B);
+  }
 
-    ++ProcessedBytes;
+  // Incremental RLE decoder. The state is kept between the calls, so the input can be split at any position.
+  class RLEDecoder
+  {
+    public:
+      // Constructor
+      RLEDecoder(): m_Count(0), m_PrevChar(0), m_bCountPending(false), m_NumRuns(0), m_NumRunBytes(0)
+      { }
+      
+      // Decodes the bytes and appends the result to OutData (a ByteVector, an out_stream or a MappedOutputFile).
+      template <class OutputT>
+      void Decode(const unsigned char* InData, size_t InLength, OutputT& OutData)
+      {
+        for (const unsigned char* const InEnd = InData + InLength; InData != InEnd; ++InData)
+          DecodeByte(*InData, OutData);
+      }
+      
+      // Decodes a single byte and appends the result to OutData.
+      template <class OutputT>
+      void DecodeByte(unsigned char CurByte, OutputT& OutData)
+      {
+        // The previous byte was the fifth byte in a row, i.e. this one is the run-length.
+        if (m_bCountPending)
+        {
+          ExpandRun(CurByte, OutData);
+          return;
+        }
+        
+        AppendByte(OutData, CurByte);
+        
+        if (CurByte != m_PrevChar)
+        {
+          m_PrevChar = CurByte;
+          m_Count = 1;
+        }
+        // Check if the byte which has just been read was the fifth byte in a row. In that case, the chunk was compressed.
+        else if (++m_Count == uz1RLEAlgorithm::RLE_LEAD)
+          m_bCountPending = true;
+      }
+      
+      // Returns false, if the input ended right before a run-length (i.e. the input is incomplete).
+      bool IsComplete()const { return !m_bCountPending; }
+      
+      // Returns the number of bytes appended to the output so far. NumDecoded is the number of bytes passed to the decoder.
+      // Only the runs are counted, so that the loop over the bytes isn't slowed down.
+      size_t GetOutputSize(size_t NumDecoded)const { return NumDecoded - m_NumRuns + m_NumRunBytes; }
+    
+    private:
+      // Writes the "missing" bytes of the current run to the output.
+      template <class OutputT>
+      void ExpandRun(unsigned char RLE_Count, OutputT& OutData)
+      {
+        if (RLE_Count < 2)
+          throw std::runtime_error("The read RLE_Count is too small, i.e. invalid (in uz1RLEAlgorithm::Decompress).");
+        
+        if (RLE_Count > uz1RLEAlgorithm::RLE_LEAD)
+        {
+          AppendRun(OutData, RLE_Count - uz1RLEAlgorithm::RLE_LEAD, m_PrevChar);
+          m_NumRunBytes += RLE_Count - uz1RLEAlgorithm::RLE_LEAD;
+        }
+        
+        m_Count = 0;
+        m_bCountPending = false;
+        ++m_NumRuns;
+      }
     
-    // Check if we need to write the data to the output.
-    if (B != PrevChar || PrevCount == 255)
+    private:
+      int m_Count;
+      unsigned char m_PrevChar;
+      bool m_bCountPending;
+      size_t m_NumRuns; // Number of run-lengths read (they don't appear in the output).
+      size_t m_NumRunBytes; // Number of bytes written by ExpandRun.
+  };
+}
+
+namespace
+{
+  // Kernel of uz1RLEAlgorithm::Compress (see the progress policies).
+  template <class ProgressT>
+  bool EncodeRLEStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress)
+  {
+    static const std::wstring UPDATE_MSG = L"Runtime-Length-Encoding";
+
+    const int InStreamLength = static_cast<int>(InData.Length);
+
+    if (Progress(0, InStreamLength, UPDATE_MSG))
+      return false;
+  
+    OutData.clear();
+    OutData.reserve(InData.Length + InData.Length/8);
+  
+    // Encode the input in slices, so that the update function can be called in between.
+    RLEEncoder Encoder;
+    for (int ProcessedBytes = 0; ProcessedBytes < InStreamLength; ProcessedBytes += uz1AlgorithmBase::BYTE_UPDATE_INTERVALL)
     {
-      EncodeEmitRun(OutStream, PrevChar, PrevCount);
-      PrevChar = B;
-      PrevCount = 0;
-    }
+      if (Progress(ProcessedBytes, InStreamLength, UPDATE_MSG))
+        return false;
     
-    ++PrevCount;
+      Encoder.Encode(InData.Data + ProcessedBytes, std::min(InStreamLength - ProcessedBytes, uz1AlgorithmBase::BYTE_UPDATE_INTERVALL), OutData);
+    }
+  
+    // Write the missing bytes to the stream.
+    Encoder.Finish(OutData);
+  
+    return true;
   }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function implementation
+//-----------------------------------------------------------------------------------------
+
+// Constructor
+uzLib::uz1RLEAlgorithm::uz1RLEAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
+    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
+{ }
+
+bool uzLib::uz1RLEAlgorithm::Compress(const SByteSpan& InData, ByteVector& OutData)
+{
+  if (GetUpdateFunc() == NULL)
+    return EncodeRLEStep(InData, OutData, NoProgress());
   
-  // Write the missing bytes to the stream.
-  EncodeEmitRun(OutStream, PrevChar, PrevCount);
+  return EncodeRLEStep(InData, OutData, [this](unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)
+      { return CallUpdateFunction(CurStatus, CompletedStatus, Msg); });
+}
+
+bool uzLib::uz1RLEAlgorithm::Decompress(const SByteSpan& InData, ByteVector& OutData)
+{
+  OutData.clear();
+  OutData.reserve(InData.Length + InData.Length/4);
   
-  return true;
+  return DecompressTo(InData, OutData);
+}
+
+#ifndef _WIN32
+bool uzLib::uz1RLEAlgorithm::Decompress(const SByteSpan& InData, MappedOutputFile& OutData)
+{
+  return DecompressTo(InData, OutData);
 }
+#endif
 
-bool uzLib::uz1RLEAlgorithm::Decompress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+template <class OutputT>
+bool uzLib::uz1RLEAlgorithm::DecompressTo(const SByteSpan& InData, OutputT& OutData)
 {
   static const std::wstring UPDATE_MSG = L"Runtime-Length-Decoding";
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
+  const int InStreamLength = static_cast<int>(InData.Length);
   
   if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
     return false;
 
-  int Count = 0;
-  BYTE PrevChar = 0;
-  
-  int ProcessedBytes = 0;
-  
-  BYTE CurByte;
-  while (TryReadNextByte(InStream, CurByte))
+  // Decode the input in slices, so that the update function can be called in between.
+  RLEDecoder Decoder;
+  for (int ProcessedBytes = 0; ProcessedBytes < InStreamLength; ProcessedBytes += BYTE_UPDATE_INTERVALL)
   {
-    if ((ProcessedBytes % BYTE_UPDATE_INTERVALL ==0) && CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
+    if (CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
       return false;
-
-    ++ProcessedBytes;
-    
-    WriteByte(OutStream, CurByte);
     
-    if (CurByte != PrevChar)
-    {
-      PrevChar = CurByte;
-      Count = 1;
-    }
-    // Check if the byte which has just been read was the fifth byte in a row. In that case, the chunk was compressed.
-    else if (++Count == RLE_LEAD)
-    {
-      if ((ProcessedBytes % BYTE_UPDATE_INTERVALL ==0) && CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
-        return false;
-
-      // Read the number of "missing" bytes.
-      unsigned char RLE_Count = (unsigned char)ReadByte(InStream);
-      ++ProcessedBytes;
-
-      if (InStream.eof())
-        throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
-      if (RLE_Count < 2)
-        throw std::runtime_error("The read RLE_Count is too small, i.e. invalid (in uz1RLEAlgorithm::Decompress).");
-      
-      // Write the missing bytes to the output-stream.
-      while (RLE_Count-- > RLE_LEAD)
-        WriteByte(OutStream, CurByte);
-      
-      Count = 0;
-    }
+    Decoder.Decode(InData.Data + ProcessedBytes, std::min(InStreamLength - ProcessedBytes, BYTE_UPDATE_INTERVALL), OutData);
   }
   
-  return true;
-}
-
-void uzLib::uz1RLEAlgorithm::EncodeEmitRun(out_stream& OutStream, BYTE Char, BYTE Count)
-{
-/*
-  // Write max. 5 characters to the stream.
-  for (int Down = std::min(Count, RLE_LEAD); Down > 0; --Down)
-    WriteByte(OutStream, Char);
+  if (!Decoder.IsComplete())
+    throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
   
-  // In case 5 or more characters where written, append the length.
-  if (Count >= RLE_LEAD)
-    WriteByte(OutStream, Count);
-*/
+  return true;
 }
 
 
@@ -1182,365 +1986,577 @@ namespace
 {
 
 //-----------------------------------------------------------------------------------------
-// HuffmanNode class: Helper class for the Huffman-algorithm which is used to build the tree.
+// BasicBitWriter class: Appends bits to a TargetT (which provides "void push_back(unsigned char)", e.g. a ByteVector),
+// beginning with the least significant bit of each byte (i.e. in the same order as boost::dynamic_bitset<unsigned char>
+// stores them).
 //-----------------------------------------------------------------------------------------
-class HuffmanNode
+template <class TargetT>
+class BasicBitWriter
 {
   public:
-    int Count; // Used from outside of the class to store the number of character for the character associated with this node (default value: 0).
-
-  public:
-    // Constructor
-    explicit HuffmanNode(int InChar):
-      Char(InChar), Count(0)
+    // Constructor. The bits are appended to Target.
+    explicit BasicBitWriter(TargetT& Target):
+      m_Target(Target), m_Pending(0), m_NumBits(0)
     { }
     
-    // Destructor
-    ~HuffmanNode();
-    
-    void PrependBit(unsigned char B);
+    // Appends the lowest Count bits of Bits, beginning with the least significant one. Count must be <= MAX_PUT_BITS.
+    void PutBits(uint64_t Bits, int Count)
+    {
+      m_Pending |= Bits << m_NumBits;
+      m_NumBits += Count;
+      
+      // Move the complete bytes to the target.
+      for (; m_NumBits >= 8; m_NumBits -= 8)
+      {
+        m_Target.push_back(static_cast<unsigned char>(m_Pending));
+        m_Pending >>= 8;
+      }
+    }
     
-    // Writes the compressed data to the buffer.
-    void WriteTable(boost::dynamic_bitset<unsigned char>& Buffer)const;
+    // Appends a single bit.
+    void PutBit(bool bBit) { PutBits(bBit ? 1 : 0, 1); }
     
-    // Writes the bits of this node (and only of this node) to the buffer.
-    void WriteBits(boost::dynamic_bitset<unsigned char>& Buffer)const;
+    // Appends the 8 bits of the byte (least significant bit first).
+    void PutByte(unsigned char B) { PutBits(B, 8); }
     
-    // Reads the compressed data. NextBit must contain the index of the first bit, and is advanced as the data is read from the bitset.
-    void ReadTable(const boost::dynamic_bitset<unsigned char>& Source, size_t& NextBit);
+    // Appends the incomplete last byte to the target (the missing bits are 0).
+    void Flush()
+    {
+      if (m_NumBits > 0)
+      {
+        m_Target.push_back(static_cast<unsigned char>(m_Pending));
+        m_Pending = 0;
+        m_NumBits = 0;
+      }
+    }
   
-    // Returns the character of this node.
-    int GetChar()const { return Char; }
-    
-    // Returns the number of bits in the "Bits" vector.
-    size_t GetBitCount()const { return Bits.size(); }
+  public:
+    static const int MAX_PUT_BITS = 56; // Less than 8 bits are pending between the calls, so 56 more bits always fit.
   
-    // If bChildOne is true, the child with the index 1 is returned, else the child with the index 0 is returned.
-    HuffmanNode* GetChild(bool bChildOne)const { return Childs[bChildOne ? 1 : 0]; }
+  private:
+    TargetT& m_Target;
+    uint64_t m_Pending; // The bits which don't form a complete byte yet.
+    int m_NumBits; // Number of bits in m_Pending (< 8 between the calls).
+};
+
+typedef BasicBitWriter<ByteVector> BitWriter;
+
+//-----------------------------------------------------------------------------------------
+// The huffman tree is stored in a flat array of nodes (the indices of the childs are saved), so that no node needs to
+// be allocated. A tree with 256 leaves has 511 nodes.
+//-----------------------------------------------------------------------------------------
+const int MAX_HUFFMAN_NODES = 2*256 - 1;
+const int MAX_HUFFMAN_DEPTH = 255; // The depth of the deepest leaf (i.e. the max. code length) of a tree with 256 leaves.
+
+struct SHuffmanNode
+{
+  int Count; // Number of occurrences of the byte(s) of this node (only used while the tree is built).
+  int Childs[2]; // Indices of the child-nodes; -1 in case of a leaf.
+  unsigned char Char; // The byte of that node. Only valid for a leaf.
   
-    // Extracts the last 2 elements from the vector and uses them to initialize the childs. I.e. NodeSrc.size() is afterwards smaller by 2.
-    void InitializeChilds(vector<HuffmanNode*>& NodeSrc);
+  bool IsLeaf()const { return Childs[0] < 0; }
+};
 
+//-----------------------------------------------------------------------------------------
+// HuffmanEncoder class: Builds the huffman-tree from the byte frequencies and encodes the bytes.
+//-----------------------------------------------------------------------------------------
+class HuffmanEncoder
+{
+  public:
+    // Constructor: Builds the tree. Counts holds the number of occurrences of each of the 256 byte values.
+    explicit HuffmanEncoder(const int* Counts);
+    
+    // Returns the number of bytes which WriteTable and Encode write for the bytes counted in Counts (the ones passed to
+    // the constructor), i.e. the size of the huffman data behind the total byte count.
+    size_t GetEncodedSize(const int* Counts)const;
+    
+    // Writes the whole huffman tree.
+    template <class WriterT>
+    void WriteTable(WriterT& Writer)const { WriteNodeTable(m_RootIndex, Writer); }
+    
+    // Writes each byte in the compressed format. Only bytes with a count > 0 may be encoded.
+    template <class WriterT>
+    void Encode(const unsigned char* InData, size_t InLength, WriterT& Writer)const
+    {
+      for (const unsigned char* const InEnd = InData + InLength; InData != InEnd; ++InData)
+      {
+        // Most codes fit into the first word.
+        const int CodeLength = m_CodeLengths[*InData];
+        if (CodeLength <= CODE_WORD_BITS)
+          Writer.PutBits(m_Codes[*InData][0], CodeLength);
+        else
+          PutLongCode(*InData, Writer);
+      }
+    }
+    
   private:
-    // Reads a byte from the bitset (NextBit is thus advanced by 8).
-    unsigned char ExtractByteFromBitset(const boost::dynamic_bitset<unsigned char>& Source, size_t& NextBit);
+    // Writes the table of the node and its childs: A flag which indicates if childs are available, followed either by
+    // the childs or by the byte.
+    template <class WriterT>
+    void WriteNodeTable(int NodeIndex, WriterT& Writer)const;
+    
+    // Returns the number of bits which WriteNodeTable writes for the node.
+    uint64_t GetNodeTableBits(int NodeIndex)const;
+    
+    // Stores the code of each leaf below the node. Code holds the bits of the path from the root (the first bit is the
+    // least significant one).
+    void AssignCodes(int NodeIndex, int CodeLength);
+    
+    // Writes a code which is longer than CODE_WORD_BITS.
+    template <class WriterT>
+    void PutLongCode(unsigned char B, WriterT& Writer)const;
   
   private:
-    int Char; // The byte of that node. Only valid if Childs.size()==0.
+    // The codes are split into words of CODE_WORD_BITS bits. Bytes which don't occur can get codes with up to 255 bits,
+    // because the nodes with count 0 are part of the tree as well.
+    static const int CODE_WORD_BITS = 32;
+    static const int MAX_CODE_WORDS = 256 / CODE_WORD_BITS;
+    
+  private:
+    SHuffmanNode m_Nodes[MAX_HUFFMAN_NODES];
+    int m_RootIndex;
     
-    vector<HuffmanNode*> Childs; // The child-nodes.
-    vector<unsigned char> Bits;
+    // The code of each byte (see AssignCodes). Bytes behind the last used byte have no code.
+    uint64_t m_Codes[256][MAX_CODE_WORDS];
+    int m_CodeLengths[256];
+    
+    // The bits of the path to the node, which is currently visited by AssignCodes.
+    uint64_t m_CurCode[MAX_CODE_WORDS];
 };
 
-// Helper function:
-// Clears the specified vector.
-void CleanupHuffmanVector(vector<HuffmanNode*>& ToClean)
+HuffmanEncoder::HuffmanEncoder(const int* Counts):
+    m_RootIndex(0)
 {
-  for (size_t CurIndex = 0; CurIndex < ToClean.size(); ++CurIndex)
+  //- - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Build compression table, i.e. the huffman-tree. This is done so that the character which appears the most is at the top of the tree.
+  
+  // Create a list of nodes. Each node corresponds to 1 character.
+  int List[256]; // Node indices.
+  int ListSize = 0;
+  for (int i = 0; i < 256; ++i)
   {
-    HuffmanNode* CurNode = ToClean.at(CurIndex);
-    if (CurNode != NULL)
-      delete CurNode;
+    SHuffmanNode& Node = m_Nodes[i];
+    Node.Count = Counts[i];
+    Node.Childs[0] = Node.Childs[1] = -1;
+    Node.Char = static_cast<unsigned char>(i);
+    
+    List[ListSize++] = i;
+    m_CodeLengths[i] = 0;
   }
+  int NumNodes = 256;
   
-  ToClean.clear();
-}
-
-HuffmanNode::~HuffmanNode()
-{
-  // Cleanup
-  CleanupHuffmanVector(Childs);
-}
+  // Remove unused nodes from the back of the list.
+  while (ListSize > 1 && m_Nodes[List[ListSize-1]].Count == 0)
+    --ListSize;
+  
+  while (ListSize > 1)
+  {
+    // Create a new node with the last 2 nodes of the list as childs. The size of the list is reduced by 2.
+    const int NewIndex = NumNodes++;
+    SHuffmanNode& NewNode = m_Nodes[NewIndex];
+    NewNode.Count = 0;
+    NewNode.Char = 0;
+    for (int CurChildIndex = 0; CurChildIndex < 2; ++CurChildIndex)
+    {
+      NewNode.Childs[CurChildIndex] = List[--ListSize];
+      NewNode.Count += m_Nodes[NewNode.Childs[CurChildIndex]].Count;
+    }
+    
+    // Insert the new node in the list, so that the elements are sorted by the 'Count'-member after the end of this "big" loop.
+    int InsertPos = 0;
+    while (InsertPos < ListSize && m_Nodes[List[InsertPos]].Count >= NewNode.Count)
+      ++InsertPos;
+    
+    memmove(List + InsertPos + 1, List + InsertPos, (ListSize - InsertPos) * sizeof(int));
+    List[InsertPos] = NewIndex;
+    ++ListSize;
+  }
+  
+  // Get the root node and compute the codes.
+  m_RootIndex = List[0];
+  memset(m_CurCode, 0, sizeof(m_CurCode));
+  AssignCodes(m_RootIndex, 0);
+}
 
-void HuffmanNode::PrependBit(unsigned char B)
+size_t HuffmanEncoder::GetEncodedSize(const int* Counts)const
 {
-  Bits.insert(Bits.begin(), B);
+  uint64_t NumBits = GetNodeTableBits(m_RootIndex);
+  for (int i = 0; i < 256; ++i)
+    NumBits += static_cast<uint64_t>(Counts[i]) * m_CodeLengths[i];
   
-  for (size_t CurChildIndex = 0; CurChildIndex < Childs.size(); ++CurChildIndex)
-    Childs[CurChildIndex]->PrependBit(B);
+  return static_cast<size_t>((NumBits + 7) / 8);
 }
 
-void HuffmanNode::WriteTable(boost::dynamic_bitset<unsigned char>& Buffer)const
+template <class WriterT>
+void HuffmanEncoder::WriteNodeTable(int NodeIndex, WriterT& Writer)const
 {
+  const SHuffmanNode& Node = m_Nodes[NodeIndex];
+  
   // Write a flag which indicates if childs are available.
-  Buffer.push_back(Childs.size() != 0);
+  Writer.PutBit(!Node.IsLeaf());
   
   // Either write all childs to the buffer or our own byte.
-  if (Childs.size() > 0)
+  if (!Node.IsLeaf())
   {
-    for (size_t CurChildIndex = 0; CurChildIndex < Childs.size(); ++CurChildIndex)
-      Childs[CurChildIndex]->WriteTable(Buffer);
+    WriteNodeTable(Node.Childs[0], Writer);
+    WriteNodeTable(Node.Childs[1], Writer);
   }
   else
-    Buffer.append(static_cast<unsigned char>(Char));
+    Writer.PutByte(Node.Char);
 }
 
-void HuffmanNode::WriteBits(boost::dynamic_bitset<unsigned char>& Buffer)const
+uint64_t HuffmanEncoder::GetNodeTableBits(int NodeIndex)const
 {
-  // Iterate through all bits and write each one to the buffer.
-  for (size_t CurBitIndex = 0; CurBitIndex < Bits.size(); ++CurBitIndex)
-    Buffer.push_back((Bits[CurBitIndex] == 0) ? false : true);
+  // The flag, then either the childs or the byte.
+  const SHuffmanNode& Node = m_Nodes[NodeIndex];
+  if (Node.IsLeaf())
+    return 1 + 8;
+  
+  return 1 + GetNodeTableBits(Node.Childs[0]) + GetNodeTableBits(Node.Childs[1]);
 }
 
-void HuffmanNode::ReadTable(const boost::dynamic_bitset<unsigned char>& Source, size_t& NextBit)
+void HuffmanEncoder::AssignCodes(int NodeIndex, int CodeLength)
 {
-  // Check if this node should have childs.
-  if (Source[NextBit++])
+  const SHuffmanNode& Node = m_Nodes[NodeIndex];
+  
+  if (Node.IsLeaf())
   {
-    // Add 2 new childs and initialize them.
-    for (size_t CurChildIndex = 0; CurChildIndex < 2; ++CurChildIndex)
-    {
-      HuffmanNode* NewNode = new HuffmanNode(-1);
-      NewNode->ReadTable(Source, NextBit);
-      
-      Childs.push_back(NewNode);
-    }
+    memcpy(m_Codes[Node.Char], m_CurCode, sizeof(m_CurCode));
+    m_CodeLengths[Node.Char] = CodeLength;
+    return;
   }
-  else
-    Char = ExtractByteFromBitset(Source, NextBit);
+  
+  // The tree has 256 leaves at most, so the depth of a child is < 256.
+  uint64_t& Word = m_CurCode[CodeLength / CODE_WORD_BITS];
+  const uint64_t Bit = uint64_t(1) << (CodeLength % CODE_WORD_BITS);
+  
+  Word &= ~Bit;
+  AssignCodes(Node.Childs[0], CodeLength+1);
+  Word |= Bit;
+  AssignCodes(Node.Childs[1], CodeLength+1);
+  Word &= ~Bit;
 }
 
-unsigned char HuffmanNode::ExtractByteFromBitset(const boost::dynamic_bitset<unsigned char>& Source, size_t& NextBit)
+template <class WriterT>
+void HuffmanEncoder::PutLongCode(unsigned char B, WriterT& Writer)const
 {
-  unsigned char Mask = 0x01; // Defines which bit is extracted next from the bitset.
-  unsigned char ToReturn = 0; // Used to build the byte.
-  
-  // Loop through the next 8 bits in the bitset.
-  for (size_t NumExtractedBits = 0; NumExtractedBits < sizeof(unsigned char)*8; ++NumExtractedBits)
-  {
-    // In case the bit is set, set the corresponding bit in 'ToReturn'.
-    if (Source.test(NextBit++))
-      ToReturn |= Mask;
+  int RemainingBits = m_CodeLengths[B];
+  for (int CurWord = 0; RemainingBits > 0; ++CurWord, RemainingBits -= CODE_WORD_BITS)
+    Writer.PutBits(m_Codes[B][CurWord], RemainingBits < CODE_WORD_BITS ? RemainingBits : CODE_WORD_BITS);
+}
+
+//-----------------------------------------------------------------------------------------
+// HuffmanTree class: The tree as read by the decoders. The bits are taken from a BitReaderT, which provides
+// "int ReadBit()" and throws if no bit is left.
+//-----------------------------------------------------------------------------------------
+class HuffmanTree
+{
+  public:
+    HuffmanTree(): m_NumNodes(0), m_MaxNodes(MAX_HUFFMAN_NODES)
+    { }
     
-    // Extract the next more significant bit the next time.
-    Mask <<= 1;
-  }
+    // Reads the tree (see HuffmanEncoder::WriteNodeTable). A tree with more nodes or a deeper leaf is rejected as soon
+    // as the node is read.
+    template <class BitReaderT>
+    void Read(BitReaderT& Reader, int MaxNodes = MAX_HUFFMAN_NODES, int MaxDepth = MAX_HUFFMAN_DEPTH)
+    {
+      m_NumNodes = 0;
+      m_MaxNodes = std::min(MaxNodes, MAX_HUFFMAN_NODES);
+      ReadNodeTable(Reader, 0, MaxDepth);
+    }
+    
+    // Returns true, if the tree only consists of the root, i.e. if a byte is decoded without reading any bits.
+    bool IsRootOnly()const { return m_Nodes[0].IsLeaf(); }
+    
+    // Decodes the next byte.
+    template <class BitReaderT>
+    unsigned char DecodeByte(BitReaderT& Reader)const
+    {
+      // Get the correct node.
+      const SHuffmanNode* Node = &m_Nodes[0];
+      while (!Node->IsLeaf())
+        Node = &m_Nodes[Node->Childs[Reader.ReadBit()]];
+      
+      return Node->Char;
+    }
   
-  return ToReturn;
-}
+  private:
+    // Reads the table of a node (at the depth Depth) and its childs and returns the index of the node.
+    template <class BitReaderT>
+    int ReadNodeTable(BitReaderT& Reader, int Depth, int MaxDepth);
+  
+  private:
+    SHuffmanNode m_Nodes[MAX_HUFFMAN_NODES]; // The root is the first node.
+    int m_NumNodes;
+    int m_MaxNodes;
+};
 
-void HuffmanNode::InitializeChilds(vector<HuffmanNode*>& NodeSrc)
+template <class BitReaderT>
+int HuffmanTree::ReadNodeTable(BitReaderT& Reader, int Depth, int MaxDepth)
 {
-  assert(NodeSrc.size() > 1);
+  if (m_NumNodes >= m_MaxNodes)
+    throw std::runtime_error("Too many nodes in the huffman table (in uz1HuffmanAlgorithm::Decompress).");
+  if (Depth > MaxDepth)
+    throw std::runtime_error("The huffman table is too deep (in uz1HuffmanAlgorithm::Decompress).");
+  
+  const int NodeIndex = m_NumNodes++;
   
-  // Add 2 new childs with the nodes from the back of the vector.
-  for (size_t CurChildIndex = 0; CurChildIndex < 2; ++CurChildIndex)
+  // Check if this node should have childs.
+  if (Reader.ReadBit() != 0)
   {
-    HuffmanNode* NewChildNode = NodeSrc.back();
-   
-    // Add the new child and remove the node from the input-vector. 
-    Childs.push_back(NewChildNode);
-    NodeSrc.pop_back();
+    const int Child0 = ReadNodeTable(Reader, Depth+1, MaxDepth);
+    const int Child1 = ReadNodeTable(Reader, Depth+1, MaxDepth);
+    m_Nodes[NodeIndex].Childs[0] = Child0;
+    m_Nodes[NodeIndex].Childs[1] = Child1;
+  }
+  else
+  {
+    unsigned char Char = 0;
+    for (int CurBit = 0; CurBit < 8; ++CurBit)
+      Char |= static_cast<unsigned char>(Reader.ReadBit() << CurBit);
     
-    // Init child.
-    NewChildNode->PrependBit(static_cast<BYTE>(CurChildIndex));
-    Count += NewChildNode->Count;
+    m_Nodes[NodeIndex].Childs[0] = m_Nodes[NodeIndex].Childs[1] = -1;
+    m_Nodes[NodeIndex].Char = Char;
   }
+  
+  return NodeIndex;
 }
 
-} // End anonymious namespace
-
 //-----------------------------------------------------------------------------------------
-// Function implementation
+// SpanBitReader class: Reads the bits directly from a buffer (least significant bit of each byte first).
 //-----------------------------------------------------------------------------------------
+class SpanBitReader
+{
+  public:
+    // Constructor: InData must stay valid as long as the object is used.
+    explicit SpanBitReader(const SByteSpan& InData):
+      m_pBits(InData.Data), m_NumBits(InData.Length * 8), m_NextBit(0)
+    { }
+    
+    // Returns the next bit.
+    int ReadBit()
+    {
+      if (m_NextBit >= m_NumBits)
+        throw std::runtime_error("Tried to read more bits than in the input stream (in uz1HuffmanAlgorithm::Decompress).");
+      
+      const int ToReturn = (m_pBits[m_NextBit >> 3] >> (m_NextBit & 7)) & 1;
+      ++m_NextBit;
+      return ToReturn;
+    }
+    
+    // Returns the number of bits which weren't read yet.
+    size_t GetRemainingBits()const { return m_NumBits - m_NextBit; }
+    
+    // Returns the number of bytes read so far (including the partially read one).
+    size_t GetConsumedBytes()const { return m_NextBit/8; }
+  
+  private:
+    const unsigned char* m_pBits;
+    size_t m_NumBits;
+    size_t m_NextBit;
+};
 
-// Constructor
-uzLib::uz1HuffmanAlgorithm::uz1HuffmanAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
-    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
-{ }
-
-bool uzLib::uz1HuffmanAlgorithm::Compress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+//-----------------------------------------------------------------------------------------
+// HuffmanDecoder class: Reads the total byte count and the tree, and decodes the bytes in slices.
+//-----------------------------------------------------------------------------------------
+class HuffmanDecoder
 {
-  static const std::wstring UPDATE_MSG1 = L"Huffman-Encoding (1)";
-  static const std::wstring UPDATE_MSG2 = L"Huffman-Encoding (2)";
+  public:
+    // Constructor: Reads the total byte count and the tree from InData (which must stay valid as long as the object is used).
+    // The tree is checked against the limits.
+    explicit HuffmanDecoder(const SByteSpan& InData, const SUz1DecodeLimits& Limits = SUz1DecodeLimits());
+    
+    // Decodes max. MaxCount bytes into OutData and returns the number of decoded bytes (0 if all bytes are decoded).
+    size_t Decode(unsigned char* OutData, size_t MaxCount);
+    
+    // Decodes the next byte. Must only be called if GetRemaining() > 0.
+    unsigned char DecodeByte()
+    {
+      --m_Remaining;
+      return m_Tree.DecodeByte(m_Bits);
+    }
+    
+    // Returns the number of decoded bytes (as saved in the header).
+    int GetTotal()const { return m_Total; }
+    
+    // Returns the number of bytes which still need to be decoded.
+    int GetRemaining()const { return m_Remaining; }
+    
+    // Returns the number of input bytes read so far.
+    size_t GetConsumedBytes()const { return sizeof(int) + m_Bits.GetConsumedBytes(); }
+  
+  private:
+    SpanBitReader m_Bits; // The table and the encoded bytes.
+    HuffmanTree m_Tree;
+    
+    int m_Total;
+    int m_Remaining;
+};
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
-  const int NumSteps = InStreamLength * 2; // We need to iterate through the input stream twice.
+HuffmanDecoder::HuffmanDecoder(const SByteSpan& InData, const SUz1DecodeLimits& Limits):
+    m_Bits(SByteSpan()), m_Total(0), m_Remaining(0)
+{
+  // Read the size of the uncompressed data.
+  if (InData.Length < sizeof(int))
+    throw std::runtime_error("Failed reading total byte count in uz1HuffmanAlgorithm::Decompress");
+  m_Total = GetInt(InData.Data);
+  if (m_Total < 0)
+    throw std::runtime_error("Invalid total byte count in uz1HuffmanAlgorithm::Decompress");
+  m_Remaining = m_Total;
   
-  if (CallUpdateFunction(0, NumSteps, UPDATE_MSG1))
-    return false;
+  // The bits are read directly from the input.
+  m_Bits = SpanBitReader(SByteSpan(InData.Data + sizeof(int), InData.Length - sizeof(int)));
+  
+  // Build the huffman tree.
+  m_Tree.Read(m_Bits, Limits.MaxHuffmanNodes > 0 ? Limits.MaxHuffmanNodes : MAX_HUFFMAN_NODES, 
+      Limits.MaxHuffmanDepth > 0 ? Limits.MaxHuffmanDepth : MAX_HUFFMAN_DEPTH);
+  
+  // Every byte needs at least one bit (unless the tree only consists of the root), so a Total which can't be
+  // right is rejected before anything is decoded.
+  if (!m_Tree.IsRootOnly() && static_cast<size_t>(m_Total) > m_Bits.GetRemainingBits())
+    throw std::runtime_error("Tried to read more bits than in the input stream (in uz1HuffmanAlgorithm::Decompress).");
+}
 
-  const size_t SavedInPos = InStream.tellg();
+size_t HuffmanDecoder::Decode(unsigned char* OutData, size_t MaxCount)
+{
+  const size_t Count = std::min(MaxCount, static_cast<size_t>(m_Remaining));
   
-  vector<HuffmanNode*> HuffmanNodes;
-  HuffmanNodes.reserve(256);
+  for (size_t CurIndex = 0; CurIndex < Count; ++CurIndex)
+    OutData[CurIndex] = DecodeByte();
   
-  try
+  return Count;
+}
+
+} // End anonymious namespace
+
+namespace
+{
+  // First pass of the huffman encoding: Counts the occurrences of each byte value of InData.
+  template <class ProgressT>
+  bool CountHuffmanBytes(const SByteSpan& InData, int* Counts, const ProgressT& Progress)
   {
-    //- - - - - - - - - - - - - - - - - - - - - - - - - - -
-		// Compute character frequencies.
+    static const std::wstring UPDATE_MSG1 = L"Huffman-Encoding (1)";
 
-    // Create a list of nodes. Each node corresponds to 1 character.
-    for (int i = 0; i < 256; ++i)
-      HuffmanNodes.push_back(new HuffmanNode(i));
-    assert(HuffmanNodes.size() == 256);
-        
-    // Initialize the huffman nodes (set the number of times the corresponding character appears).
-    int Total = 0; // After the loop this will contain the number of bytes in the input-stream.
-    BYTE CurByte;
-    while (TryReadNextByte(InStream, CurByte))
+    const int InStreamLength = static_cast<int>(InData.Length);
+    const int NumSteps = InStreamLength * 2; // We need to iterate through the input stream twice.
+  
+    if (Progress(0, NumSteps, UPDATE_MSG1))
+      return false;
+  
+    // In slices, so that the update function isn't checked for each byte.
+    std::fill(Counts, Counts + 256, 0);
+    for (int Total = 0; Total < InStreamLength; Total += uz1AlgorithmBase::BYTE_UPDATE_INTERVALL)
     {
-      if ((Total % BYTE_UPDATE_INTERVALL ==0) && CallUpdateFunction(Total, NumSteps, UPDATE_MSG1))
-      {
-        CleanupHuffmanVector(HuffmanNodes);
+      if (Progress(Total, NumSteps, UPDATE_MSG1))
         return false;
-      }
-      
-      HuffmanNodes[CurByte]->Count++;
-      ++Total;
-    }
-    
-    InStream.clear();
-    InStream.seekg(SavedInPos);
-    WriteInt(OutStream, Total);
-    
     
-    //- - - - - - - - - - - - - - - - - - - - - - - - - - -
-    // Build compression table, i.e. the huffman-tree. This is done so that the character which appears the most is at the top of the tree.
-    
-    // Remove unused nodes from the back of the node-array.
-    while (HuffmanNodes.size() > 1 && HuffmanNodes.back()->Count == 0)
-    {  
-      delete HuffmanNodes.back();
-      HuffmanNodes.pop_back();
+      const unsigned char* const SliceEnd = InData.Data + std::min(InStreamLength, Total + uz1AlgorithmBase::BYTE_UPDATE_INTERVALL);
+      for (const unsigned char* pCur = InData.Data + Total; pCur != SliceEnd; ++pCur)
+        Counts[*pCur]++;
     }
-  } // Try ends here because below all nodes are connected with each other and a node deletes all its childs. Bad design, I know...
-  catch(...)
-  {
-    CleanupHuffmanVector(HuffmanNodes);
-    throw; // Rethrow
-  }
-
     
-  // Create a copy of the node-pointers. All nodes should stay valid from here on.
-  // It is used to access the correct node by a given byte (which directly comes from the input stream).
-  vector<HuffmanNode*> ByteToNodeVector(HuffmanNodes);
+    return true;
+  }
   
-  //size_t BitCount = HuffmanNodes.size() * (8+1);
-  while (HuffmanNodes.size() > 1)
+  // Second pass of the huffman encoding: Writes the table and the bitstream of InData (without the total byte count)
+  // to Target (see BasicBitWriter).
+  template <class TargetT, class ProgressT>
+  bool WriteHuffmanBits(const SByteSpan& InData, const HuffmanEncoder& Encoder, TargetT& Target, 
+      const ProgressT& Progress)
   {
-    // Create a new node and initialize its childs. The size of the HuffmanNodes-vector is reduced by 2.
-    HuffmanNode* NewNode = new HuffmanNode(-1);
-    NewNode->InitializeChilds(HuffmanNodes);
+    static const std::wstring UPDATE_MSG2 = L"Huffman-Encoding (2)";
+
+    const int InStreamLength = static_cast<int>(InData.Length);
+    const int NumSteps = InStreamLength * 2;
     
-    // Insert the new node in the HuffmanNodes-vector, so that the elements are sorted by the 'Count'-member after the end of this "big" loop.
-    vector<HuffmanNode*>::iterator InsertPos = HuffmanNodes.begin();
-    while (InsertPos != HuffmanNodes.end())
+    BasicBitWriter<TargetT> OutBits(Target);
+    Encoder.WriteTable(OutBits);
+  
+    // Encode each byte in the input stream, i.e. write each byte in the compressed format.
+    for (int ProcessedBytes = 0; ProcessedBytes < InStreamLength; ProcessedBytes += uz1AlgorithmBase::BYTE_UPDATE_INTERVALL)
     {
-      if ((*InsertPos)->Count < NewNode->Count)
-        break;
+      if (Progress(InStreamLength + ProcessedBytes, NumSteps, UPDATE_MSG2))
+        return false;
     
-      InsertPos++;
+      Encoder.Encode(InData.Data + ProcessedBytes, std::min(InStreamLength - ProcessedBytes, uz1AlgorithmBase::BYTE_UPDATE_INTERVALL), OutBits);
     }
-        
-    HuffmanNodes.insert(InsertPos, NewNode);
-    //++BitCount;
+    OutBits.Flush();
+
+    return true;
   }
   
-  //- - - - - - - - - - - - - - - - - - - - - - - - - - -
-  // Calc stats.
-  /*while (!IsEOF(InStream))
+  // Kernel of uz1HuffmanAlgorithm::Compress (see the progress policies), but the result is appended to OutData.
+  template <class ProgressT>
+  bool AppendHuffmanStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress)
   {
-    const BYTE CurByte = ReadByte(InStream);
-    BitCount += ByteToNodeVector.at(CurByte)->GetBitCount();
-  }
-  InStream.clear();
-  InStream.seekg(SavedInPos);*/
-  
-  //- - - - - - - - - - - - - - - - - - - - - - - - - - -
-  // Save table and bitstream.
+    int Counts[256];
+    if (!CountHuffmanBytes(InData, Counts, Progress))
+      return false;
   
-  // Get the root node.
-  HuffmanNode* RootNode = HuffmanNodes.back();
-  HuffmanNodes.pop_back();    
+    const size_t TotalPos = OutData.size();
+    OutData.resize(TotalPos + sizeof(int));
+    PutInt(&OutData[TotalPos], static_cast<int>(InData.Length));
   
-  // Write the whole huffman tree.
-  boost::dynamic_bitset<unsigned char> OutBits;
-  RootNode->WriteTable(OutBits);
+    // Build the tree and save table and bitstream (appended to the total byte count).
+    const HuffmanEncoder Encoder(Counts);
+    return WriteHuffmanBits(InData, Encoder, OutData, Progress);
+  }
   
-  // Encode each byte in the input stream, i.e. write each byte in the compressed format.
-  int ProcessedBytes = InStreamLength;
-  char CurByte;
-  while (TryReadNextByte(InStream, CurByte))
+  template <class ProgressT>
+  bool EncodeHuffmanStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress)
   {
-    if ((ProcessedBytes % BYTE_UPDATE_INTERVALL == 0) && CallUpdateFunction(ProcessedBytes, NumSteps, UPDATE_MSG2))
-    {
-      // Cleanup ALL nodes (every node is an (indirect) child of the root node, and in the node's destructor the childs are deleted).
-      delete RootNode;
-      RootNode = NULL;
-      HuffmanNodes.clear();
-      ByteToNodeVector.clear();
-      return false;
-    }
-
-    ByteToNodeVector.at(CurByte)->WriteBits(OutBits);
-    ++ProcessedBytes;
+    OutData.clear();
+    return AppendHuffmanStep(InData, OutData, Progress);
   }
-  
-  // Cleanup ALL nodes (every node is an (indirect) child of the root node, and in the node's destructor the childs are deleted).
-  delete RootNode;
-  RootNode = NULL;
-  HuffmanNodes.clear();
-  ByteToNodeVector.clear();
-  
-  //assert(OutBits.size() == BitCount);
-  //if (OutBits.size() != BitCount)
-  //  return false;
+}
+
+//-----------------------------------------------------------------------------------------
+// Function implementation
+//-----------------------------------------------------------------------------------------
 
-  // Write all bits to the output stream.
-  std::ostream_iterator<BYTE, BYTE> OutIter(OutStream);
-  boost::to_block_range(OutBits, OutIter);
+// Constructor
+uzLib::uz1HuffmanAlgorithm::uz1HuffmanAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
+    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
+{ }
 
-  return true;
+bool uzLib::uz1HuffmanAlgorithm::Compress(const SByteSpan& InData, ByteVector& OutData)
+{
+  if (GetUpdateFunc() == NULL)
+    return EncodeHuffmanStep(InData, OutData, NoProgress());
+  
+  return EncodeHuffmanStep(InData, OutData, [this](unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)
+      { return CallUpdateFunction(CurStatus, CompletedStatus, Msg); });
 }
 
-bool uzLib::uz1HuffmanAlgorithm::Decompress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+bool uzLib::uz1HuffmanAlgorithm::Decompress(const SByteSpan& InData, ByteVector& OutData)
 {
   static const std::wstring UPDATE_MSG1 = L"Huffman-Decoding (reading)";
   static const std::wstring UPDATE_MSG2 = L"Huffman-Decoding (reconstructing)";
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
+  const int InStreamLength = static_cast<int>(InData.Length);
   
   if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG1))
     return false;
 
-  // Read the size of the uncompressed data.
-  int Total = ReadInt(InStream);
-  if (!InStream.good())
-    throw std::runtime_error("Failed reading total byte count in uz1HuffmanAlgorithm::Decompress");
+  // Read the size of the uncompressed data and the tree.
+  HuffmanDecoder Decoder(InData, m_DecodeLimits);
   
   if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG1))
     return false;
   
-  // Read all bits into memory. Don't use istream_iterator, because it will read formatted data.
-  std::istreambuf_iterator<BYTE> InStreamIter(InStream);
-  std::istreambuf_iterator<BYTE> EndOfInStreamIter;
-  boost::dynamic_bitset<unsigned char> InBits(InStreamIter, EndOfInStreamIter);
+  // The output size is known from the header. The data might be the input of the RLE step of 5678, which expands it.
+  DecodeBudget Budget(m_DecodeLimits);
+  Budget.CheckHuffmanTotal(Decoder.GetTotal(), true);
+  OutData.resize(Decoder.GetTotal());
   
-  // Build the huffman tree.
-  HuffmanNode RootNode(-1);
-  size_t NextBit = 0;
-  RootNode.ReadTable(InBits, NextBit);
-  
-  const size_t TotalBitCount = InBits.size();
-  
-  // Reconstruct the uncompressed data.
-  while(Total-- > 0)
+  // Reconstruct the uncompressed data in slices, so that the update function can be called in between.
+  for (size_t ProcessedBytes = 0; ProcessedBytes < OutData.size(); ProcessedBytes += BYTE_UPDATE_INTERVALL)
   {
-    if (((NextBit/8) % BYTE_UPDATE_INTERVALL == 0) && CallUpdateFunction(NextBit/8, TotalBitCount/8, UPDATE_MSG2))
+    if (CallUpdateFunction(Decoder.GetConsumedBytes(), InStreamLength, UPDATE_MSG2))
       return false;
-
-    if (NextBit >= TotalBitCount)
-      throw std::runtime_error("Tried to read more bits than in the input stream (in uz1HuffmanAlgorithm::Decompress).");
-  
-    // Get the correct node.
-    HuffmanNode* Node = &RootNode;
-    while(Node->GetChar() == -1)
-      Node = Node->GetChild(InBits.test( NextBit++ ));
+    Budget.CheckCPUTime();
     
-    // Get the corresponding byte and write it.
-    const BYTE CurByte = static_cast<BYTE>(Node->GetChar());
-    WriteByte(OutStream, CurByte);
+    Decoder.Decode(&OutData[ProcessedBytes], BYTE_UPDATE_INTERVALL);
   }
   
   return true;
@@ -1552,103 +2568,1929 @@ bool uzLib::uz1HuffmanAlgorithm::Decompress(uzLib::in_stream& InStream, uzLib::o
 //============================================================================================================================
 
 //-----------------------------------------------------------------------------------------
-// Function implementation
+// Helper classes
 //-----------------------------------------------------------------------------------------
+namespace
+{
+  // Incremental move-to-front encoder. The byte list is kept between the calls, so the input can be split at any position.
+  class MTFEncoder
+  {
+    public:
+      // Constructor
+      MTFEncoder()
+      {
+        for (int CurByte = 0; CurByte < 256; ++CurByte)
+          m_List[CurByte] = static_cast<unsigned char>(CurByte);
+      }
+      
+      // Encodes the bytes. Every input byte results in exactly one output byte, i.e. OutData must have room for InLength bytes
+      // (OutData may be the same as InData).
+      void Encode(const unsigned char* InData, size_t InLength, unsigned char* OutData)
+      {
+        for (const unsigned char* const InEnd = InData + InLength; InData != InEnd; ++InData)
+        {
+          const unsigned char CurByte = *InData;
+          
+          // Find the index of the current byte in the list (always succeeds, as the list is a permutation of all bytes).
+          int ByteIndexInList = 0;
+          while (m_List[ByteIndexInList] != CurByte)
+            ++ByteIndexInList;
+          
+          // Write the position of the byte in the list to the output.
+          *OutData++ = static_cast<unsigned char>(ByteIndexInList);
+          
+          // Move the entry of the current byte in the list to the front of the list.
+          memmove(m_List + 1, m_List, ByteIndexInList);
+          m_List[0] = CurByte;
+        }
+      }
+    
+    private:
+      unsigned char m_List[256];
+  };
+  
+  // Incremental move-to-front decoder. The byte list is kept between the calls, so the input can be split at any position.
+  class MTFDecoder
+  {
+    public:
+      // Constructor
+      MTFDecoder()
+      {
+        for (int CurByte = 0; CurByte < 256; ++CurByte)
+          m_List[CurByte] = static_cast<unsigned char>(CurByte);
+      }
+      
+      // Decodes the bytes. Every input byte results in exactly one output byte, i.e. OutData must have room for InLength bytes
+      // (OutData may be the same as InData).
+      void Decode(const unsigned char* InData, size_t InLength, unsigned char* OutData)
+      {
+        for (const unsigned char* const InEnd = InData + InLength; InData != InEnd; ++InData)
+          *OutData++ = DecodeByte(*InData);
+      }
+      
+      // Returns the original byte of the list index and moves it to the front of the list.
+      unsigned char DecodeByte(unsigned char ListIndex)
+      {
+        const unsigned char DecompressedByte = m_List[ListIndex];
+        memmove(m_List + 1, m_List, ListIndex);
+        m_List[0] = DecompressedByte;
+        return DecompressedByte;
+      }
+    
+    private:
+      unsigned char m_List[256];
+  };
+}
 
-// Constructor
-uzLib::uz1MoveToFrontAlgorithm::uz1MoveToFrontAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
-    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
-{ }
-
-bool uzLib::uz1MoveToFrontAlgorithm::Compress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+namespace
 {
-  static const std::wstring UPDATE_MSG = L"Move-to-front encoding";
+  // Kernel of uz1MoveToFrontAlgorithm::Compress (see the progress policies).
+  template <class ProgressT>
+  bool EncodeMTFStep(const SByteSpan& InData, ByteVector& OutData, const ProgressT& Progress)
+  {
+    static const std::wstring UPDATE_MSG = L"Move-to-front encoding";
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
-  if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
-    return false;
-  
-  // Create the byte list.
-  BYTE List[256];
-  for (int CurByte = 0; CurByte < 256; ++CurByte)
-    List[CurByte] = static_cast<BYTE>(CurByte);
+    const int InStreamLength = static_cast<int>(InData.Length);
+    if (Progress(0, InStreamLength, UPDATE_MSG))
+      return false;
   
-  int ProcessedBytes = 0;
+    // Every input byte results in exactly one output byte.
+    OutData.resize(InData.Length);
   
-  // Iterate through all bytes in the input stream.
-  BYTE CurByte;
-  while (TryReadNextByte(InStream, CurByte))
-  {
-    if ((ProcessedBytes % BYTE_UPDATE_INTERVALL == 0) && CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
-      return false;
-
-    ++ProcessedBytes;
-    
-    // Find the index of the current byte in the list.
-    int ByteIndexInList = 0;
-    while (ByteIndexInList < 256)
+    // Encode the input in slices, so that the update function can be called in between.
+    MTFEncoder Encoder;
+    for (int ProcessedBytes = 0; ProcessedBytes < InStreamLength; ProcessedBytes += uz1AlgorithmBase::BYTE_UPDATE_INTERVALL)
     {
-      if (List[ByteIndexInList] == CurByte)
-        break;
-    
-      ++ByteIndexInList;
-    }
-    
-    if (ByteIndexInList >= 256)
-      throw std::logic_error("Couldn't find index of current byte (in uz1MoveToFrontAlgorithm::Compress)");
-    
-    // Write the position of the byte in the list to the output stream.
-    WriteByte(OutStream, static_cast<BYTE>(ByteIndexInList));
+      if (Progress(ProcessedBytes, InStreamLength, UPDATE_MSG))
+        return false;
     
-    // Move the entry of the current byte in the list to the front of the list.
-    const int NewPos = 0;
-    while (ByteIndexInList > NewPos)
-    {
-      List[ByteIndexInList] = List[ByteIndexInList - 1];
-      --ByteIndexInList;
+      Encoder.Encode(InData.Data + ProcessedBytes, std::min(InStreamLength - ProcessedBytes, uz1AlgorithmBase::BYTE_UPDATE_INTERVALL), 
+          &OutData[ProcessedBytes]);
     }
-    List[NewPos] = CurByte;
+  
+    return true;
   }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function implementation
+//-----------------------------------------------------------------------------------------
+
+// Constructor
+uzLib::uz1MoveToFrontAlgorithm::uz1MoveToFrontAlgorithm(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps):
+    uz1AlgorithmBase(UpdateFunc, UserObj, ThisStepNum, NumSteps)
+{ }
+
+bool uzLib::uz1MoveToFrontAlgorithm::Compress(const SByteSpan& InData, ByteVector& OutData)
+{
+  if (GetUpdateFunc() == NULL)
+    return EncodeMTFStep(InData, OutData, NoProgress());
   
-  return true;
+  return EncodeMTFStep(InData, OutData, [this](unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg)
+      { return CallUpdateFunction(CurStatus, CompletedStatus, Msg); });
 }
 
-bool uzLib::uz1MoveToFrontAlgorithm::Decompress(uzLib::in_stream& InStream, uzLib::out_stream& OutStream, ios::pos_type InStreamBeg)
+bool uzLib::uz1MoveToFrontAlgorithm::Decompress(const SByteSpan& InData, ByteVector& OutData)
 {
   static const std::wstring UPDATE_MSG = L"Move-to-front decoding";
 
-  const int InStreamLength = AlgorithmPreamble(InStream, OutStream, InStreamBeg);
+  const int InStreamLength = static_cast<int>(InData.Length);
   if (CallUpdateFunction(0, InStreamLength, UPDATE_MSG))
     return false;
   
-  // Create the byte list.
-  unsigned char List[256];
-  for (int CurByte = 0; CurByte < 256; ++CurByte)
-    List[CurByte] = static_cast<unsigned char>(CurByte);
-
-  int ProcessedBytes = 0;
+  // Every input byte results in exactly one output byte.
+  OutData.resize(InData.Length);
   
-  // Iterate through all bytes in the input stream.
-  BYTE CurByteTMP;
-  while (TryReadNextByte(InStream, CurByteTMP))
+  // Decode the input in slices, so that the update function can be called in between.
+  MTFDecoder Decoder;
+  for (int ProcessedBytes = 0; ProcessedBytes < InStreamLength; ProcessedBytes += BYTE_UPDATE_INTERVALL)
   {
-    unsigned char CurByte = (unsigned char)CurByteTMP;
-
-    if ((ProcessedBytes % BYTE_UPDATE_INTERVALL == 0) && CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
+    if (CallUpdateFunction(ProcessedBytes, InStreamLength, UPDATE_MSG))
       return false;
-
-    ++ProcessedBytes;
-
-    // Get the original byte and write it to the stream.
-    const unsigned char DecompressedByte = List[CurByte];
-
-    WriteByte(OutStream, DecompressedByte);
     
-    const int NewPos = 0;
-    for (int Index = CurByte; Index > NewPos; --Index)
-      List[Index] = List[Index-1];
-    List[NewPos] = DecompressedByte;
+    Decoder.Decode(InData.Data + ProcessedBytes, std::min(InStreamLength - ProcessedBytes, BYTE_UPDATE_INTERVALL), 
+        &OutData[ProcessedBytes]);
   }
   
   return true;
 }
+
+
+//============================================================================================================================
+// Fused huffman/MTF decoding
+//============================================================================================================================
+
+namespace
+{
+  const size_t FUSED_UPDATE_INTERVALL = 0x10000; // Number of huffman symbols decoded between two update-function calls.
+  
+  // Decodes the huffman symbols and passes each one immediately through the inverse RLE (5678 only) and the inverse MTF,
+  // so that the output of the huffman and the RLE decoding is never stored.
+  // HuffmanT is the huffman decoder (HuffmanDecoder or, for non-seekable inputs, StreamHuffmanDecoder).
+  template <class HuffmanT>
+  class HuffmanMTFDecoder
+  {
+    public:
+      // Constructor: Huffman must have read the tree already and stay valid as long as the object is used.
+      HuffmanMTFDecoder(HuffmanT& Huffman, bool bWithRLE):
+        m_Huffman(Huffman), m_bWithRLE(bWithRLE), m_RLECount(0), m_RLEPrevChar(0), m_bRLECountPending(false)
+      { }
+      
+      // Decodes max. MaxSymbols huffman symbols and appends the result to OutData. Returns the number of decoded
+      // symbols (0 if all symbols are decoded).
+      size_t Decode(size_t MaxSymbols, ByteVector& OutData)
+      {
+        return m_bWithRLE ? Decode<true>(MaxSymbols, OutData) : Decode<false>(MaxSymbols, OutData);
+      }
+      
+      // Same as above, but bWithRLE (which must be the value passed to the constructor) is known at compile time.
+      template <bool bWithRLE>
+      size_t Decode(size_t MaxSymbols, ByteVector& OutData)
+      {
+        assert(bWithRLE == m_bWithRLE);
+        const size_t Count = std::min(MaxSymbols, static_cast<size_t>(m_Huffman.GetRemaining()));
+        
+        if (!bWithRLE)
+        {
+          // Every symbol results in exactly one byte.
+          const size_t OldSize = OutData.size();
+          OutData.resize(OldSize + Count);
+          unsigned char* pOut = OutData.empty() ? NULL : &OutData[OldSize];
+          
+          for (size_t CurIndex = 0; CurIndex < Count; ++CurIndex)
+            pOut[CurIndex] = m_MTF.DecodeByte(m_Huffman.DecodeByte());
+        }
+        else
+        {
+          for (size_t CurIndex = 0; CurIndex < Count; ++CurIndex)
+          {
+            const unsigned char CurSymbol = m_Huffman.DecodeByte();
+            
+            // The symbol is the length of the current run: Write the "missing" bytes of the run.
+            if (m_bRLECountPending)
+            {
+              if (CurSymbol < 2)
+                throw std::runtime_error("The read RLE_Count is too small, i.e. invalid (in uz1RLEAlgorithm::Decompress).");
+              
+              for (int CurRunByte = uz1RLEAlgorithm::RLE_LEAD; CurRunByte < CurSymbol; ++CurRunByte)
+                OutData.push_back(m_MTF.DecodeByte(m_RLEPrevChar));
+              
+              m_RLECount = 0;
+              m_bRLECountPending = false;
+              continue;
+            }
+            
+            OutData.push_back(m_MTF.DecodeByte(CurSymbol));
+            
+            if (CurSymbol != m_RLEPrevChar)
+            {
+              m_RLEPrevChar = CurSymbol;
+              m_RLECount = 1;
+            }
+            // After the fifth identical symbol in a row the length of the run follows.
+            else if (++m_RLECount == uz1RLEAlgorithm::RLE_LEAD)
+              m_bRLECountPending = true;
+          }
+        }
+        
+        return Count;
+      }
+      
+      // Returns false, if the input ended right before a run-length.
+      bool IsComplete()const { return !m_bRLECountPending; }
+      
+      // Returns the number of symbols (as saved in the header) and the number of symbols which still need to be decoded.
+      int GetTotal()const { return m_Huffman.GetTotal(); }
+      int GetRemaining()const { return m_Huffman.GetRemaining(); }
+    
+    private:
+      HuffmanT& m_Huffman;
+      MTFDecoder m_MTF;
+      
+      // State of the RLE decoding (see RLEDecoder).
+      const bool m_bWithRLE;
+      int m_RLECount;
+      unsigned char m_RLEPrevChar;
+      bool m_bRLECountPending;
+  };
+  
+  // Implementation of DecodeHuffmanMTF for the signature (with or without RLE) and the progress policy.
+  template <bool bWithRLE, class ProgressT>
+  bool DecodeHuffmanMTF_Templ(const SByteSpan& Payload, ByteVector& OutData, const ProgressT& Progress, 
+      const std::wstring& UpdateMsg, DecodeBudget& Budget)
+  {
+    HuffmanDecoder Huffman(Payload, Budget.GetLimits());
+    HuffmanMTFDecoder<HuffmanDecoder> Decoder(Huffman, bWithRLE);
+    const int Total = Decoder.GetTotal();
+    
+    // Total bounds the size of the output, so too many BWT blocks (or a too big package) are rejected before anything
+    // is decoded. This also covers a tree which only consists of the root, whose symbols don't use any input bits.
+    Budget.CheckHuffmanTotal(Total, bWithRLE);
+    
+    // The Total of a damaged file can be huge, so max. MAX_INITIAL_RESERVE bytes are reserved; the buffer grows
+    // beyond that if required.
+    const size_t MAX_INITIAL_RESERVE = 0x4000000;
+    size_t ReserveSize = static_cast<size_t>(Total);
+    if (bWithRLE)
+      ReserveSize += ReserveSize/4;
+    if (Budget.GetMaxBWTDataSize() != 0)
+      ReserveSize = std::min(ReserveSize, Budget.GetMaxBWTDataSize());
+    
+    OutData.clear();
+    OutData.reserve(std::min(ReserveSize, MAX_INITIAL_RESERVE));
+    
+    do
+    {
+      if (Progress(Total - Decoder.GetRemaining(), Total, UpdateMsg))
+        return false;
+      
+      Budget.CheckBWTDataSize(OutData.size());
+      Budget.CheckCPUTime();
+    }
+    while (Decoder.template Decode<bWithRLE>(FUSED_UPDATE_INTERVALL, OutData) > 0);
+    
+    if (!Decoder.IsComplete())
+      throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
+    
+    return true;
+  }
+  
+  template <class ProgressT>
+  bool DecodeHuffmanMTF(const SByteSpan& Payload, bool bWithRLE, ByteVector& OutData, const ProgressT& Progress, 
+      const std::wstring& UpdateMsg, DecodeBudget& Budget)
+  {
+    return bWithRLE ? DecodeHuffmanMTF_Templ<true>(Payload, OutData, Progress, UpdateMsg, Budget) : 
+        DecodeHuffmanMTF_Templ<false>(Payload, OutData, Progress, UpdateMsg, Budget);
+  }
+}
+
+
+
+//============================================================================================================================
+// Fused inverse BWT/RLE decoding
+//============================================================================================================================
+
+namespace
+{
+  // Decodes one BWT chunk and passes each byte of the LF walk immediately through the RLE decoder.
+  template <class OutputT>
+  void DecodeBWTChunkRLE(const SBWTChunkHeader& Header, const unsigned char* ChunkData, int* Temp, RLEDecoder& RLE, 
+      OutputT& OutData)
+  {
+    BuildBWTChunkLinks(Header, ChunkData, Temp);
+    
+    // All indices in Temp are smaller than Header.Length+1, so the walk stays inside the chunk.
+    for (int i = Header.First, j = 0; j < Header.Length; i = Temp[i], ++j)
+      RLE.DecodeByte(ChunkData[i], OutData);
+  }
+  
+  template <class OutputT, class ProgressT>
+  bool DecodeBWTRLE(const SByteSpan& InData, OutputT& OutData, IndexVector& Temp, const ProgressT& Progress, 
+      const std::wstring& UpdateMsg, DecodeBudget& Budget)
+  {
+    const int InStreamLength = static_cast<int>(InData.Length);
+    
+    RLEDecoder RLE;
+    size_t NumDecoded = 0; // Bytes passed to the RLE decoder.
+    
+    int ProcessedBytes = 0;
+    do
+    {
+      if (Progress(ProcessedBytes, InStreamLength, UpdateMsg))
+        return false;
+      
+      Budget.CheckOutputSize(RLE.GetOutputSize(NumDecoded));
+      Budget.CheckCPUTime();
+      
+      if (ProcessedBytes == InStreamLength)
+        break;
+      
+      if (InStreamLength - ProcessedBytes < BWT_CHUNK_HEADER_SIZE)
+        throw std::runtime_error("Reached EOF too early in uz1BurrowsWheelerAlgorithm::Decompress.");
+      
+      const SBWTChunkHeader Header = ParseBWTChunkHeader(InData.Data + ProcessedBytes);
+      ProcessedBytes += BWT_CHUNK_HEADER_SIZE;
+      if (Header.Length >= InStreamLength-ProcessedBytes)
+        throw std::runtime_error("Invalid DecompressLength in uz1BurrowsWheelerAlgorithm::Decompress.");
+      
+      Budget.AddBWTBlock();
+      
+      if (Temp.size() < static_cast<size_t>(Header.Length+1))
+        Temp.resize(Header.Length+1);
+      
+      DecodeBWTChunkRLE(Header, InData.Data + ProcessedBytes, &Temp[0], RLE, OutData);
+      ProcessedBytes += Header.Length+1;
+      NumDecoded += Header.Length;
+    }
+    while (true);
+    
+    if (!RLE.IsComplete())
+      throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
+    
+    return true;
+  }
+}
+
+
+
+//============================================================================================================================
+//============================================================================================================================
+// Pipelined uz1 decompression
+//============================================================================================================================
+//============================================================================================================================
+
+namespace
+{
+  const size_t PIPELINE_CHUNK_SIZE = 0x10000; // Size of the chunks passed between the steps (except for the complete BWT chunks).
+  const size_t PIPELINE_QUEUE_LENGTH = 8; // Max. number of chunks waiting between two steps.
+  
+  // Used to wait for a queue: Yields first and sleeps if the wait takes longer.
+  class WaitBackoff
+  {
+    public:
+      WaitBackoff(): m_NumWaits(0)
+      { }
+      
+      void Wait()
+      {
+        if (++m_NumWaits < 64)
+          std::this_thread::yield();
+        else
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      
+    private:
+      int m_NumWaits;
+  };
+  
+  // Bounded lock-free queue for exactly one producer thread and one consumer thread.
+  template <class T, size_t Capacity>
+  class SPSCQueue
+  {
+    public:
+      SPSCQueue(): m_Head(0), m_Tail(0)
+      { }
+      
+      // Moves the item into the queue. Returns false if the queue is full (Item is unchanged then).
+      bool TryPush(T& Item)
+      {
+        const size_t Tail = m_Tail.load(std::memory_order_relaxed);
+        if (Tail - m_Head.load(std::memory_order_acquire) == Capacity)
+          return false;
+        
+        m_Slots[Tail % Capacity] = std::move(Item);
+        m_Tail.store(Tail + 1, std::memory_order_release);
+        return true;
+      }
+      
+      // Moves the oldest item out of the queue. Returns false if the queue is empty.
+      bool TryPop(T& Item)
+      {
+        const size_t Head = m_Head.load(std::memory_order_relaxed);
+        if (Head == m_Tail.load(std::memory_order_acquire))
+          return false;
+        
+        Item = std::move(m_Slots[Head % Capacity]);
+        m_Head.store(Head + 1, std::memory_order_release);
+        return true;
+      }
+    
+    private:
+      T m_Slots[Capacity];
+      alignas(64) std::atomic<size_t> m_Head; // Only written by the consumer.
+      alignas(64) std::atomic<size_t> m_Tail; // Only written by the producer.
+  };
+  
+  typedef SPSCQueue<ByteVector, PIPELINE_QUEUE_LENGTH> ChunkQueue;
+  
+  
+  // State shared by all steps of the pipeline. An empty chunk marks the end of the data in a queue. If pCancel is not
+  // NULL, the pipeline counts as aborted as soon as it's cancelled.
+  class PipelineControl
+  {
+    public:
+      explicit PipelineControl(const SUz1Progress* pCancel): 
+        m_bAbort(false), m_ConsumedInput(0), m_CPUTime(0), m_pCancel(pCancel)
+      { }
+      
+      // Stops all steps as soon as possible.
+      void Abort() { m_bAbort.store(true); }
+      bool IsAborted()const
+      {
+        return m_bAbort.load(std::memory_order_relaxed) || (m_pCancel != NULL && m_pCancel->IsCancelled());
+      }
+      
+      // Saves the first error and aborts the pipeline.
+      void Fail(std::exception_ptr Error)
+      {
+        {
+          std::lock_guard<std::mutex> Lock(m_ErrorMutex);
+          if (!m_Error)
+            m_Error = Error;
+        }
+        Abort();
+      }
+      
+      // Rethrows the saved error (if any).
+      void RethrowError()
+      {
+        if (m_Error)
+          std::rethrow_exception(m_Error);
+      }
+      
+      // Number of input bytes consumed by the first step (used for the progress).
+      void SetConsumedInput(size_t Count) { m_ConsumedInput.store(Count, std::memory_order_relaxed); }
+      size_t GetConsumedInput()const { return m_ConsumedInput.load(std::memory_order_relaxed); }
+      
+      // CPU time (in ns) used by all steps; shared by their DecodeBudgets, so that MaxCPUTime applies to the sum.
+      std::atomic<int64_t>* GetCPUTimeCounter() { return &m_CPUTime; }
+      
+      // Moves the chunk into the queue; waits while the queue is full. Returns false if the pipeline was aborted.
+      bool Push(ChunkQueue& Queue, ByteVector& Chunk)
+      {
+        if (IsAborted())
+          return false;
+        
+        WaitBackoff Backoff;
+        while (!Queue.TryPush(Chunk))
+        {
+          if (IsAborted())
+            return false;
+          Backoff.Wait();
+        }
+        return true;
+      }
+      
+      // Pushes the end-of-data marker.
+      bool PushEnd(ChunkQueue& Queue)
+      {
+        ByteVector EndMarker;
+        return Push(Queue, EndMarker);
+      }
+      
+      // Gets the next chunk from the queue; waits while the queue is empty. Returns false if the pipeline was aborted.
+      bool Pop(ChunkQueue& Queue, ByteVector& Chunk)
+      {
+        WaitBackoff Backoff;
+        while (!Queue.TryPop(Chunk))
+        {
+          if (IsAborted())
+            return false;
+          Backoff.Wait();
+        }
+        return true;
+      }
+    
+    private:
+      std::atomic<bool> m_bAbort;
+      std::atomic<size_t> m_ConsumedInput;
+      std::atomic<int64_t> m_CPUTime;
+      const SUz1Progress* const m_pCancel;
+      std::mutex m_ErrorMutex;
+      std::exception_ptr m_Error;
+  };
+  
+  // Starts the steps on their own threads and joins them. In case the threads are still running on destruction
+  // (i.e. an exception was thrown in the calling thread), the pipeline is aborted first.
+  class PipelineThreads
+  {
+    public:
+      explicit PipelineThreads(PipelineControl& Control): m_Control(Control)
+      { }
+      
+      ~PipelineThreads()
+      {
+        if (!m_Threads.empty())
+        {
+          m_Control.Abort();
+          Join();
+        }
+      }
+      
+      // Runs the step on a new thread. Exceptions of the step are passed to the PipelineControl.
+      template <class TStep>
+      void Start(TStep Step)
+      {
+        PipelineControl& Control = m_Control;
+        m_Threads.push_back(std::thread([Step, &Control]() mutable
+        {
+          try
+          {
+            Step();
+          }
+          catch (...)
+          {
+            Control.Fail(std::current_exception());
+          }
+        }));
+      }
+      
+      // Waits until all steps have finished.
+      void Join()
+      {
+        for (size_t CurIndex = 0; CurIndex < m_Threads.size(); ++CurIndex)
+          m_Threads[CurIndex].join();
+        m_Threads.clear();
+      }
+    
+    private:
+      PipelineControl& m_Control;
+      std::vector<std::thread> m_Threads;
+  };
+  
+  
+  // Each step checks the limits with its own DecodeBudget; the CPU time of all steps is summed up in the PipelineControl,
+  // so that MaxCPUTime applies to the whole decompression.
+  
+  // Huffman step: Decodes the bytes in chunks of PIPELINE_CHUNK_SIZE.
+  void PipelineHuffmanStep(HuffmanDecoder& Decoder, ChunkQueue& OutQueue, PipelineControl& Control, 
+      const SUz1DecodeLimits& Limits)
+  {
+    DecodeBudget Budget(Limits, Control.GetCPUTimeCounter());
+    while (Decoder.GetRemaining() > 0)
+    {
+      Budget.CheckCPUTime();
+      
+      ByteVector Chunk(std::min<size_t>(Decoder.GetRemaining(), PIPELINE_CHUNK_SIZE));
+      Decoder.Decode(&Chunk[0], Chunk.size());
+      Control.SetConsumedInput(Decoder.GetConsumedBytes());
+      
+      if (!Control.Push(OutQueue, Chunk))
+        return;
+    }
+    
+    Control.PushEnd(OutQueue);
+  }
+  
+  // RLE step (only for the 5678-version).
+  void PipelineRLEStep(ChunkQueue& InQueue, ChunkQueue& OutQueue, PipelineControl& Control, const SUz1DecodeLimits& Limits)
+  {
+    DecodeBudget Budget(Limits, Control.GetCPUTimeCounter());
+    RLEDecoder Decoder;
+    ByteVector InChunk;
+    while (Control.Pop(InQueue, InChunk))
+    {
+      Budget.CheckCPUTime();
+      
+      if (InChunk.empty())
+      {
+        if (!Decoder.IsComplete())
+          throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
+        Control.PushEnd(OutQueue);
+        return;
+      }
+      
+      ByteVector OutChunk;
+      OutChunk.reserve(InChunk.size() + InChunk.size()/4);
+      Decoder.Decode(&InChunk[0], InChunk.size(), OutChunk);
+      if (!OutChunk.empty() && !Control.Push(OutQueue, OutChunk))
+        return;
+    }
+  }
+  
+  // MTF step: Decodes each chunk in place.
+  void PipelineMTFStep(ChunkQueue& InQueue, ChunkQueue& OutQueue, PipelineControl& Control, const SUz1DecodeLimits& Limits)
+  {
+    DecodeBudget Budget(Limits, Control.GetCPUTimeCounter());
+    MTFDecoder Decoder;
+    ByteVector Chunk;
+    while (Control.Pop(InQueue, Chunk))
+    {
+      Budget.CheckCPUTime();
+      
+      const bool bEnd = Chunk.empty();
+      if (!bEnd)
+        Decoder.Decode(&Chunk[0], Chunk.size(), &Chunk[0]);
+      
+      if (!Control.Push(OutQueue, Chunk) || bEnd)
+        return;
+    }
+  }
+  
+  // BWT step: Collects the incoming chunks until a complete BWT chunk is available and passes the decoded BWT chunk on.
+  void PipelineBWTStep(ChunkQueue& InQueue, ChunkQueue& OutQueue, PipelineControl& Control, const SUz1DecodeLimits& Limits)
+  {
+    DecodeBudget Budget(Limits, Control.GetCPUTimeCounter());
+    IndexVector Temp(uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE+1);
+    ByteVector Pending; // Not yet decoded input.
+    size_t PendingPos = 0; // Position of the next BWT chunk in Pending.
+    
+    ByteVector InChunk;
+    while (Control.Pop(InQueue, InChunk))
+    {
+      if (InChunk.empty())
+      {
+        if (PendingPos != Pending.size())
+          throw std::runtime_error("Reached EOF too early in uz1BurrowsWheelerAlgorithm::Decompress.");
+        Control.PushEnd(OutQueue);
+        return;
+      }
+      
+      // Remove the already decoded BWT chunks and append the new data.
+      Pending.erase(Pending.begin(), Pending.begin() + PendingPos);
+      PendingPos = 0;
+      Pending.insert(Pending.end(), InChunk.begin(), InChunk.end());
+      
+      // Decode all complete BWT chunks.
+      while (Pending.size() - PendingPos >= static_cast<size_t>(BWT_CHUNK_HEADER_SIZE))
+      {
+        const SBWTChunkHeader Header = ParseBWTChunkHeader(&Pending[PendingPos]);
+        if (Pending.size() - PendingPos - BWT_CHUNK_HEADER_SIZE < static_cast<size_t>(Header.Length+1))
+          break;
+        
+        Budget.AddBWTBlock();
+        Budget.CheckCPUTime();
+        
+        ByteVector OutChunk(Header.Length);
+        DecodeBWTChunk(Header, &Pending[PendingPos + BWT_CHUNK_HEADER_SIZE], &Temp[0], OutChunk.empty() ? NULL : &OutChunk[0]);
+        PendingPos += BWT_CHUNK_HEADER_SIZE + Header.Length+1;
+        
+        if (!OutChunk.empty() && !Control.Push(OutQueue, OutChunk))
+          return;
+      }
+    }
+  }
+  
+  // Runs the pipeline. The last RLE step runs on the calling thread and writes the output.
+  template <class ProgressT>
+  bool DecompressFromUz1Pipelined_Impl(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      ProgressT& Progress, const SUz1DecodeLimits& Limits)
+  {
+    static const std::wstring UPDATE_MSG = L"Decoding (pipelined)";
+    
+    PipelineControl Control(GetCancelToken(Progress));
+    DecodeBudget Budget(Limits, Control.GetCPUTimeCounter());
+    
+    // Send an initial update.
+    if (Progress(0, 1, DECODE_INIT_MSG))
+      return false;
+  
+    InStream.clear(); // Clear any bad-flags.
+    InStream.seekg(0, ios_base::beg); // Move the in-pointer to the beginning.
+    InStream.exceptions(std::ios::badbit | std::ios::failbit);
+    
+    const int Uz1Signature = ReadUz1Header(InStream, OrigFilename);
+    
+    ByteVector InData;
+    ReadStreamToBuffer(InStream, InData);
+    
+    // Read the huffman-tree before the threads are started, so that invalid files are rejected early.
+    HuffmanDecoder Huffman(SByteSpan(InData), Limits);
+    Budget.CheckHuffmanTotal(Huffman.GetTotal(), Uz1Signature == 5678);
+    
+    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+    
+    ChunkQueue HuffmanQueue, RLEQueue, MTFQueue, BWTQueue;
+    ChunkQueue* const MTFInQueue = (Uz1Signature == 5678) ? &RLEQueue : &HuffmanQueue;
+    
+    PipelineThreads Threads(Control);
+    Threads.Start([&]() { PipelineHuffmanStep(Huffman, HuffmanQueue, Control, Limits); });
+    if (Uz1Signature == 5678)
+      Threads.Start([&]() { PipelineRLEStep(HuffmanQueue, RLEQueue, Control, Limits); });
+    Threads.Start([&]() { PipelineMTFStep(*MTFInQueue, MTFQueue, Control, Limits); });
+    Threads.Start([&]() { PipelineBWTStep(MTFQueue, BWTQueue, Control, Limits); });
+    
+    // The final RLE step.
+    bool bCancelled = false;
+    bool bComplete = false;
+    RLEDecoder Decoder;
+    ByteVector InChunk;
+    ByteVector OutChunk;
+    size_t OutputSize = 0;
+    while (!bComplete && Control.Pop(BWTQueue, InChunk))
+    {
+      Budget.CheckCPUTime();
+      
+      if (InChunk.empty())
+      {
+        if (!Decoder.IsComplete())
+          throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
+        bComplete = true;
+        break;
+      }
+      
+      OutChunk.clear();
+      Decoder.Decode(&InChunk[0], InChunk.size(), OutChunk);
+      OutputSize += OutChunk.size();
+      Budget.CheckOutputSize(OutputSize);
+      WriteBufferToStream(OutStream, OutChunk);
+      
+      if (Progress(Control.GetConsumedInput(), InData.size(), UPDATE_MSG))
+      {
+        Control.Abort();
+        bCancelled = true;
+      }
+    }
+    
+    Threads.Join();
+    Control.RethrowError();
+    
+    return !bCancelled && bComplete;
+  }
+  
+  bool DecompressFromUz1Pipelined_Templ(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SProgressTarget& Target, const SUz1DecodeLimits& Limits = SUz1DecodeLimits())
+  {
+    return RunWithProgress(Target, 0, [&](auto& Progress) {
+      return DecompressFromUz1Pipelined_Impl(InStream, OutStream, OrigFilename, Progress, Limits);
+    });
+  }
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1Pipelined_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Pipelined(InStream, OutStream, TempFilename, UpdateFunc, UserObj);
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    SUz1Progress& Progress)
+{
+  return DecompressFromUz1Pipelined_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Pipelined(InStream, OutStream, TempFilename, Progress);
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1Pipelined_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj), Limits);
+}
+
+bool uzLib::DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, SUz1Progress& Progress)
+{
+  return DecompressFromUz1Pipelined_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress), Limits);
+}
+
+
+//============================================================================================================================
+//============================================================================================================================
+// Streaming uz1 compression
+//============================================================================================================================
+//============================================================================================================================
+
+namespace
+{
+  const size_t STREAMING_READ_SIZE = 0x10000; // Number of bytes read from the input stream / the spill file at once.
+  
+  // Temporary file (deleted when closed) used to keep the input of the huffman step out of the memory.
+  class SpillFile
+  {
+    public:
+      SpillFile(): m_File(std::tmpfile()), m_Size(0)
+      {
+        if (m_File == NULL)
+          throw std::runtime_error("Couldn't create the temporary file in CompressToUz1Streaming.");
+      }
+      
+      ~SpillFile() { fclose(m_File); }
+      
+      // Appends the data to the file.
+      void Write(const unsigned char* Data, size_t Length)
+      {
+        if (Length > 0 && fwrite(Data, 1, Length, m_File) != Length)
+          throw std::runtime_error("Couldn't write to the temporary file in CompressToUz1Streaming.");
+        
+        m_Size += Length;
+      }
+      
+      // Moves the file position back to the beginning, so that the data can be read.
+      void Rewind()
+      {
+        if (fflush(m_File) != 0 || fseek(m_File, 0, SEEK_SET) != 0)
+          throw std::runtime_error("Couldn't rewind the temporary file in CompressToUz1Streaming.");
+      }
+      
+      // Reads max. MaxLength bytes and returns the number of read bytes (0 at the end of the file).
+      size_t Read(unsigned char* Target, size_t MaxLength)
+      {
+        const size_t NumRead = fread(Target, 1, MaxLength, m_File);
+        if (NumRead < MaxLength && ferror(m_File))
+          throw std::runtime_error("Couldn't read from the temporary file in CompressToUz1Streaming.");
+        
+        return NumRead;
+      }
+      
+      // Returns the total number of written bytes.
+      size_t GetSize()const { return m_Size; }
+    
+    private:
+      SpillFile(const SpillFile&); // Not copyable.
+      SpillFile& operator=(const SpillFile&);
+    
+    private:
+      FILE* m_File;
+      size_t m_Size;
+  };
+  
+  // Runs the RLE, BWT, MTF (and for 5678 the second RLE) steps block by block. The output (the input of the huffman
+  // step) is written to the spill file and the byte frequencies are counted on the way. If pCancel is not NULL, the
+  // BWT sort is stopped as soon as it's cancelled; Encode and Finish return false then.
+  class StreamingBlockEncoder
+  {
+    public:
+      StreamingBlockEncoder(SpillFile& Spill, bool bSecondRLE, const SUz1Progress* pCancel):
+        m_Spill(Spill), m_bSecondRLE(bSecondRLE), m_pCancel(pCancel)
+      {
+        memset(m_Counts, 0, sizeof(m_Counts));
+        m_Block.reserve(uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE + STREAMING_READ_SIZE + STREAMING_READ_SIZE/4);
+        m_EncodedChunk.resize(uz1BurrowsWheelerAlgorithm::GetEncodedChunkSize(uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE));
+      }
+      
+      // Encodes the next bytes of the package. Every completed BWT block is written to the spill file.
+      bool Encode(const unsigned char* InData, size_t InLength)
+      {
+        m_RLE.Encode(InData, InLength, m_Block);
+        return EncodeFullBlocks();
+      }
+      
+      // Encodes the remaining data after the last input.
+      bool Finish()
+      {
+        m_RLE.Finish(m_Block);
+        if (!EncodeFullBlocks())
+          return false;
+        
+        if (!m_Block.empty() && !EncodeBlock(&m_Block[0], static_cast<int>(m_Block.size())))
+          return false;
+        m_Block.clear();
+        
+        if (m_bSecondRLE)
+        {
+          m_SecondRLE.Finish(m_SecondRLEOutput);
+          SpillData(m_SecondRLEOutput.empty() ? NULL : &m_SecondRLEOutput[0], m_SecondRLEOutput.size());
+          m_SecondRLEOutput.clear();
+        }
+        return true;
+      }
+      
+      // Returns the number of occurrences of each byte in the spilled data.
+      const int* GetCounts()const { return m_Counts; }
+      
+    private:
+      // Encodes all complete BWT blocks and keeps the remaining bytes for the next call.
+      bool EncodeFullBlocks()
+      {
+        const size_t BlockSize = uz1BurrowsWheelerAlgorithm::MAX_BUFFER_SIZE;
+        
+        size_t ProcessedBytes = 0;
+        for (; m_Block.size() - ProcessedBytes >= BlockSize; ProcessedBytes += BlockSize)
+        {
+          if (!EncodeBlock(&m_Block[ProcessedBytes], static_cast<int>(BlockSize)))
+            return false;
+        }
+        
+        m_Block.erase(m_Block.begin(), m_Block.begin() + ProcessedBytes);
+        return true;
+      }
+      
+      // Runs the BWT, MTF and (optional) second RLE for one block and writes the result to the spill file.
+      bool EncodeBlock(const unsigned char* BlockData, int BlockLength)
+      {
+        const size_t ChunkSize = uz1BurrowsWheelerAlgorithm::GetEncodedChunkSize(BlockLength);
+        if (!uz1BurrowsWheelerAlgorithm::EncodeChunk(BlockData, BlockLength, &m_EncodedChunk[0], m_CompressPosition, m_pCancel))
+          return false;
+        m_MTF.Encode(&m_EncodedChunk[0], ChunkSize, &m_EncodedChunk[0]);
+        
+        if (m_bSecondRLE)
+        {
+          m_SecondRLE.Encode(&m_EncodedChunk[0], ChunkSize, m_SecondRLEOutput);
+          SpillData(m_SecondRLEOutput.empty() ? NULL : &m_SecondRLEOutput[0], m_SecondRLEOutput.size());
+          m_SecondRLEOutput.clear();
+        }
+        else
+          SpillData(&m_EncodedChunk[0], ChunkSize);
+        return true;
+      }
+      
+      // Counts the bytes and writes them to the spill file.
+      void SpillData(const unsigned char* Data, size_t Length)
+      {
+        for (size_t CurIndex = 0; CurIndex < Length; ++CurIndex)
+          m_Counts[Data[CurIndex]]++;
+        
+        m_Spill.Write(Data, Length);
+      }
+    
+    private:
+      SpillFile& m_Spill;
+      const bool m_bSecondRLE;
+      const SUz1Progress* const m_pCancel;
+      int m_Counts[256];
+      
+      RLEEncoder m_RLE;
+      ByteVector m_Block; // RLE-encoded data which wasn't passed to the BWT yet.
+      ByteVector m_EncodedChunk; // BWT (and afterwards MTF) output of the current block.
+      IndexVector m_CompressPosition; // Scratch memory of the BWT.
+      MTFEncoder m_MTF; // The MTF state runs across the block boundaries.
+      RLEEncoder m_SecondRLE;
+      ByteVector m_SecondRLEOutput;
+  };
+  
+  template <class T, class ProgressT>
+  bool CompressToUz1Streaming_Impl(in_stream& InStream, out_stream& OutStream, const T& PkgFilename, EUz1Signature Uz1Sig, 
+      ProgressT& Progress)
+  {
+    static const std::wstring UPDATE_MSG1 = L"(1/2) Encoding blocks";
+    static const std::wstring UPDATE_MSG2 = L"(2/2) Huffman-Encoding";
+    
+    // Send an initial update.
+    if (Progress(0, 1, L"Initializing..."))
+      return false;
+    
+    // The input is read up to its end, so the eof- and fail-bits are expected to be set.
+    InStream.exceptions(std::ios::badbit);
+    
+    // Write signature and filename (including length).
+    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+    WriteUz1Header(OutStream, static_cast<int>(Uz1Sig), PkgFilename);
+    
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Pass 1: Read the input and run all steps except the huffman encoding. The length of the input is unknown, so
+    // CompletedStatus is 0.
+    SpillFile Spill;
+    StreamingBlockEncoder BlockEncoder(Spill, Uz1Sig == USIG_5678, GetCancelToken(Progress));
+    
+    ByteVector ReadBuffer(STREAMING_READ_SIZE);
+    unsigned int TotalRead = 0;
+    while (InStream.good())
+    {
+      if (Progress(TotalRead, 0, UPDATE_MSG1))
+        return false;
+      
+      InStream.read(reinterpret_cast<BYTE*>(&ReadBuffer[0]), ReadBuffer.size());
+      const size_t NumRead = static_cast<size_t>(InStream.gcount());
+      
+      if (!BlockEncoder.Encode(&ReadBuffer[0], NumRead))
+        return false;
+      TotalRead += static_cast<unsigned int>(NumRead);
+    }
+    if (!BlockEncoder.Finish())
+      return false;
+    
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Pass 2: Huffman-encode the spilled data. Only complete bytes are written, the last incomplete byte is kept in the BitWriter.
+    const unsigned int Total = static_cast<unsigned int>(Spill.GetSize());
+    if (Spill.GetSize() > static_cast<size_t>(std::numeric_limits<int>::max()))
+      throw std::runtime_error("The package is too big for the uz1-format.");
+    
+    WriteInt(OutStream, static_cast<int>(Total));
+    
+    const HuffmanEncoder Encoder(BlockEncoder.GetCounts());
+    ByteVector OutBuffer;
+    BitWriter OutBits(OutBuffer);
+    Encoder.WriteTable(OutBits);
+    
+    Spill.Rewind();
+    unsigned int TotalEncoded = 0;
+    size_t NumRead = 0;
+    while ((NumRead = Spill.Read(&ReadBuffer[0], ReadBuffer.size())) > 0)
+    {
+      if (Progress(TotalEncoded, Total, UPDATE_MSG2))
+        return false;
+      
+      Encoder.Encode(&ReadBuffer[0], NumRead, OutBits);
+      TotalEncoded += static_cast<unsigned int>(NumRead);
+      
+      WriteBufferToStream(OutStream, SByteSpan(OutBuffer));
+      OutBuffer.clear();
+    }
+    
+    OutBits.Flush();
+    WriteBufferToStream(OutStream, SByteSpan(OutBuffer));
+    
+    return true;
+  }
+  
+  // The messages contain the step numbers already, so the update function gets them as they are.
+  template <class T>
+  bool CompressToUz1Streaming_Templ(in_stream& InStream, out_stream& OutStream, const T& PkgFilename, EUz1Signature Uz1Sig, 
+      const SProgressTarget& Target)
+  {
+    return RunWithProgress(Target, 0, [&](auto& Progress) {
+      return CompressToUz1Streaming_Impl(InStream, OutStream, PkgFilename, Uz1Sig, Progress);
+    });
+  }
+  
+  // Converts the package name to ASCII if possible and calls CompressToUz1Streaming_Templ.
+  bool CompressToUz1Streaming_Conv(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, const SProgressTarget& Target)
+  {
+    // Try to convert the filename to ASCII. If it fails, we need to use unicode.
+    std::string ConvFilename;
+    if (TryConvertUnicodeToASCII(PkgFilename, ConvFilename))
+      return CompressToUz1Streaming_Templ(InStream, OutStream, ConvFilename, Uz1Sig, Target);
+    else
+      return CompressToUz1Streaming_Templ(InStream, OutStream, PkgFilename, Uz1Sig, Target);
+  }
+}
+
+bool uzLib::CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressToUz1Streaming_Templ(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressToUz1Streaming_Templ(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+bool uzLib::CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressToUz1Streaming_Conv(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressToUz1Streaming_Conv(InStream, OutStream, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+
+//============================================================================================================================
+//============================================================================================================================
+// uz1 compression/decompression of memory-mapped files
+//============================================================================================================================
+//============================================================================================================================
+
+#ifndef _WIN32 // FileMapping.h is POSIX only.
+
+namespace
+{
+  // Byte target of BasicBitWriter, which appends the bytes to a mapped output file.
+  class MappedFileAppender
+  {
+    public:
+      explicit MappedFileAppender(MappedOutputFile& File): m_File(File)
+      { }
+      
+      void push_back(unsigned char B) { m_File.AppendByte(B); }
+    
+    private:
+      MappedOutputFile& m_File;
+  };
+  
+  // Compression of a file (ASCII or Unicode package name).
+  template <class T, class ProgressT>
+  bool CompressFileToUz1_Impl(const std::string& InFilename, const std::string& OutFilename, const T& PkgFilename, 
+      EUz1Signature Uz1Sig, ProgressT& Progress)
+  {
+    static const std::wstring INIT_MSG = L"Initializing...";
+    
+    if (Progress(0, 1, INIT_MSG))
+      return false;
+    
+    // The first step reads directly from the mapping.
+    const MappedInputFile InFile(InFilename);
+    
+    ByteVector Buffer1;
+    ByteVector Buffer2;
+    ByteVector* pHuffmanInput = NULL;
+    if (!EncodeUz1StepsBeforeHuffman(SByteSpan(InFile.GetData(), InFile.GetSize()), Uz1Sig, Buffer1, Buffer2, 
+        pHuffmanInput, Progress))
+      return false;
+    
+    // Huffman encoding: The size of the output follows from the byte frequencies, so the output file is created with
+    // its final size and the last step writes directly into the mapping.
+    const SByteSpan HuffmanInput(*pHuffmanInput);
+    Progress.NextStep();
+    int Counts[256];
+    if (!CountHuffmanBytes(HuffmanInput, Counts, Progress))
+      return false;
+    const HuffmanEncoder Encoder(Counts);
+    
+    // Signature and filename (including length).
+    ByteVector Header;
+    AppendUz1Header(Header, static_cast<int>(Uz1Sig), PkgFilename);
+    
+    MappedOutputFile OutFile(OutFilename, Header.size() + sizeof(int) + Encoder.GetEncodedSize(Counts));
+    OutFile.Append(&Header[0], Header.size());
+    PutInt(OutFile.Extend(sizeof(int)), static_cast<int>(HuffmanInput.Length));
+    
+    // A cancelled compression doesn't leave a file of the final size behind.
+    MappedFileAppender Appender(OutFile);
+    if (!WriteHuffmanBits(HuffmanInput, Encoder, Appender, Progress))
+    {
+      OutFile.Discard();
+      return false;
+    }
+    OutFile.Close();
+    
+    return true;
+  }
+  
+  template <class T>
+  bool CompressFileToUz1_Templ(const std::string& InFilename, const std::string& OutFilename, const T& PkgFilename, 
+      EUz1Signature Uz1Sig, const SProgressTarget& Target)
+  {
+    return RunWithProgress(Target, GetNumEncodeSteps(Uz1Sig), [&](auto& Progress) {
+      return CompressFileToUz1_Impl(InFilename, OutFilename, PkgFilename, Uz1Sig, Progress);
+    });
+  }
+  
+  // Converts the package name to ASCII if possible and calls CompressFileToUz1_Templ.
+  bool CompressFileToUz1_Conv(const std::string& InFilename, const std::string& OutFilename, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, const SProgressTarget& Target)
+  {
+    // Try to convert the filename to ASCII. If it fails, we need to use unicode.
+    std::string ConvFilename;
+    if (TryConvertUnicodeToASCII(PkgFilename, ConvFilename))
+      return CompressFileToUz1_Templ(InFilename, OutFilename, ConvFilename, Uz1Sig, Target);
+    else
+      return CompressFileToUz1_Templ(InFilename, OutFilename, PkgFilename, Uz1Sig, Target);
+  }
+  
+  // Decompression of a file.
+  template <class ProgressT>
+  bool DecompressFileFromUz1_Impl(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      ProgressT& Progress, const SUz1DecodeLimits& Limits)
+  {
+    DecodeBudget Budget(Limits);
+    
+    if (Progress(0, 1, DECODE_INIT_MSG))
+      return false;
+    
+    const MappedInputFile InFile(InFilename);
+    const SByteSpan InData(InFile.GetData(), InFile.GetSize());
+    
+    // Parse the header directly from the mapping.
+    size_t HeaderSize = 0;
+    const int Uz1Signature = ParseUz1Header(InData, OrigFilename, HeaderSize);
+    
+    // The first step reads directly from the mapping.
+    ByteVector BWTData;
+    Progress.NextStep();
+    if (!DecodeHuffmanMTF(SByteSpan(InData.Data + HeaderSize, InData.Length - HeaderSize), Uz1Signature == 5678, BWTData, 
+        Progress, DECODE_STEP1_MSG, Budget))
+      return false;
+    
+    // The second step writes to the output file. The size of the package isn't stored in the uz1-file, so the
+    // output file starts with an estimate and grows if required. If the step fails (damaged data, exceeded limits or
+    // cancellation), the partially written file is removed.
+    MappedOutputFile OutFile(OutFilename, BWTData.size() + BWTData.size()/4);
+    IndexVector Temp;
+    Progress.NextStep();
+    bool bDecoded = false;
+    try
+    {
+      bDecoded = DecodeBWTRLE(SByteSpan(BWTData), OutFile, Temp, Progress, DECODE_STEP2_MSG, Budget);
+    }
+    catch (...)
+    {
+      OutFile.Discard();
+      throw;
+    }
+    if (!bDecoded)
+    {
+      OutFile.Discard();
+      return false;
+    }
+    
+    OutFile.Close();
+    return true;
+  }
+  
+  bool DecompressFileFromUz1_Templ(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      const SProgressTarget& Target, const SUz1DecodeLimits& Limits = SUz1DecodeLimits())
+  {
+    return RunWithProgress(Target, NUM_DECODE_STEPS, [&](auto& Progress) {
+      return DecompressFileFromUz1_Impl(InFilename, OutFilename, OrigFilename, Progress, Limits);
+    });
+  }
+}
+
+bool uzLib::CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressFileToUz1_Templ(InFilename, OutFilename, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressFileToUz1_Templ(InFilename, OutFilename, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+bool uzLib::CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return CompressFileToUz1_Conv(InFilename, OutFilename, PkgFilename, Uz1Sig, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  return CompressFileToUz1_Conv(InFilename, OutFilename, PkgFilename, Uz1Sig, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFileFromUz1_Templ(InFilename, OutFilename, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+    SUz1Progress& Progress)
+{
+  return DecompressFileFromUz1_Templ(InFilename, OutFilename, OrigFilename, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return DecompressFileFromUz1(InFilename, OutFilename, TempFilename, Progress);
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFileFromUz1_Templ(InFilename, OutFilename, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj), Limits);
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, SUz1Progress& Progress)
+{
+  return DecompressFileFromUz1_Templ(InFilename, OutFilename, OrigFilename, MakeProgressTarget(Progress), Limits);
+}
+
+bool uzLib::DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  SFilename TempFilename;
+  return DecompressFileFromUz1(InFilename, OutFilename, TempFilename, UpdateFunc, UserObj);
+}
+
+#endif // _WIN32
+
+
+//============================================================================================================================
+//============================================================================================================================
+// uz1 compression/decompression of buffers (small-file fast path)
+//============================================================================================================================
+//============================================================================================================================
+
+//-----------------------------------------------------------------------------------------
+// uz1Codec
+//-----------------------------------------------------------------------------------------
+
+uzLib::uz1Codec::uz1Codec()
+{ }
+
+// Compression (ASCII or Unicode package name). Runs the kernels of all steps one after the other on the work buffers.
+template <class T, class ProgressT>
+bool uzLib::uz1Codec::Compress_Templ(const SByteSpan& InData, ByteVector& OutData, const T& PkgFilename, EUz1Signature Uz1Sig, 
+    ProgressT& Progress)
+{
+  // RLE encoding: InData -> m_Buffer1
+  if (!EncodeRLEStep(InData, m_Buffer1, Progress))
+    return false;
+  
+  // BW encoding: m_Buffer1 -> m_Buffer2
+  if (!EncodeBWTStep(SByteSpan(m_Buffer1), m_Buffer2, Progress, m_Positions))
+    return false;
+  
+  // MTF encoding: m_Buffer2 -> m_Buffer1
+  if (!EncodeMTFStep(SByteSpan(m_Buffer2), m_Buffer1, Progress))
+    return false;
+  
+  // RLE encoding: m_Buffer1 -> m_Buffer2
+  const ByteVector* pHuffmanInput = &m_Buffer1;
+  if (Uz1Sig == USIG_5678)
+  {
+    if (!EncodeRLEStep(SByteSpan(m_Buffer1), m_Buffer2, Progress))
+      return false;
+    pHuffmanInput = &m_Buffer2;
+  }
+  
+  // Header and huffman encoding: -> OutData
+  OutData.clear();
+  AppendUz1Header(OutData, static_cast<int>(Uz1Sig), PkgFilename);
+  return AppendHuffmanStep(SByteSpan(*pHuffmanInput), OutData, Progress);
+}
+
+template <class ProgressT>
+bool uzLib::uz1Codec::Compress_Conv(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, ProgressT& Progress)
+{
+  // Try to convert the filename to ASCII. If it fails, we need to use unicode.
+  std::string ConvFilename;
+  if (TryConvertUnicodeToASCII(PkgFilename, ConvFilename))
+    return Compress_Templ(InData, OutData, ConvFilename, Uz1Sig, Progress);
+  else
+    return Compress_Templ(InData, OutData, PkgFilename, Uz1Sig, Progress);
+}
+
+template <class ProgressT>
+bool uzLib::uz1Codec::Decompress_Templ(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename, 
+    ProgressT& Progress)
+{
+  DecodeBudget Budget(m_DecodeLimits);
+  
+  size_t HeaderSize = 0;
+  const int Uz1Signature = ParseUz1Header(InData, OrigFilename, HeaderSize);
+  
+  // Huffman, RLE (5678 only) and MTF decoding: -> m_Buffer1
+  if (!DecodeHuffmanMTF(SByteSpan(InData.Data + HeaderSize, InData.Length - HeaderSize), Uz1Signature == 5678, m_Buffer1, 
+      Progress, DECODE_STEP1_MSG, Budget))
+    return false;
+  
+  // BW and RLE decoding: m_Buffer1 -> OutData
+  OutData.clear();
+  OutData.reserve(m_Buffer1.size() + m_Buffer1.size()/4);
+  return DecodeBWTRLE(SByteSpan(m_Buffer1), OutData, m_Positions, Progress, DECODE_STEP2_MSG, Budget);
+}
+
+void uzLib::uz1Codec::Compress(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, EUz1Signature Uz1Sig)
+{
+  NoProgress Progress;
+  Compress_Templ(InData, OutData, PkgFilename, Uz1Sig, Progress);
+}
+
+void uzLib::uz1Codec::Compress(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig)
+{
+  NoProgress Progress;
+  Compress_Conv(InData, OutData, PkgFilename, Uz1Sig, Progress);
+}
+
+void uzLib::uz1Codec::Decompress(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename)
+{
+  NoProgress Progress;
+  Decompress_Templ(InData, OutData, OrigFilename, Progress);
+}
+
+void uzLib::uz1Codec::Decompress(const SByteSpan& InData, ByteVector& OutData)
+{
+  SFilename TempFilename;
+  Decompress(InData, OutData, TempFilename);
+}
+
+bool uzLib::uz1Codec::Compress(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  AtomicProgress TheProgress(Progress, 0);
+  return Compress_Templ(InData, OutData, PkgFilename, Uz1Sig, TheProgress);
+}
+
+bool uzLib::uz1Codec::Compress(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, 
+    EUz1Signature Uz1Sig, SUz1Progress& Progress)
+{
+  AtomicProgress TheProgress(Progress, 0);
+  return Compress_Conv(InData, OutData, PkgFilename, Uz1Sig, TheProgress);
+}
+
+bool uzLib::uz1Codec::Decompress(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename, SUz1Progress& Progress)
+{
+  AtomicProgress TheProgress(Progress, 0);
+  return Decompress_Templ(InData, OutData, OrigFilename, TheProgress);
+}
+
+bool uzLib::uz1Codec::Decompress(const SByteSpan& InData, ByteVector& OutData, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return Decompress(InData, OutData, TempFilename, Progress);
+}
+
+size_t uzLib::uz1Codec::GetWorkspaceSize()const
+{
+  return m_Buffer1.capacity() + m_Buffer2.capacity() + m_Positions.capacity() * sizeof(int);
+}
+
+void uzLib::uz1Codec::ReleaseWorkspace()
+{
+  ByteVector().swap(m_Buffer1);
+  ByteVector().swap(m_Buffer2);
+  IndexVector().swap(m_Positions);
+}
+
+
+//-----------------------------------------------------------------------------------------
+// Buffer functions: Each thread has its own codec.
+//-----------------------------------------------------------------------------------------
+
+namespace
+{
+  // If the work buffers grew beyond this size (in bytes), they are released after the call, so that a single big
+  // package doesn't keep its memory alive.
+  const size_t MAX_KEPT_WORKSPACE_SIZE = 0x1000000;
+  
+  // Returns the codec of the calling thread.
+  uz1Codec& GetThreadCodec()
+  {
+    thread_local uz1Codec Codec;
+    return Codec;
+  }
+  
+  // Releases the work buffers of the codec when the function returns (or throws), if they are too big to be kept.
+  class WorkspaceTrimmer
+  {
+    public:
+      explicit WorkspaceTrimmer(uz1Codec& Codec): m_Codec(Codec)
+      { }
+      
+      ~WorkspaceTrimmer()
+      {
+        if (m_Codec.GetWorkspaceSize() > MAX_KEPT_WORKSPACE_SIZE)
+          m_Codec.ReleaseWorkspace();
+      }
+    
+    private:
+      uz1Codec& m_Codec;
+  };
+}
+
+void uzLib::CompressBufferToUz1(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, EUz1Signature Uz1Sig)
+{
+  uz1Codec& Codec = GetThreadCodec();
+  const WorkspaceTrimmer Trimmer(Codec);
+  Codec.Compress(InData, OutData, PkgFilename, Uz1Sig);
+}
+
+void uzLib::CompressBufferToUz1(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig)
+{
+  uz1Codec& Codec = GetThreadCodec();
+  const WorkspaceTrimmer Trimmer(Codec);
+  Codec.Compress(InData, OutData, PkgFilename, Uz1Sig);
+}
+
+void uzLib::DecompressBufferFromUz1(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename)
+{
+  uz1Codec& Codec = GetThreadCodec();
+  const WorkspaceTrimmer Trimmer(Codec);
+  Codec.Decompress(InData, OutData, OrigFilename);
+}
+
+void uzLib::DecompressBufferFromUz1(const SByteSpan& InData, ByteVector& OutData)
+{
+  SFilename TempFilename;
+  DecompressBufferFromUz1(InData, OutData, TempFilename);
+}
+
+
+//============================================================================================================================
+//============================================================================================================================
+// uz1 decompression from non-seekable sources
+//============================================================================================================================
+//============================================================================================================================
+
+namespace
+{
+  const size_t SEQUENTIAL_READ_SIZE = 0x10000; // Max. number of bytes requested from the source at once.
+  
+  // Stream buffer which gets its data from a read function.
+  class ReadFuncStreamBuf : public std::streambuf
+  {
+    public:
+      ReadFuncStreamBuf(pUz1ReadFunc ReadFunc, void* ReadObj):
+        m_ReadFunc(ReadFunc), m_pReadObj(ReadObj), m_Buffer(SEQUENTIAL_READ_SIZE)
+      { }
+    
+    protected:
+      virtual int_type underflow()
+      {
+        if (gptr() < egptr())
+          return traits_type::to_int_type(*gptr());
+        
+        const size_t Count = (*m_ReadFunc)(reinterpret_cast<unsigned char*>(&m_Buffer[0]), m_Buffer.size(), m_pReadObj);
+        if (Count == 0)
+          return traits_type::eof();
+        if (Count > m_Buffer.size())
+          throw std::logic_error("The read function returned more bytes than requested (in DecompressFromUz1Sequential).");
+        
+        setg(&m_Buffer[0], &m_Buffer[0], &m_Buffer[0] + Count);
+        return traits_type::to_int_type(*gptr());
+      }
+    
+    private:
+      pUz1ReadFunc m_ReadFunc;
+      void* m_pReadObj;
+      std::vector<char> m_Buffer;
+  };
+  
+  // Reads the bits from a stream buffer, which is never seeked. Only the data which is available at the moment is
+  // requested from the stream buffer (at least one byte), so that the decoding keeps up with a slow source.
+  class StreamBitReader
+  {
+    public:
+      explicit StreamBitReader(std::streambuf& Source):
+        m_Source(Source), m_Buffer(SEQUENTIAL_READ_SIZE), m_NumBits(0), m_NextBit(0), m_ConsumedBytes(0)
+      { }
+      
+      // Returns the next bit.
+      int ReadBit()
+      {
+        if (m_NextBit == m_NumBits)
+          Refill();
+        
+        const int ToReturn = (m_Buffer[m_NextBit >> 3] >> (m_NextBit & 7)) & 1;
+        ++m_NextBit;
+        return ToReturn;
+      }
+      
+      // Reads the next 8 bits.
+      unsigned char ReadByte()
+      {
+        unsigned char ToReturn = 0;
+        for (int CurBit = 0; CurBit < 8; ++CurBit)
+          ToReturn |= static_cast<unsigned char>(ReadBit() << CurBit);
+        return ToReturn;
+      }
+      
+      // Returns the number of bytes read so far (including the partially read one).
+      size_t GetConsumedBytes()const { return m_ConsumedBytes + (m_NextBit+7)/8; }
+    
+    private:
+      // Replaces the (completely read) buffer with the next data of the source.
+      void Refill()
+      {
+        typedef std::streambuf::traits_type traits_type;
+        
+        m_ConsumedBytes += m_NumBits/8;
+        m_NumBits = 0;
+        m_NextBit = 0;
+        
+        // Wait for at least one byte, then take everything which is buffered.
+        std::streamsize Available = m_Source.in_avail();
+        if (Available <= 0)
+        {
+          if (traits_type::eq_int_type(m_Source.sgetc(), traits_type::eof()))
+            throw std::runtime_error("Tried to read more bits than in the input stream (in uz1HuffmanAlgorithm::Decompress).");
+          Available = std::max<std::streamsize>(m_Source.in_avail(), 1);
+        }
+        
+        const std::streamsize Count = m_Source.sgetn(reinterpret_cast<char*>(&m_Buffer[0]), 
+            std::min<std::streamsize>(Available, m_Buffer.size()));
+        if (Count <= 0)
+          throw std::runtime_error("Tried to read more bits than in the input stream (in uz1HuffmanAlgorithm::Decompress).");
+        
+        m_NumBits = static_cast<size_t>(Count) * 8;
+      }
+    
+    private:
+      std::streambuf& m_Source;
+      ByteVector m_Buffer;
+      size_t m_NumBits; // Number of valid bits in m_Buffer.
+      size_t m_NextBit;
+      size_t m_ConsumedBytes; // Number of bytes read before the current buffer.
+  };
+  
+  // Huffman decoder which pulls the encoded data from a stream buffer (see HuffmanDecoder).
+  class StreamHuffmanDecoder
+  {
+    public:
+      // Constructor: Reads the total byte count and the tree. The tree is checked against the limits.
+      StreamHuffmanDecoder(std::streambuf& Source, const SUz1DecodeLimits& Limits):
+        m_Bits(Source), m_Total(0), m_Remaining(0)
+      {
+        // Read the size of the uncompressed data.
+        unsigned char TotalBytes[sizeof(int)];
+        for (size_t CurIndex = 0; CurIndex < sizeof(int); ++CurIndex)
+          TotalBytes[CurIndex] = m_Bits.ReadByte();
+        
+        m_Total = GetInt(TotalBytes);
+        if (m_Total < 0)
+          throw std::runtime_error("Invalid total byte count in uz1HuffmanAlgorithm::Decompress");
+        m_Remaining = m_Total;
+        
+        // Build the huffman tree.
+        m_Tree.Read(m_Bits, Limits.MaxHuffmanNodes > 0 ? Limits.MaxHuffmanNodes : MAX_HUFFMAN_NODES, 
+            Limits.MaxHuffmanDepth > 0 ? Limits.MaxHuffmanDepth : MAX_HUFFMAN_DEPTH);
+      }
+      
+      // Decodes the next byte. Must only be called if GetRemaining() > 0.
+      unsigned char DecodeByte()
+      {
+        --m_Remaining;
+        return m_Tree.DecodeByte(m_Bits);
+      }
+      
+      int GetTotal()const { return m_Total; }
+      int GetRemaining()const { return m_Remaining; }
+      
+      // Returns the number of input bytes read so far.
+      size_t GetConsumedBytes()const { return m_Bits.GetConsumedBytes(); }
+    
+    private:
+      StreamBitReader m_Bits;
+      HuffmanTree m_Tree;
+      
+      int m_Total;
+      int m_Remaining;
+  };
+  
+  // Returns the size of the uz1 header with the filename (as read by ReadUz1Header).
+  size_t GetUz1HeaderSize(const SFilename& OrigFilename)
+  {
+    const bool bASCII = (OrigFilename.FilenameType == FT_ASCII);
+    const int FilenameLen = static_cast<int>(bASCII ? OrigFilename.ASCIIStr.length() : OrigFilename.UnicodeStr.length()) + 1;
+    
+    unsigned char CompactIndex[MAX_COMPACT_INDEX_SIZE];
+    return sizeof(int) + PutCompactIndex(CompactIndex, FilenameLen) + FilenameLen * (bASCII ? 1 : 2);
+  }
+  
+}
+
+// Decodes the uz1 payload from a stream buffer without seeking, one BWT chunk at a time: The huffman data is decoded
+// while it is read and each BWT chunk is inverted as soon as it is complete, so the memory usage doesn't depend on the
+// file size.
+class uzLib::uz1SequentialDecoder
+{
+  public:
+    // Constructor: Reads the huffman tree. Source must point to the beginning of the payload (i.e. behind the header).
+    // The limits are checked from here on (the CPU time as well).
+    uz1SequentialDecoder(std::streambuf& Source, int Uz1Signature, const SUz1DecodeLimits& Limits):
+      m_Budget(Limits), m_Huffman(Source, Limits), m_Decoder(m_Huffman, Uz1Signature == 5678), m_NumDecoded(0), 
+      m_PendingPos(0), m_bCancelled(false)
+    {
+      m_Budget.CheckHuffmanTotal(m_Huffman.GetTotal(), Uz1Signature == 5678);
+    }
+    
+    // Decodes the next BWT chunk and appends the result (i.e. package data) to OutData. Returns false, if all chunks
+    // were decoded (nothing is appended then). If pCancel is not NULL, it's checked between the huffman slices and false
+    // is returned as well, if it's cancelled (see WasCancelled).
+    template <class OutputT>
+    bool DecodeNextChunk(OutputT& OutData, const SUz1Progress* pCancel = NULL);
+    
+    // Returns true, if the last DecodeNextChunk call was cancelled.
+    bool WasCancelled()const { return m_bCancelled; }
+    
+    // Returns the number of payload bytes read so far.
+    size_t GetConsumedBytes()const { return m_Huffman.GetConsumedBytes(); }
+  
+  private:
+    uz1SequentialDecoder(const uz1SequentialDecoder&); // Not copyable.
+    uz1SequentialDecoder& operator=(const uz1SequentialDecoder&);
+  
+  private:
+    DecodeBudget m_Budget;
+    StreamHuffmanDecoder m_Huffman;
+    HuffmanMTFDecoder<StreamHuffmanDecoder> m_Decoder;
+    RLEDecoder m_RLE;
+    size_t m_NumDecoded; // Bytes passed to m_RLE.
+    IndexVector m_Temp;
+    ByteVector m_Pending; // Output of the MTF decoding, which isn't part of a complete BWT chunk yet.
+    size_t m_PendingPos; // Position of the next BWT chunk in m_Pending.
+    bool m_bCancelled;
+};
+
+template <class OutputT>
+bool uzLib::uz1SequentialDecoder::DecodeNextChunk(OutputT& OutData, const SUz1Progress* pCancel)
+{
+  while (true)
+  {
+    m_Budget.CheckOutputSize(m_RLE.GetOutputSize(m_NumDecoded));
+    
+    // Decode the next BWT chunk, if it is complete.
+    if (m_Pending.size() - m_PendingPos >= static_cast<size_t>(BWT_CHUNK_HEADER_SIZE))
+    {
+      const SBWTChunkHeader Header = ParseBWTChunkHeader(&m_Pending[m_PendingPos]);
+      if (m_Pending.size() - m_PendingPos - BWT_CHUNK_HEADER_SIZE >= static_cast<size_t>(Header.Length+1))
+      {
+        m_Budget.AddBWTBlock();
+        
+        if (m_Temp.size() < static_cast<size_t>(Header.Length+1))
+          m_Temp.resize(Header.Length+1);
+        
+        DecodeBWTChunkRLE(Header, &m_Pending[m_PendingPos + BWT_CHUNK_HEADER_SIZE], &m_Temp[0], m_RLE, OutData);
+        m_PendingPos += BWT_CHUNK_HEADER_SIZE + Header.Length+1;
+        m_NumDecoded += Header.Length;
+        return true;
+      }
+    }
+    
+    // Remove the already decoded BWT chunks and decode more huffman symbols.
+    m_Pending.erase(m_Pending.begin(), m_Pending.begin() + m_PendingPos);
+    m_PendingPos = 0;
+    
+    if (pCancel != NULL && pCancel->IsCancelled())
+    {
+      m_bCancelled = true;
+      return false;
+    }
+    
+    m_Budget.CheckCPUTime();
+    if (m_Decoder.Decode(FUSED_UPDATE_INTERVALL, m_Pending) == 0)
+      break;
+  }
+  
+  if (!m_Decoder.IsComplete() || !m_RLE.IsComplete())
+    throw std::runtime_error("Couldn't read RLE_Count because the EOF was reached early in uz1RLEAlgorithm::Decompress.");
+  if (!m_Pending.empty())
+    throw std::runtime_error("Reached EOF too early in uz1BurrowsWheelerAlgorithm::Decompress.");
+  
+  return false;
+}
+
+namespace
+{
+  // Decodes the uz1 data from InStream without seeking and writes each BWT chunk to OutStream as soon as it is decoded.
+  template <class ProgressT>
+  bool DecompressFromUz1Sequential_Impl(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      ProgressT& Progress, const SUz1DecodeLimits& Limits)
+  {
+    static const std::wstring UPDATE_MSG = L"Decoding";
+    
+    // Send an initial update.
+    if (Progress(0, 0, UPDATE_MSG))
+      return false;
+    
+    InStream.exceptions(std::ios::badbit | std::ios::failbit);
+    OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+    
+    // The header is read byte by byte, i.e. nothing behind it is consumed.
+    const int Uz1Signature = ReadUz1Header(InStream, OrigFilename);
+    const size_t HeaderSize = GetUz1HeaderSize(OrigFilename);
+    
+    uz1SequentialDecoder Decoder(*InStream.rdbuf(), Uz1Signature, Limits);
+    do
+    {
+      if (Progress(static_cast<unsigned int>(HeaderSize + Decoder.GetConsumedBytes()), 0, UPDATE_MSG))
+        return false;
+    }
+    while (Decoder.DecodeNextChunk(OutStream, GetCancelToken(Progress)));
+    
+    return !Decoder.WasCancelled();
+  }
+  
+  bool DecompressFromUz1Sequential_Templ(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SProgressTarget& Target, const SUz1DecodeLimits& Limits = SUz1DecodeLimits())
+  {
+    return RunWithProgress(Target, 0, [&](auto& Progress) {
+      return DecompressFromUz1Sequential_Impl(InStream, OutStream, OrigFilename, Progress, Limits);
+    });
+  }
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Sequential(InStream, OutStream, TempFilename, UpdateFunc, UserObj);
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  ReadFuncStreamBuf StreamBuf(ReadFunc, ReadObj);
+  in_stream InStream(&StreamBuf);
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj));
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, 
+    pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Sequential(ReadFunc, ReadObj, OutStream, TempFilename, UpdateFunc, UserObj);
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    SUz1Progress& Progress)
+{
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Sequential(InStream, OutStream, TempFilename, Progress);
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+    SUz1Progress& Progress)
+{
+  ReadFuncStreamBuf StreamBuf(ReadFunc, ReadObj);
+  in_stream InStream(&StreamBuf);
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress));
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SUz1Progress& Progress)
+{
+  SFilename TempFilename;
+  return DecompressFromUz1Sequential(ReadFunc, ReadObj, OutStream, TempFilename, Progress);
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj), Limits);
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc, void* UserObj)
+{
+  ReadFuncStreamBuf StreamBuf(ReadFunc, ReadObj);
+  in_stream InStream(&StreamBuf);
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(UpdateFunc, UserObj), Limits);
+}
+
+bool uzLib::DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, SUz1Progress& Progress)
+{
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress), Limits);
+}
+
+bool uzLib::DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+    const SUz1DecodeLimits& Limits, SUz1Progress& Progress)
+{
+  ReadFuncStreamBuf StreamBuf(ReadFunc, ReadObj);
+  in_stream InStream(&StreamBuf);
+  return DecompressFromUz1Sequential_Templ(InStream, OutStream, OrigFilename, MakeProgressTarget(Progress), Limits);
+}
+
+
+//============================================================================================================================
+// uz1DecompressStreamBuf
+//============================================================================================================================
+
+uzLib::uz1DecompressStreamBuf::uz1DecompressStreamBuf(in_stream& Source, const SUz1DecodeLimits& Limits):
+    m_pDecoder(NULL), m_bEnd(false)
+{
+  Source.exceptions(std::ios::badbit | std::ios::failbit);
+  
+  const int Uz1Signature = ReadUz1Header(Source, m_OrigFilename);
+  m_pDecoder = new uz1SequentialDecoder(*Source.rdbuf(), Uz1Signature, Limits);
+}
+
+uzLib::uz1DecompressStreamBuf::~uz1DecompressStreamBuf()
+{
+  delete m_pDecoder;
+}
+
+uzLib::uz1DecompressStreamBuf::int_type uzLib::uz1DecompressStreamBuf::underflow()
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  
+  // Decode the next BWT chunk. A chunk might result in no data at all (if it only completes a run of the RLE).
+  m_Buffer.clear();
+  while (m_Buffer.empty())
+  {
+    if (m_bEnd || !m_pDecoder->DecodeNextChunk(m_Buffer))
+    {
+      m_bEnd = true;
+      return traits_type::eof();
+    }
+  }
+  
+  char* const pBuffer = reinterpret_cast<char*>(&m_Buffer[0]);
+  setg(pBuffer, pBuffer, pBuffer + m_Buffer.size());
+  return traits_type::to_int_type(*gptr());
+}
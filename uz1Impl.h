@@ -13,8 +13,16 @@ Created by Gugi, 2010-2011
 #include <exception>
 #include <string>
 #include <iostream>
+#include <chrono>
 #include <zlib.h>
 
+// The managed wrapper (uzLib.cpp) includes this header as well, but C++/CLI doesn't support <mutex> and <atomic>, which
+// Allocator.h and SUz1Progress need. The declarations which use them are only available to native code.
+#ifndef __cplusplus_cli
+  #include <atomic>
+  #include "Allocator.h"
+#endif
+
 
 //===========================================================================
 //===========================================================================
@@ -25,7 +33,8 @@ Created by Gugi, 2010-2011
 // in the UT-Package-Delphi-library.
 // It is assumed, that all in_stream's behave like memory streams, i.e. the stream
 // stays the same on read operations (unlike e.g. the cin-object). That means, you
-// should only use fstreams and strstreams for it.
+// should only use fstreams and strstreams for it. The only exception is
+// DecompressFromUz1Sequential, which never seeks.
 //===========================================================================
 //===========================================================================
 namespace uzLib 
@@ -34,7 +43,70 @@ namespace uzLib
   using in_stream = std::istream;
   using out_stream = std::ostream;
   
+  // Growable byte buffer used by the buffer interface of the algorithms.
+  typedef std::vector<unsigned char> ByteVector;
+  
+#ifndef __cplusplus_cli
+  // Index arrays of the BWT (the biggest work buffers), allocated through the functions set by SetAllocator.
+  typedef std::vector<int, HookAllocator<int> > IndexVector;
+#endif
+  
+  // Read-only view of a contiguous byte range (e.g. the content of a ByteVector).
+  struct SByteSpan
+  {
+    const unsigned char* Data;
+    size_t Length;
+    
+    SByteSpan(): Data(NULL), Length(0) { }
+    SByteSpan(const unsigned char* InData, size_t InLength): Data(InData), Length(InLength) { }
+    SByteSpan(const ByteVector& Buffer): Data(Buffer.empty() ? NULL : &Buffer[0]), Length(Buffer.size()) { }
+  };
+  
+  class MappedOutputFile; // See FileMapping.h
+  
   typedef void (*pUz1UpdateFunc)(unsigned int CurStatus, unsigned int CompletedStatus, const std::wstring& Msg, bool& bCancel, void* UserObj);
+  
+  // Progress of an operation, shared with other threads, and its cancellation token. Alternative to the update function
+  // for the functions which have an overload with it: The operation only stores the counters (relaxed atomic stores, no
+  // messages are built) and checks IsCancelled() wherever it would call the update function, and additionally inside
+  // the BWT sort, so that it reacts within a few milliseconds. Another thread (e.g. a UI timer) polls the counters and
+  // may set bCancel; a deadline cancels the operation without another thread. A cancelled operation returns false.
+  // The object must stay valid during the call. Native code only (C++/CLI only sees the declaration).
+#ifdef __cplusplus_cli
+  struct SUz1Progress;
+#else
+  struct SUz1Progress
+  {
+    typedef std::chrono::steady_clock Clock;
+    
+    std::atomic<int> Step; // Current step (1..NumSteps); both are 0 for the functions without steps.
+    std::atomic<int> NumSteps;
+    std::atomic<unsigned int> CurStatus; // Same as the parameters of the update function (mostly bytes of the current step).
+    std::atomic<unsigned int> CompletedStatus;
+    std::atomic<bool> bCancel;
+    std::atomic<Clock::rep> Deadline; // Clock ticks since the epoch of Clock; 0 for none.
+    
+    SUz1Progress(): Step(0), NumSteps(0), CurStatus(0), CompletedStatus(0), bCancel(false), Deadline(0) { }
+    
+    // Cancels the operation once Clock::now() passed the deadline (or Timeout passed from now on).
+    void SetDeadline(Clock::time_point TimePoint) { Deadline.store(TimePoint.time_since_epoch().count()); }
+    void SetTimeout(Clock::duration Timeout) { SetDeadline(Clock::now() + Timeout); }
+    
+    // Returns true, if bCancel is set or the deadline passed.
+    bool IsCancelled()const
+    {
+      if (bCancel.load(std::memory_order_relaxed))
+        return true;
+      
+      const Clock::rep DeadlineTicks = Deadline.load(std::memory_order_relaxed);
+      return DeadlineTicks != 0 && Clock::now().time_since_epoch().count() >= DeadlineTicks;
+    }
+  };
+#endif
+  
+  // Reads max. MaxLength bytes into Buffer and returns the number of read bytes. It should block until at least one byte
+  // is available; 0 is returned at the end of the data. Exceptions thrown by the function are passed on.
+  typedef size_t (*pUz1ReadFunc)(unsigned char* Buffer, size_t MaxLength, void* ReadObj);
 
 
   //==================================================
@@ -64,6 +136,23 @@ namespace uzLib
       EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
   bool CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
       EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
+  bool CompressToUz1(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
+  
+  // Same as CompressToUz1, but with bounded memory: The input is read sequentially from its current position (no seeking)
+  // and passed block by block through the RLE, BWT and MTF steps; only the input of the huffman step is kept, in a
+  // temporary file. The memory usage is a small multiple of the BWT block size (256 KiB). The output is identical.
+  // The length of the input is unknown while it is read, so CompletedStatus is 0 during the first pass.
+  bool CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+      EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::string& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
+  bool CompressToUz1Streaming(in_stream& InStream, out_stream& OutStream, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
   
   
   //==================================================
@@ -86,6 +175,22 @@ namespace uzLib
     std::wstring UnicodeStr; // Valid in case of FilenameType == FT_UNICODE.
   };
   
+  // Limits for the decompression of untrusted uz1-files, so that a single file can't use up the CPU or the memory. A file
+  // which exceeds a limit is rejected with a std::runtime_error. Each limit is checked before the work it guards wherever
+  // the header data allows it (e.g. the huffman table and the BWT block headers), else between the slices of the decoding
+  // (every 64K huffman symbols or BWT block). 0 means no limit.
+  struct SUz1DecodeLimits
+  {
+    size_t MaxOutputBytes; // Size of the package. Checked after each BWT block, i.e. one block might be written beyond it.
+                           // Also limits the intermediate data (with the huffman header and every 64K symbols).
+    int MaxHuffmanDepth; // Max. code length in bits (the format allows 255).
+    int MaxHuffmanNodes; // Number of nodes of the huffman tree (the format allows 511).
+    int MaxBWTBlocks; // Number of BWT blocks (of max. 256 KiB each). Also bounds the memory of the intermediate data.
+    std::chrono::milliseconds MaxCPUTime; // CPU time of the calling thread (of all threads for DecompressFromUz1Pipelined).
+    
+    SUz1DecodeLimits(): MaxOutputBytes(0), MaxHuffmanDepth(0), MaxHuffmanNodes(0), MaxBWTBlocks(0), MaxCPUTime(0) { }
+  };
+  
   
   // Speed tests:
   // - AS-HiSpeed.unr.uz (1.21MB):
@@ -104,20 +209,203 @@ namespace uzLib
   // unicode or ASCII format. Use the second version of this function to get it.
   bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
   bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress);
+  bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, SUz1Progress& Progress);
+  bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, const SUz1DecodeLimits& Limits, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, const SUz1DecodeLimits& Limits, 
+      SUz1Progress& Progress);
+  
+  // Same as DecompressFromUz1, but the decoding steps are pipelined: Each step runs on its own thread and passes
+  // fixed-size chunks through a bounded queue to the next step (the BWT step waits for complete BWT chunks), so the
+  // steps overlap and the total time approaches the time of the slowest step.
+  // The update function is only called from the calling thread.
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress);
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, SUz1Progress& Progress);
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Pipelined(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, SUz1Progress& Progress);
+  
+  // Same as DecompressFromUz1, but for sources which can't seek (pipes, sockets, cin): The input is read from its
+  // current position and only as far as the uz1 data goes (the stream buffer might have read ahead, though). The data
+  // is decoded while it arrives and each BWT chunk is written to OutStream as soon as it is complete, so the memory
+  // usage is independent of the file size. The second pair reads the data through ReadFunc (ReadObj is passed to it).
+  // The length of the input is unknown, so CurStatus is the number of consumed bytes and CompletedStatus is always 0.
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SUz1Progress& Progress);
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, SUz1Progress& Progress);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SUz1Progress& Progress);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+      SUz1Progress& Progress);
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFromUz1Sequential(in_stream& InStream, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, SUz1Progress& Progress);
+  bool DecompressFromUz1Sequential(pUz1ReadFunc ReadFunc, void* ReadObj, out_stream& OutStream, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, SUz1Progress& Progress);
+  
+  class uz1SequentialDecoder; // Internal decoder of DecompressFromUz1Sequential.
+  
+  // Read-only stream buffer, which decompresses the uz1 data in Source lazily: A BWT chunk is only decoded when the
+  // reader gets to it, so reading e.g. only the header and the name table of a package costs a fraction of a full
+  // decode. Source is read sequentially from its current position (see DecompressFromUz1Sequential) and must stay
+  // valid as long as the object is used.
+  // The constructor reads the uz1 header and throws in case of errors. Later errors set the badbit of the reading
+  // istream (see DecompressStream.h), which rethrows them if requested by its exception mask.
+  // The limits are checked from the construction on, so MaxCPUTime includes the work of the reader in between.
+  class uz1DecompressStreamBuf : public std::streambuf
+  {
+    public:
+      explicit uz1DecompressStreamBuf(in_stream& Source, const SUz1DecodeLimits& Limits = SUz1DecodeLimits());
+      virtual ~uz1DecompressStreamBuf();
+      
+      // Returns the original filename saved in the header.
+      const SFilename& GetOrigFilename()const { return m_OrigFilename; }
+    
+    protected:
+      virtual int_type underflow();
+    
+    private:
+      uz1DecompressStreamBuf(const uz1DecompressStreamBuf&); // Not copyable.
+      uz1DecompressStreamBuf& operator=(const uz1DecompressStreamBuf&);
+    
+    private:
+      SFilename m_OrigFilename;
+      uz1SequentialDecoder* m_pDecoder;
+      ByteVector m_Buffer; // The last decoded BWT chunk.
+      bool m_bEnd;
+  };
+  
+  // Buffer versions of CompressToUz1 and DecompressFromUz1, meant for small packages (e.g. .int, .u and .utx files),
+  // where the fixed costs of the stream versions dominate: No streams and no step objects are used, the huffman tree
+  // lives in a fixed array and each thread keeps its work buffers between the calls, so that a series of calls doesn't
+  // allocate once the buffers are warmed up. Bigger inputs work as well.
+  // There is no update function. OutData is replaced by the result. Exceptions are thrown in case of errors.
+  void CompressBufferToUz1(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, EUz1Signature Uz1Sig);
+  void CompressBufferToUz1(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig);
+  void DecompressBufferFromUz1(const SByteSpan& InData, ByteVector& OutData);
+  void DecompressBufferFromUz1(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename);
+  
+  //==================================================
+  // Reusable uz1 compression/decompression context: It owns all work buffers (including the scratch memory of the BWT)
+  // and keeps them at the size of the biggest file so far, so that a series of Compress/Decompress calls doesn't
+  // allocate once the buffers grew (if the same OutData vector is passed each time; converting a unicode package name
+  // might allocate). The buffer functions above use one codec per thread.
+  // An object must only be used by one thread at a time. Exceptions are thrown in case of errors. Native code only.
+  //==================================================
+#ifndef __cplusplus_cli
+  class uz1Codec
+  {
+    public:
+      uz1Codec();
+      
+      // Same as CompressBufferToUz1 and DecompressBufferFromUz1.
+      void Compress(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, EUz1Signature Uz1Sig);
+      void Compress(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig);
+      void Decompress(const SByteSpan& InData, ByteVector& OutData);
+      void Decompress(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename);
+      
+      // Same as above, but with progress and cancellation; false is returned if the operation was cancelled.
+      bool Compress(const SByteSpan& InData, ByteVector& OutData, const std::string& PkgFilename, EUz1Signature Uz1Sig, 
+          SUz1Progress& Progress);
+      bool Compress(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig, 
+          SUz1Progress& Progress);
+      bool Decompress(const SByteSpan& InData, ByteVector& OutData, SUz1Progress& Progress);
+      bool Decompress(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename, SUz1Progress& Progress);
+      
+      // Sets the limits for all following Decompress calls (none by default).
+      void SetDecodeLimits(const SUz1DecodeLimits& Limits) { m_DecodeLimits = Limits; }
+      const SUz1DecodeLimits& GetDecodeLimits()const { return m_DecodeLimits; }
+      
+      // Returns the number of bytes held by the work buffers.
+      size_t GetWorkspaceSize()const;
+      
+      // Frees the work buffers (e.g. after an unusually big file).
+      void ReleaseWorkspace();
+    
+    private:
+      uz1Codec(const uz1Codec&); // Not copyable.
+      uz1Codec& operator=(const uz1Codec&);
+      
+      template <class T, class ProgressT>
+      bool Compress_Templ(const SByteSpan& InData, ByteVector& OutData, const T& PkgFilename, EUz1Signature Uz1Sig, 
+          ProgressT& Progress);
+      template <class ProgressT>
+      bool Compress_Conv(const SByteSpan& InData, ByteVector& OutData, const std::wstring& PkgFilename, EUz1Signature Uz1Sig, 
+          ProgressT& Progress);
+      template <class ProgressT>
+      bool Decompress_Templ(const SByteSpan& InData, ByteVector& OutData, SFilename& OrigFilename, ProgressT& Progress);
+    
+    private:
+      ByteVector m_Buffer1;
+      ByteVector m_Buffer2;
+      IndexVector m_Positions; // Scratch memory of the BWT.
+      SUz1DecodeLimits m_DecodeLimits;
+  };
+#endif
+  
+#ifndef _WIN32
+  // File versions of CompressToUz1 and DecompressFromUz1 (POSIX only): The input file is mapped into the memory and
+  // the first step reads directly from the mapping; the last step writes directly into a mapping of the output file.
+  // When compressing, the output file is created with its final size, which follows from the byte frequencies of the
+  // huffman step; when decompressing, it grows while it is written.
+  // A std::runtime_error is thrown if a file can't be opened or mapped and, like for DecompressFromUz1, if the data is
+  // damaged or exceeds the decode limits. The output file is only created after the input was read; if the last step
+  // fails or is cancelled, it is removed again, so that no incomplete file is left behind.
+  bool CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::string& PkgFilename, 
+      EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::string& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
+  bool CompressFileToUz1(const std::string& InFilename, const std::string& OutFilename, const std::wstring& PkgFilename, 
+      EUz1Signature Uz1Sig, SUz1Progress& Progress);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SUz1Progress& Progress);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      SUz1Progress& Progress);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL);
+  bool DecompressFileFromUz1(const std::string& InFilename, const std::string& OutFilename, SFilename& OrigFilename, 
+      const SUz1DecodeLimits& Limits, SUz1Progress& Progress);
+#endif
   
 
 
   //==================================================
   // Base class for all algorithms required for the uz-format.
   //==================================================
+  // Each algorithm works on contiguous buffers (the "buffer interface"). The stream interface is only a thin adapter,
+  // which reads the input in one go into a buffer and writes the result in one go to the output stream.
   class uz1AlgorithmBase
   {
     public:
       // Encodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0) = 0;
+      bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
       
       // Decodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0) = 0;
+      bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      
+      // Encodes the data in InData and stores the result in OutData. The previous content of OutData is discarded
+      // (its capacity is kept, so the same vectors can be used for several steps).
+      virtual bool Compress(const SByteSpan& InData, ByteVector& OutData) = 0;
+      
+      // Decodes the data in InData and stores the result in OutData. The previous content of OutData is discarded.
+      virtual bool Decompress(const SByteSpan& InData, ByteVector& OutData) = 0;
     
       // Update function getter/setter.
       pUz1UpdateFunc GetUpdateFunc()const { return m_UpdateFunc; }
@@ -130,9 +418,6 @@ namespace uzLib
       // Constructor. UpdateFunc is called in the compress/decompress process, if UpdateFunc is not NULL (UserObj is passed
       // as a parameter with the UpdateFunc-call). ThisStepNum and NumsSteps are used to amend the message of the UpdateFunc-call.
       uz1AlgorithmBase(pUz1UpdateFunc UpdateFunc, void* UserObj, int ThisStepNum, int NumSteps);
-    
-      // Called at the beginning of the Compress/Decompress functions. Returns the length of InStream.
-      int AlgorithmPreamble(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamStartPos);
       
       // If m_UpdateFunc is not NULL, it is called. True is returned, in case the operation should be cancelled,
       // else false is returned.
@@ -142,9 +427,11 @@ namespace uzLib
       pUz1UpdateFunc m_UpdateFunc;
       void* m_pUserObj;
       int m_ThisStepNum;
-      std::wstring m_NumStepsStr;
+      std::wstring m_StepPrefix; // E.g. "(2/5) ".
+      std::wstring m_LastMsg; // The last message and the one with m_StepPrefix, which is passed to the update function.
+      std::wstring m_StepMsg;
       
-    protected:
+    public:
       static const int BYTE_UPDATE_INTERVALL = 8192; // In some algorithms every x bytes the update-function is called. x is this constant.
   };
 
@@ -179,34 +466,59 @@ namespace uzLib
       // Constructor. UpdateFunc is called in the compress/decompress process, if UpdateFunc is not NULL.
       uz1BurrowsWheelerAlgorithm(pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL, int ThisStepNum = -1, int NumSteps = -1);
     
-      // Encodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Stream interface (see uz1AlgorithmBase).
+      using uz1AlgorithmBase::Compress;
+      using uz1AlgorithmBase::Decompress;
+    
+      // Encodes the data in InData and stores the result in OutData.
+      virtual bool Compress(const SByteSpan& InData, ByteVector& OutData);
       
-      // Decodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Decodes the data in InData and stores the result in OutData.
+      virtual bool Decompress(const SByteSpan& InData, ByteVector& OutData);
+      
+      // Encodes one chunk of max. MAX_BUFFER_SIZE bytes: Writes the chunk header (Length, First, Last) and the Length+1
+      // encoded bytes to OutData (i.e. GetEncodedChunkSize(Length) bytes). CompressPosition is used as scratch memory
+      // (2*(Length+1) ints); nothing else is allocated and no static data is used, so several threads may encode at once.
+      // If pCancel is not NULL, the sort checks it regularly (BWT_STD_SORT only) and false is returned if the operation
+      // was cancelled; OutData is incomplete then. Native code only.
+#ifndef __cplusplus_cli
+      static bool EncodeChunk(const unsigned char* InData, const int Length, unsigned char* OutData, IndexVector& CompressPosition, 
+          const SUz1Progress* pCancel = NULL);
+#endif
+      
+      // Returns the size of an encoded chunk (including its header).
+      static size_t GetEncodedChunkSize(int Length) { return 3*sizeof(int) + Length + 1; }
       
     private:
+#ifndef __cplusplus_cli
       // Initializes the vector with numbers: { 0, 1, 2, 3, ..., CompressLength }
-      static void InitCompressPositionVector(std::vector<int>& CompressPositionVect, const int CompressLength);
+      static void InitCompressPositionVector(IndexVector& CompressPositionVect, const int CompressLength);
+#endif
 
       // Used to sort the data.
 #if (BWT_SORT_TYPE == BWT_STD_SORT)
-      static bool ClampedBufferCompare(int P1, int P2);
+      struct ClampedBufferCompare
+      {
+        const unsigned char* CompressBuffer;
+        int CompressLength;
+        
+        bool operator()(int P1, int P2)const;
+        
+        // Same as operator(), but also returns the number of compared bytes (i.e. the cost of the comparison).
+        bool Compare(int P1, int P2, int& NumCompared)const;
+      };
 #elif (BWT_SORT_TYPE == BWT_C_SORT)
       static int CStyle_ClampedBufferCompare(const int* P1, const int* P2);
 #endif
     
-      // These are only valid during the ClampedBufferCompare-call.
-#if (BWT_SORT_TYPE == BWT_STD_SORT)
-      static std::vector<unsigned char>* Temp_CompressBuffer;
-      static int Temp_CompressLength;
-#elif (BWT_SORT_TYPE == BWT_C_SORT)
-	    static unsigned char* Temp_CStyle_CompressBuffer;
+      // These are only valid during the CStyle_ClampedBufferCompare-call.
+#if (BWT_SORT_TYPE == BWT_C_SORT)
+	    static const unsigned char* Temp_CStyle_CompressBuffer;
 	    static int Temp_CStyle_CompressLength;
 #endif
 
-    private:
-      static const unsigned int MAX_BUFFER_SIZE = 0x40000; // Size of the used buffer.
+    public:
+      static const unsigned int MAX_BUFFER_SIZE = 0x40000; // Size of the used buffer (i.e. the max. size of a chunk).
   };
 
 
@@ -219,20 +531,28 @@ namespace uzLib
       // Constructor. UpdateFunc is called in the compress/decompress process, if UpdateFunc is not NULL.
       uz1RLEAlgorithm(pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL, int ThisStepNum = -1, int NumSteps = -1);
 
-      // Encodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Stream interface (see uz1AlgorithmBase).
+      using uz1AlgorithmBase::Compress;
+      using uz1AlgorithmBase::Decompress;
+    
+      // Encodes the data in InData and stores the result in OutData.
+      virtual bool Compress(const SByteSpan& InData, ByteVector& OutData);
       
-      // Decodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Decodes the data in InData and stores the result in OutData.
+      virtual bool Decompress(const SByteSpan& InData, ByteVector& OutData);
       
-    private:
-      // If Count >= 5, the specified 'Char' is written 5 times and the length is appended.
-      // Else only the specified number of 'Char's are written.
-      // That means, a compressed block begins, if 5 identical characters appear back-to-back.
-      static void EncodeEmitRun(out_stream& OutStream, BYTE Char, BYTE Count); 
+#ifndef _WIN32
+      // Decodes the data in InData and appends the result to the output file (POSIX only).
+      bool Decompress(const SByteSpan& InData, MappedOutputFile& OutData);
+#endif
       
     private:
-      static const BYTE RLE_LEAD = 5;
+      // Implementation of the buffer and the file version of Decompress().
+      template <class OutputT>
+      bool DecompressTo(const SByteSpan& InData, OutputT& OutData);
+      
+    public:
+      static const BYTE RLE_LEAD = 5; // Number of identical bytes after which the run-length follows.
   };
 
 
@@ -245,11 +565,23 @@ namespace uzLib
       // Constructor. UpdateFunc is called in the compress/decompress process, if UpdateFunc is not NULL.
       uz1HuffmanAlgorithm(pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL, int ThisStepNum = -1, int NumSteps = -1);
 
-      // Encodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Stream interface (see uz1AlgorithmBase).
+      using uz1AlgorithmBase::Compress;
+      using uz1AlgorithmBase::Decompress;
+    
+      // Encodes the data in InData and stores the result in OutData.
+      virtual bool Compress(const SByteSpan& InData, ByteVector& OutData);
       
-      // Decodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Decodes the data in InData and stores the result in OutData.
+      virtual bool Decompress(const SByteSpan& InData, ByteVector& OutData);
+      
+      // Limits for the decompression of untrusted data (none by default): The tree is checked against the huffman limits
+      // and the total byte count against MaxOutputBytes and MaxBWTBlocks before the output is allocated.
+      void SetDecodeLimits(const SUz1DecodeLimits& Limits) { m_DecodeLimits = Limits; }
+      const SUz1DecodeLimits& GetDecodeLimits()const { return m_DecodeLimits; }
+    
+    private:
+      SUz1DecodeLimits m_DecodeLimits;
   };
   
   
@@ -262,11 +594,15 @@ namespace uzLib
       // Constructor. UpdateFunc is called in the compress/decompress process, if UpdateFunc is not NULL.
       uz1MoveToFrontAlgorithm(pUz1UpdateFunc UpdateFunc = NULL, void* UserObj = NULL, int ThisStepNum = -1, int NumSteps = -1);
 
-      // Encodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Compress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Stream interface (see uz1AlgorithmBase).
+      using uz1AlgorithmBase::Compress;
+      using uz1AlgorithmBase::Decompress;
+    
+      // Encodes the data in InData and stores the result in OutData.
+      virtual bool Compress(const SByteSpan& InData, ByteVector& OutData);
       
-      // Decodes the data in the input stream, beginning with the byte at position InStreamBeg.
-      virtual bool Decompress(in_stream& InStream, out_stream& OutStream, std::ios::pos_type InStreamBeg = 0);
+      // Decodes the data in InData and stores the result in OutData.
+      virtual bool Decompress(const SByteSpan& InData, ByteVector& OutData);
   };
   
 } // End namepsace uzLib
\ No newline at end of file
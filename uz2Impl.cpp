@@ -0,0 +1,409 @@
+/*
+uz2Impl.cpp: Contains the implementation of the classes in uz2Impl.h.
+
+Language: C++
+*/
+
+#include "uz2Impl.h"
+#include "FileMapping.h"
+#include "OrderedWorkers.h"
+#include "IndexedChunks.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+using namespace uzLib;
+
+
+namespace
+{
+  // Reads exactly Length bytes from the stream buffer and returns the number of read bytes (less only at the end of the data).
+  size_t ReadFromStreamBuf(std::streambuf& Source, unsigned char* Target, size_t Length)
+  {
+    return static_cast<size_t>(Source.sgetn(reinterpret_cast<char*>(Target), static_cast<std::streamsize>(Length)));
+  }
+  
+  // Checks the sizes of a chunk header. ComprSize and UnComprSize must be > 0 and below the max. sizes.
+  void CheckChunkHeader(int ComprSize, int UnComprSize)
+  {
+    if (ComprSize <= 0 || static_cast<size_t>(ComprSize) > UZ2_COMPR_BLOCK_SIZE)
+      throw std::runtime_error("Input is not a uz2 file (invalid compressed-size).");
+    if (UnComprSize <= 0 || static_cast<size_t>(UnComprSize) > UZ2_UNCOMPR_BLOCK_SIZE)
+      throw std::runtime_error("Input is not a uz2 file (invalid uncompressed-size).");
+  }
+}
+
+
+//============================================================================================================================
+// uz2Codec
+//============================================================================================================================
+
+void uzLib::uz2Codec::Compress(const SByteSpan& InData, ByteVector& OutData)
+{
+  // Reserve room for the worst case, so that appending the chunks doesn't reallocate.
+  const size_t NumChunks = (InData.Length + UZ2_UNCOMPR_BLOCK_SIZE - 1) / UZ2_UNCOMPR_BLOCK_SIZE;
+  OutData.clear();
+  OutData.reserve(NumChunks * (UZ2_CHUNK_HEADER_SIZE + UZ2_COMPR_BLOCK_SIZE));
+  
+  // Compress each chunk of max. UZ2_UNCOMPR_BLOCK_SIZE bytes on its own.
+  for (size_t ProcessedBytes = 0; ProcessedBytes < InData.Length; ProcessedBytes += UZ2_UNCOMPR_BLOCK_SIZE)
+  {
+    const size_t UnComprSize = std::min(InData.Length - ProcessedBytes, UZ2_UNCOMPR_BLOCK_SIZE);
+    
+    const size_t ChunkPos = OutData.size();
+    OutData.resize(ChunkPos + UZ2_CHUNK_HEADER_SIZE + UZ2_COMPR_BLOCK_SIZE);
+    const size_t ChunkSize = CompressChunk(InData.Data + ProcessedBytes, UnComprSize, &OutData[ChunkPos]);
+    OutData.resize(ChunkPos + ChunkSize);
+  }
+}
+
+void uzLib::uz2Codec::Decompress(const SByteSpan& InData, ByteVector& OutData)
+{
+  OutData.clear();
+  
+  size_t ProcessedBytes = 0;
+  while (ProcessedBytes < InData.Length)
+  {
+    if (InData.Length - ProcessedBytes < UZ2_CHUNK_HEADER_SIZE)
+      throw std::runtime_error("Input ends inside the header of a uz2 chunk.");
+    
+    const int ComprSize = GetInt(InData.Data + ProcessedBytes);
+    const int UnComprSize = GetInt(InData.Data + ProcessedBytes + sizeof(int));
+    CheckChunkHeader(ComprSize, UnComprSize);
+    ProcessedBytes += UZ2_CHUNK_HEADER_SIZE;
+    
+    if (InData.Length - ProcessedBytes < static_cast<size_t>(ComprSize))
+      throw std::runtime_error("Couldn't read complete compressed-data chunk (or the file is damaged).");
+    
+    const size_t OldSize = OutData.size();
+    OutData.resize(OldSize + UnComprSize);
+    DecompressChunk(InData.Data + ProcessedBytes, ComprSize, &OutData[OldSize], UnComprSize);
+    
+    ProcessedBytes += ComprSize;
+  }
+}
+
+size_t uzLib::uz2Codec::CompressChunk(const unsigned char* Source, size_t Length, unsigned char* Target)
+{
+  uLongf ComprSize = UZ2_COMPR_BLOCK_SIZE;
+  const int StatusCode = m_Deflate.Compress(Target + UZ2_CHUNK_HEADER_SIZE, &ComprSize, Source, static_cast<uLong>(Length));
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't compress a uz2 chunk", StatusCode);
+  
+  PutInt(Target, static_cast<int>(ComprSize));
+  PutInt(Target + sizeof(int), static_cast<int>(Length));
+  return UZ2_CHUNK_HEADER_SIZE + ComprSize;
+}
+
+void uzLib::uz2Codec::DecompressChunk(const unsigned char* Source, size_t ComprSize, unsigned char* Target, size_t UnComprSize)
+{
+  uLongf RealUnComprSize = static_cast<uLongf>(UnComprSize);
+  const int StatusCode = m_Inflate.Decompress(Target, &RealUnComprSize, Source, static_cast<uLong>(ComprSize));
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't decompress a uz2 chunk", StatusCode);
+  else if (RealUnComprSize != static_cast<uLongf>(UnComprSize))
+    throw std::runtime_error("The decompressed chunk has a different size than the saved value. Damaged file?");
+}
+
+
+//-----------------------------------------------------------------------------------------
+// Buffer functions: Each thread has its own codec.
+//-----------------------------------------------------------------------------------------
+
+void uzLib::CompressBufferToUz2(const SByteSpan& InData, ByteVector& OutData)
+{
+  GetThreadCodec<uz2Codec>().Compress(InData, OutData);
+}
+
+void uzLib::DecompressBufferFromUz2(const SByteSpan& InData, ByteVector& OutData)
+{
+  GetThreadCodec<uz2Codec>().Decompress(InData, OutData);
+}
+
+
+//============================================================================================================================
+// Parallel uz2 compression
+//============================================================================================================================
+
+namespace
+{
+  // Chunk of the parallel compression.
+  struct SUz2ChunkSlot
+  {
+    ByteVector InData; // UZ2_UNCOMPR_BLOCK_SIZE bytes.
+    size_t InLength;
+    ByteVector OutData; // Compressed chunk including its header.
+    size_t OutLength;
+    
+    SUz2ChunkSlot(): InData(UZ2_UNCOMPR_BLOCK_SIZE), InLength(0), OutData(UZ2_CHUNK_HEADER_SIZE + UZ2_COMPR_BLOCK_SIZE), 
+        OutLength(0)
+    { }
+  };
+  
+  // Compresses the chunks of one worker thread with its own codec.
+  class Uz2ChunkWorker
+  {
+    public:
+      void Process(SUz2ChunkSlot& Slot)
+      {
+        Slot.OutLength = m_Codec.CompressChunk(&Slot.InData[0], Slot.InLength, &Slot.OutData[0]);
+      }
+    
+    private:
+      uz2Codec m_Codec;
+  };
+}
+
+void uzLib::CompressToUz2Parallel(in_stream& InStream, out_stream& OutStream, unsigned int NumThreads)
+{
+  if (NumThreads == 0)
+    NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  
+  OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+  
+  // The calling thread reads ahead into the free slots and writes the compressed chunks in order.
+  std::streambuf& Source = *InStream.rdbuf();
+  OrderedWorkers<SUz2ChunkSlot, Uz2ChunkWorker> Workers(NumThreads, NumThreads * UZ2_SLOTS_PER_THREAD);
+  Workers.Run([&Source](SUz2ChunkSlot& Slot)
+  {
+    Slot.InLength = ReadFromStreamBuf(Source, &Slot.InData[0], UZ2_UNCOMPR_BLOCK_SIZE);
+    return Slot.InLength > 0;
+  },
+  [&OutStream](SUz2ChunkSlot& Slot)
+  {
+    OutStream.write(reinterpret_cast<const char*>(&Slot.OutData[0]), Slot.OutLength);
+  });
+}
+
+
+//============================================================================================================================
+// Parallel uz2 decompression
+//============================================================================================================================
+
+namespace
+{
+  // Inflates the chunks into Target on NumThreads threads (the calling one included, see ProcessIndicesParallel).
+  void DecompressUz2ChunksParallel(const SByteSpan& InData, const uz2ChunkIndex& Index, unsigned char* Target, 
+      unsigned int NumThreads)
+  {
+    ProcessIndicesParallel<uz2Codec>(Index.GetNumChunks(), NumThreads, [&](uz2Codec& Codec, size_t CurIndex)
+    {
+      Codec.DecompressChunk(InData.Data + Index.GetChunkOffset(CurIndex) + UZ2_CHUNK_HEADER_SIZE, 
+          Index.GetComprSize(CurIndex), Target + Index.GetUnComprOffset(CurIndex), Index.GetUnComprSize(CurIndex));
+    });
+  }
+}
+
+void uzLib::DecompressFileFromUz2Parallel(const std::string& InFilename, const std::string& OutFilename, 
+    unsigned int NumThreads)
+{
+  if (NumThreads == 0)
+    NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  
+  const MappedInputFile InFile(InFilename);
+  const SByteSpan InData(InFile.GetData(), InFile.GetSize());
+  
+  uz2ChunkIndex Index;
+  Index.Build(InData);
+  
+  const size_t PackageSize = Index.GetPackageSize();
+  MappedOutputFile OutFile(OutFilename, PackageSize);
+  DecompressUz2ChunksParallel(InData, Index, OutFile.Extend(PackageSize), NumThreads);
+  OutFile.Close();
+}
+
+
+//============================================================================================================================
+// uz2ChunkIndex
+//============================================================================================================================
+
+namespace
+{
+  // Sidecar file (see IndexedChunks.h) with the size of the uz2 data and one entry per chunk: The compressed and the
+  // uncompressed size of the chunk (2 bytes each; both are <= 0xFFFF).
+  const uint32_t UZ2_INDEX_MAGIC_NUMBER = 0x49325A55; // "UZ2I"
+  const uint32_t UZ2_INDEX_VERSION = 1;
+  const size_t UZ2_INDEX_ENTRY_SIZE = 2*sizeof(uint16_t);
+}
+
+uzLib::uz2ChunkIndex::uz2ChunkIndex():
+  m_ComprOffsets(1, 0), m_UnComprOffsets(1, 0)
+{ }
+
+void uzLib::uz2ChunkIndex::Build(const SByteSpan& Uz2Data)
+{
+  std::vector<size_t> ComprOffsets(1, 0);
+  std::vector<size_t> UnComprOffsets(1, 0);
+  
+  size_t ProcessedBytes = 0;
+  while (ProcessedBytes < Uz2Data.Length)
+  {
+    if (Uz2Data.Length - ProcessedBytes < UZ2_CHUNK_HEADER_SIZE)
+      throw std::runtime_error("Input ends inside the header of a uz2 chunk.");
+    
+    const int ComprSize = GetInt(Uz2Data.Data + ProcessedBytes);
+    const int UnComprSize = GetInt(Uz2Data.Data + ProcessedBytes + sizeof(int));
+    CheckChunkHeader(ComprSize, UnComprSize);
+    ProcessedBytes += UZ2_CHUNK_HEADER_SIZE;
+    
+    if (Uz2Data.Length - ProcessedBytes < static_cast<size_t>(ComprSize))
+      throw std::runtime_error("Couldn't read complete compressed-data chunk (or the file is damaged).");
+    
+    ProcessedBytes += ComprSize;
+    ComprOffsets.push_back(ProcessedBytes);
+    UnComprOffsets.push_back(UnComprOffsets.back() + UnComprSize);
+  }
+  
+  m_ComprOffsets.swap(ComprOffsets);
+  m_UnComprOffsets.swap(UnComprOffsets);
+}
+
+void uzLib::uz2ChunkIndex::Save(const std::string& Filename)const
+{
+  ByteVector Data = BeginIndexFile(UZ2_INDEX_MAGIC_NUMBER, UZ2_INDEX_VERSION, m_ComprOffsets.back(), GetNumChunks(), 
+      UZ2_INDEX_ENTRY_SIZE);
+  for (size_t CurIndex = 0; CurIndex < GetNumChunks(); ++CurIndex)
+  {
+    AppendValue<uint16_t>(Data, static_cast<uint16_t>(GetComprSize(CurIndex)));
+    AppendValue<uint16_t>(Data, static_cast<uint16_t>(GetUnComprSize(CurIndex)));
+  }
+  
+  SaveIndexFile(Filename, Data, "uz2");
+}
+
+bool uzLib::uz2ChunkIndex::Load(const std::string& Filename, size_t Uz2Size)
+{
+  ByteVector Data;
+  size_t Pos;
+  uint32_t NumChunks = 0;
+  if (!LoadIndexFile(Filename, UZ2_INDEX_MAGIC_NUMBER, UZ2_INDEX_VERSION, Uz2Size, UZ2_INDEX_ENTRY_SIZE, Data, Pos, NumChunks))
+    return false;
+  
+  std::vector<size_t> ComprOffsets(1, 0);
+  std::vector<size_t> UnComprOffsets(1, 0);
+  ComprOffsets.reserve(NumChunks + 1);
+  UnComprOffsets.reserve(NumChunks + 1);
+  for (uint32_t CurIndex = 0; CurIndex < NumChunks; ++CurIndex)
+  {
+    const size_t ComprSize = ReadValue<uint16_t>(Data, Pos);
+    const size_t UnComprSize = ReadValue<uint16_t>(Data, Pos);
+    if (ComprSize == 0 || ComprSize > UZ2_COMPR_BLOCK_SIZE || UnComprSize == 0 || UnComprSize > UZ2_UNCOMPR_BLOCK_SIZE)
+      return false;
+    
+    ComprOffsets.push_back(ComprOffsets.back() + UZ2_CHUNK_HEADER_SIZE + ComprSize);
+    UnComprOffsets.push_back(UnComprOffsets.back() + UnComprSize);
+  }
+  
+  if (ComprOffsets.back() != Uz2Size)
+    return false;
+  
+  m_ComprOffsets.swap(ComprOffsets);
+  m_UnComprOffsets.swap(UnComprOffsets);
+  return true;
+}
+
+size_t uzLib::uz2ChunkIndex::FindChunk(size_t Offset)const
+{
+  // The first chunk which begins behind Offset follows the searched one.
+  return std::upper_bound(m_UnComprOffsets.begin(), m_UnComprOffsets.end(), Offset) - m_UnComprOffsets.begin() - 1;
+}
+
+
+//============================================================================================================================
+// uz2RandomAccessFile
+//============================================================================================================================
+
+uzLib::uz2RandomAccessFile::uz2RandomAccessFile(const std::string& Filename, const std::string& IndexFilename, 
+    size_t NumCachedChunks):
+  m_File(Filename, false), m_Cache(NumCachedChunks)
+{
+  const SByteSpan Uz2Data(m_File.GetData(), m_File.GetSize());
+  if (IndexFilename.empty() || !m_Index.Load(IndexFilename, Uz2Data.Length))
+  {
+    m_Index.Build(Uz2Data);
+    if (!IndexFilename.empty())
+      m_Index.Save(IndexFilename);
+  }
+}
+
+size_t uzLib::uz2RandomAccessFile::ReadAt(size_t Offset, unsigned char* Target, size_t Length)
+{
+  if (Offset >= GetPackageSize())
+    return 0;
+  Length = std::min(Length, GetPackageSize() - Offset);
+  
+  size_t NumCopied = 0;
+  for (size_t ChunkIndex = m_Index.FindChunk(Offset); NumCopied < Length; ++ChunkIndex)
+  {
+    const ByteVector& Chunk = GetChunk(ChunkIndex);
+    const size_t PosInChunk = Offset + NumCopied - m_Index.GetUnComprOffset(ChunkIndex);
+    const size_t Count = std::min(Chunk.size() - PosInChunk, Length - NumCopied);
+    memcpy(Target + NumCopied, &Chunk[PosInChunk], Count);
+    NumCopied += Count;
+  }
+  
+  return NumCopied;
+}
+
+const ByteVector& uzLib::uz2RandomAccessFile::GetChunk(size_t ChunkIndex)
+{
+  return m_Cache.Get(ChunkIndex, m_Index.GetUnComprSize(ChunkIndex), [&](unsigned char* Target)
+  {
+    // A loaded index might not match the file; check the header of the chunk.
+    const unsigned char* const pChunk = m_File.GetData() + m_Index.GetChunkOffset(ChunkIndex);
+    if (static_cast<size_t>(GetInt(pChunk)) != m_Index.GetComprSize(ChunkIndex) || 
+        static_cast<size_t>(GetInt(pChunk + sizeof(int))) != m_Index.GetUnComprSize(ChunkIndex))
+      throw std::runtime_error("The uz2 chunk index doesn't match the uz2-file.");
+    
+    m_Codec.DecompressChunk(pChunk + UZ2_CHUNK_HEADER_SIZE, m_Index.GetComprSize(ChunkIndex), Target, 
+        m_Index.GetUnComprSize(ChunkIndex));
+  });
+}
+
+
+//============================================================================================================================
+// uz2DecompressStreamBuf
+//============================================================================================================================
+
+uzLib::uz2DecompressStreamBuf::uz2DecompressStreamBuf(in_stream& Source):
+    m_Source(*Source.rdbuf()), m_ComprBuffer(UZ2_COMPR_BLOCK_SIZE), m_UnComprBuffer(UZ2_UNCOMPR_BLOCK_SIZE)
+{ }
+
+uzLib::uz2DecompressStreamBuf::int_type uzLib::uz2DecompressStreamBuf::underflow()
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  
+  const size_t UnComprSize = DecompressNextChunk();
+  if (UnComprSize == 0)
+    return traits_type::eof();
+  
+  char* const pBuffer = reinterpret_cast<char*>(&m_UnComprBuffer[0]);
+  setg(pBuffer, pBuffer, pBuffer + UnComprSize);
+  return traits_type::to_int_type(*gptr());
+}
+
+size_t uzLib::uz2DecompressStreamBuf::DecompressNextChunk()
+{
+  // Read the compressed and the uncompressed size. The data may only end in front of a chunk.
+  unsigned char Header[UZ2_CHUNK_HEADER_SIZE];
+  const size_t HeaderBytes = ReadFromStreamBuf(m_Source, Header, UZ2_CHUNK_HEADER_SIZE);
+  if (HeaderBytes == 0)
+    return 0;
+  else if (HeaderBytes != UZ2_CHUNK_HEADER_SIZE)
+    throw std::runtime_error("Input ends inside the header of a uz2 chunk.");
+  
+  const int ComprSize = GetInt(Header);
+  const int UnComprSize = GetInt(Header + sizeof(int));
+  CheckChunkHeader(ComprSize, UnComprSize);
+  
+  // Read the whole compressed chunk and decompress it.
+  if (ReadFromStreamBuf(m_Source, &m_ComprBuffer[0], ComprSize) != static_cast<size_t>(ComprSize))
+    throw std::runtime_error("Couldn't read complete compressed-data chunk (or the file is damaged).");
+  
+  m_Codec.DecompressChunk(&m_ComprBuffer[0], ComprSize, &m_UnComprBuffer[0], UnComprSize);
+  return UnComprSize;
+}
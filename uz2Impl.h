@@ -0,0 +1,185 @@
+/*
+uz2Impl.h: Contains the native (standard C++) classes for the uz2-format.
+
+Language: C++
+*/
+
+#pragma once
+
+#include "uz1Impl.h"
+#include "ZlibStream.h"
+#include "FileMapping.h"
+#include "IndexedChunks.h"
+
+
+//===========================================================================
+// The uz2-format consists of independently compressed chunks. Each chunk
+// begins with 2 4-byte ints: The compressed size and the uncompressed size
+// (max. UZ2_UNCOMPR_BLOCK_SIZE bytes), followed by the output of zlib's
+// compress() function. See also uz2Lib in uzLib.h.
+//===========================================================================
+namespace uzLib
+{
+  const size_t UZ2_UNCOMPR_BLOCK_SIZE = 32768; // Max. size of the uncompressed data of a chunk.
+  const size_t UZ2_COMPR_BLOCK_SIZE = 33096; // Max. size of the compressed data of a chunk.
+  const size_t UZ2_CHUNK_HEADER_SIZE = 2*sizeof(int); // Compressed and uncompressed size.
+  
+  // Compresses the complete package in InData to the uz2-format (same output as uz2Lib::CompressFile) and saves the
+  // result in OutData. Exceptions are thrown in case of errors (derived from std::exception).
+  void CompressBufferToUz2(const SByteSpan& InData, ByteVector& OutData);
+  
+  // Decompresses the complete uz2 data in InData and saves the package in OutData. A std::runtime_error is thrown if
+  // the data is invalid.
+  void DecompressBufferFromUz2(const SByteSpan& InData, ByteVector& OutData);
+  
+  // Compresses the data in InStream (from its current position to the end) to the uz2-format and writes it to OutStream.
+  // The chunks are compressed by NumThreads worker threads (0: one per core), while the calling thread reads ahead and
+  // writes the compressed chunks in their order; the output is the same as the one of CompressBufferToUz2. At most
+  // UZ2_SLOTS_PER_THREAD chunks per thread are held in memory. OutStream will have its exceptions-flags set for the
+  // fail and bad-bits. Exceptions are thrown in case of errors (derived from std::exception).
+  const size_t UZ2_SLOTS_PER_THREAD = 4;
+  void CompressToUz2Parallel(in_stream& InStream, out_stream& OutStream, unsigned int NumThreads = 0);
+  
+  // Decompresses the uz2-file InFilename into OutFilename (POSIX only) on NumThreads threads (0: one per core). All chunk
+  // headers are read (and checked) first, which gives the offset of each chunk in the package: The output file is
+  // created with its final size and mapped, and the threads inflate the chunks directly into the mapping.
+  // A std::runtime_error is thrown if a file can't be opened or mapped or if the data is invalid (the output file is
+  // left incomplete then).
+  void DecompressFileFromUz2Parallel(const std::string& InFilename, const std::string& OutFilename, 
+      unsigned int NumThreads = 0);
+  
+  
+  //==================================================
+  // Reusable uz2 compression/decompression context: One deflate and one inflate state are kept for all chunks (and
+  // files) instead of initializing zlib for every chunk. The buffer functions above use one codec per thread.
+  // An object must only be used by one thread at a time. Exceptions are thrown in case of errors.
+  //==================================================
+  class uz2Codec
+  {
+    public:
+      uz2Codec() { }
+      
+      // Same as CompressBufferToUz2 and DecompressBufferFromUz2.
+      void Compress(const SByteSpan& InData, ByteVector& OutData);
+      void Decompress(const SByteSpan& InData, ByteVector& OutData);
+      
+      // Compresses a single chunk (max. UZ2_UNCOMPR_BLOCK_SIZE bytes) including its header into Target, which must hold
+      // UZ2_CHUNK_HEADER_SIZE + UZ2_COMPR_BLOCK_SIZE bytes. Returns the number of written bytes.
+      size_t CompressChunk(const unsigned char* Source, size_t Length, unsigned char* Target);
+      
+      // Decompresses the data of a single chunk (without header) into Target, which holds UnComprSize bytes.
+      void DecompressChunk(const unsigned char* Source, size_t ComprSize, unsigned char* Target, size_t UnComprSize);
+    
+    private:
+      uz2Codec(const uz2Codec&); // Not copyable.
+      uz2Codec& operator=(const uz2Codec&);
+    
+    private:
+      DeflateStream m_Deflate;
+      InflateStream m_Inflate;
+  };
+  
+  //==================================================
+  // Index of the chunks of a uz2-file: The position of each chunk in the uz2 data and of its data in the package. It's
+  // built from the chunk headers and can be saved to a small sidecar file (4 bytes per chunk), so that the headers of a
+  // big file don't need to be read again.
+  //==================================================
+  class uz2ChunkIndex
+  {
+    public:
+      uz2ChunkIndex();
+      
+      // Reads and checks all chunk headers of the uz2 data. A std::runtime_error is thrown if the data is invalid.
+      void Build(const SByteSpan& Uz2Data);
+      
+      // Saves the index to the sidecar file. A std::runtime_error is thrown if the file can't be written.
+      void Save(const std::string& Filename)const;
+      
+      // Loads the index from the sidecar file. Returns false (and leaves the index unchanged) if the file doesn't
+      // exist, is damaged or belongs to uz2 data of another size than Uz2Size (e.g. the uz2-file was replaced).
+      bool Load(const std::string& Filename, size_t Uz2Size);
+      
+      size_t GetNumChunks()const { return m_UnComprOffsets.size() - 1; }
+      size_t GetPackageSize()const { return m_UnComprOffsets.back(); }
+      
+      // Returns the index of the chunk which contains the byte at Offset (< GetPackageSize()) of the package.
+      size_t FindChunk(size_t Offset)const;
+      
+      // Position of the chunk (including its header) in the uz2 data.
+      size_t GetChunkOffset(size_t ChunkIndex)const { return m_ComprOffsets[ChunkIndex]; }
+      size_t GetComprSize(size_t ChunkIndex)const
+      {
+        return m_ComprOffsets[ChunkIndex+1] - m_ComprOffsets[ChunkIndex] - UZ2_CHUNK_HEADER_SIZE;
+      }
+      
+      // Position of the data of the chunk in the package.
+      size_t GetUnComprOffset(size_t ChunkIndex)const { return m_UnComprOffsets[ChunkIndex]; }
+      size_t GetUnComprSize(size_t ChunkIndex)const { return m_UnComprOffsets[ChunkIndex+1] - m_UnComprOffsets[ChunkIndex]; }
+    
+    private:
+      std::vector<size_t> m_ComprOffsets; // NumChunks+1 entries; the last one is the size of the uz2 data.
+      std::vector<size_t> m_UnComprOffsets; // NumChunks+1 entries; the last one is the size of the package.
+  };
+  
+  
+  //==================================================
+  // Random access to the package in a uz2-file (POSIX only): A read only inflates the chunks which cover the requested
+  // range. The last decoded chunks are kept (least recently used ones are replaced), so that neighbouring reads don't
+  // inflate a chunk again.
+  // An object must only be used by one thread at a time. Exceptions are thrown in case of errors.
+  //==================================================
+  class uz2RandomAccessFile
+  {
+    public:
+      // Maps the uz2-file. If IndexFilename isn't empty, the chunk index is loaded from this sidecar file; if it
+      // doesn't exist (or doesn't match the uz2-file), the index is built and saved there.
+      explicit uz2RandomAccessFile(const std::string& Filename, const std::string& IndexFilename = std::string(), 
+          size_t NumCachedChunks = 4);
+      
+      size_t GetPackageSize()const { return m_Index.GetPackageSize(); }
+      const uz2ChunkIndex& GetIndex()const { return m_Index; }
+      
+      // Copies Length bytes beginning at Offset of the package to Target. Returns the number of copied bytes, which is
+      // less than Length at the end of the package.
+      size_t ReadAt(size_t Offset, unsigned char* Target, size_t Length);
+    
+    private:
+      uz2RandomAccessFile(const uz2RandomAccessFile&); // Not copyable.
+      uz2RandomAccessFile& operator=(const uz2RandomAccessFile&);
+      
+      // Returns the decoded chunk (from the cache, if possible).
+      const ByteVector& GetChunk(size_t ChunkIndex);
+    
+    private:
+      MappedInputFile m_File;
+      uz2ChunkIndex m_Index;
+      uz2Codec m_Codec;
+      ChunkCache m_Cache;
+  };
+  
+  // Read-only stream buffer, which decompresses the uz2 data in Source lazily: A chunk is only decompressed when
+  // the reader gets to it. Source is read sequentially from its current position and must stay valid as long as the
+  // object is used. Errors set the badbit of the reading istream (see DecompressStream.h), which rethrows them if
+  // requested by its exception mask.
+  class uz2DecompressStreamBuf : public std::streambuf
+  {
+    public:
+      explicit uz2DecompressStreamBuf(in_stream& Source);
+    
+    protected:
+      virtual int_type underflow();
+    
+    private:
+      uz2DecompressStreamBuf(const uz2DecompressStreamBuf&); // Not copyable.
+      uz2DecompressStreamBuf& operator=(const uz2DecompressStreamBuf&);
+      
+      // Reads and decompresses the next chunk into m_UnComprBuffer. Returns the size of the decompressed data (0 at the end).
+      size_t DecompressNextChunk();
+    
+    private:
+      std::streambuf& m_Source;
+      uz2Codec m_Codec;
+      ByteVector m_ComprBuffer;
+      ByteVector m_UnComprBuffer;
+  };
+}
@@ -0,0 +1,686 @@
+/*
+uz3Impl.cpp: Contains the implementation of the classes in uz3Impl.h.
+
+Language: C++
+*/
+
+#include "uz3Impl.h"
+#include "OrderedWorkers.h"
+#include "IndexedChunks.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+using namespace uzLib;
+
+
+namespace
+{
+  // The zlib header, as written by compress() (32 KiB window, default level, no dictionary), and the size of the
+  // Adler-32 at the end of the zlib stream.
+  const unsigned char ZLIB_HEADER[] = { 0x78, 0x9C };
+  const size_t ZLIB_HEADER_SIZE = sizeof(ZLIB_HEADER);
+  const size_t ZLIB_TRAILER_SIZE = 4;
+  
+  // Returns the number of bytes from the current position to the end of the stream. The size is saved in front of the
+  // compressed data, so it's taken from the stream (which must be seekable) before compressing.
+  size_t GetInputSize(in_stream& InStream)
+  {
+    InStream.clear();
+    const std::streampos StartPos = InStream.tellg();
+    if (StartPos == std::streampos(-1) || !InStream.seekg(0, std::ios::end))
+      throw std::runtime_error("Couldn't get the size of the input (the stream must be seekable).");
+    const std::streamoff InSize = InStream.tellg() - StartPos;
+    InStream.seekg(StartPos);
+    
+    if (InSize <= 0)
+      throw std::runtime_error("An empty package can't be saved in the uz3-format.");
+    if (InSize > static_cast<std::streamoff>(std::numeric_limits<int>::max()))
+      throw std::runtime_error("The package is too big for the uz3-format.");
+    return static_cast<size_t>(InSize);
+  }
+  
+  // Writes the magic number and the original size.
+  void WriteHeader(out_stream& OutStream, size_t OrigSize)
+  {
+    unsigned char Header[UZ3_HEADER_SIZE];
+    PutInt(Header, UZ3_MAGIC_NUMBER);
+    PutInt(Header + sizeof(int), static_cast<int>(OrigSize));
+    OutStream.write(reinterpret_cast<const char*>(Header), UZ3_HEADER_SIZE);
+  }
+}
+
+
+//============================================================================================================================
+// uz3Codec
+//============================================================================================================================
+
+void uzLib::uz3Codec::Compress(const SByteSpan& InData, ByteVector& OutData)
+{
+  // The decompression rejects an original size of 0 (as uz3DecompressStreamBuf).
+  if (InData.Length == 0)
+    throw std::runtime_error("An empty package can't be saved in the uz3-format.");
+  if (InData.Length > static_cast<size_t>(std::numeric_limits<int>::max()))
+    throw std::runtime_error("The package is too big for the uz3-format.");
+  
+  // Write the magic number and the original size, followed by the compressed data.
+  uLongf ComprSize = DeflateStream::GetBound(InData.Length);
+  OutData.resize(UZ3_HEADER_SIZE + ComprSize);
+  PutInt(&OutData[0], UZ3_MAGIC_NUMBER);
+  PutInt(&OutData[sizeof(int)], static_cast<int>(InData.Length));
+  
+  const int StatusCode = m_Deflate.Compress(&OutData[UZ3_HEADER_SIZE], &ComprSize, InData.Data, 
+      static_cast<uLong>(InData.Length));
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't compress the uz3 data", StatusCode);
+  
+  OutData.resize(UZ3_HEADER_SIZE + ComprSize);
+}
+
+void uzLib::uz3Codec::Decompress(const SByteSpan& InData, ByteVector& OutData)
+{
+  if (InData.Length < UZ3_HEADER_SIZE || GetInt(InData.Data) != UZ3_MAGIC_NUMBER)
+    throw std::runtime_error("Input is not a valid uz3 file.");
+  
+  const int OrigSize = GetInt(InData.Data + sizeof(int));
+  if (OrigSize <= 0)
+    throw std::runtime_error("The read value for the uncompressed filesize is invalid.");
+  
+  OutData.resize(OrigSize);
+  uLongf RealOrigSize = static_cast<uLongf>(OrigSize);
+  const int StatusCode = m_Inflate.Decompress(&OutData[0], &RealOrigSize, InData.Data + UZ3_HEADER_SIZE, 
+      static_cast<uLong>(InData.Length - UZ3_HEADER_SIZE));
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't decompress the uz3 data", StatusCode);
+  else if (RealOrigSize != static_cast<uLongf>(OrigSize))
+    throw std::runtime_error("The decompressed file has a different size than the saved filesize. Damaged file?");
+}
+
+
+void uzLib::uz3Codec::Compress(in_stream& InStream, out_stream& OutStream)
+{
+  OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+  
+  const size_t InSize = GetInputSize(InStream);
+  WriteHeader(OutStream, InSize);
+  
+  m_InWindow.resize(UZ3_WINDOW_SIZE);
+  m_OutWindow.resize(UZ3_WINDOW_SIZE);
+  
+  int StatusCode = m_Deflate.Reset();
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't initialize the uz3 compression", StatusCode);
+  z_stream& ZStream = m_Deflate.GetZStream();
+  ZStream.avail_in = 0;
+  
+  // Deflate window by window; the last one finishes the zlib stream. The output doesn't depend on the windows.
+  std::streambuf& Source = *InStream.rdbuf();
+  size_t RemainingBytes = InSize;
+  do
+  {
+    if (ZStream.avail_in == 0 && RemainingBytes > 0)
+    {
+      const std::streamsize ReadCount = Source.sgetn(reinterpret_cast<char*>(&m_InWindow[0]), 
+          static_cast<std::streamsize>(std::min(RemainingBytes, m_InWindow.size())));
+      if (ReadCount <= 0)
+        throw std::runtime_error("The input ended before its size was reached.");
+      
+      ZStream.next_in = &m_InWindow[0];
+      ZStream.avail_in = static_cast<uInt>(ReadCount);
+      RemainingBytes -= static_cast<size_t>(ReadCount);
+    }
+    
+    ZStream.next_out = &m_OutWindow[0];
+    ZStream.avail_out = static_cast<uInt>(m_OutWindow.size());
+    StatusCode = deflate(&ZStream, RemainingBytes == 0 ? Z_FINISH : Z_NO_FLUSH);
+    if (StatusCode != Z_OK && StatusCode != Z_STREAM_END && StatusCode != Z_BUF_ERROR)
+      ThrowZlibError("Couldn't compress the uz3 data", StatusCode);
+    
+    OutStream.write(reinterpret_cast<const char*>(&m_OutWindow[0]), m_OutWindow.size() - ZStream.avail_out);
+  } while (StatusCode != Z_STREAM_END);
+}
+
+
+void uzLib::uz3Codec::Decompress(in_stream& InStream, out_stream& OutStream)
+{
+  OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+  
+  // Read the magic number and the original size.
+  std::streambuf& Source = *InStream.rdbuf();
+  unsigned char Header[UZ3_HEADER_SIZE];
+  if (Source.sgetn(reinterpret_cast<char*>(Header), UZ3_HEADER_SIZE) != static_cast<std::streamsize>(UZ3_HEADER_SIZE) ||
+      GetInt(Header) != UZ3_MAGIC_NUMBER)
+    throw std::runtime_error("Input is not a valid uz3 file.");
+  
+  const int OrigSize = GetInt(Header + sizeof(int));
+  if (OrigSize <= 0)
+    throw std::runtime_error("The read value for the uncompressed filesize is invalid.");
+  
+  m_InWindow.resize(UZ3_WINDOW_SIZE);
+  m_OutWindow.resize(UZ3_WINDOW_SIZE);
+  
+  int StatusCode = m_Inflate.Reset();
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't initialize the uz3 decompression", StatusCode);
+  z_stream& ZStream = m_Inflate.GetZStream();
+  ZStream.avail_in = 0;
+  
+  // Inflate window by window until the end of the zlib stream.
+  do
+  {
+    if (ZStream.avail_in == 0)
+    {
+      const std::streamsize ReadCount = Source.sgetn(reinterpret_cast<char*>(&m_InWindow[0]), m_InWindow.size());
+      if (ReadCount <= 0)
+        throw std::runtime_error("The uz3 data ends too early. Damaged file?");
+      
+      ZStream.next_in = &m_InWindow[0];
+      ZStream.avail_in = static_cast<uInt>(ReadCount);
+    }
+    
+    ZStream.next_out = &m_OutWindow[0];
+    ZStream.avail_out = static_cast<uInt>(m_OutWindow.size());
+    StatusCode = inflate(&ZStream, Z_NO_FLUSH);
+    if (StatusCode != Z_OK && StatusCode != Z_STREAM_END)
+      ThrowZlibError("Couldn't decompress the uz3 data", StatusCode == Z_NEED_DICT ? Z_DATA_ERROR : StatusCode);
+    
+    if (ZStream.total_out > static_cast<uLong>(OrigSize))
+      throw std::runtime_error("The decompressed file is bigger than the saved filesize. Damaged file?");
+    
+    OutStream.write(reinterpret_cast<const char*>(&m_OutWindow[0]), m_OutWindow.size() - ZStream.avail_out);
+  } while (StatusCode != Z_STREAM_END);
+  
+  if (ZStream.total_out != static_cast<uLong>(OrigSize))
+    throw std::runtime_error("The decompressed file has a different size than the saved filesize. Damaged file?");
+}
+
+
+//-----------------------------------------------------------------------------------------
+// Parallel compression
+//-----------------------------------------------------------------------------------------
+
+namespace
+{
+  const size_t UZ3_DICTIONARY_SIZE = 0x8000; // Size of the deflate window.
+  
+  // Block of the parallel compression.
+  struct SUz3BlockSlot
+  {
+    ByteVector Dictionary; // The last UZ3_DICTIONARY_SIZE bytes of the previous block (empty at a flush point).
+    ByteVector InData; // UZ3_PARALLEL_BLOCK_SIZE bytes.
+    size_t InLength;
+    size_t InOffset; // Position of the block in the package.
+    bool bFlushPoint; // The first block or one at a flush point.
+    bool bLast;
+    ByteVector OutData; // Raw deflate data.
+    size_t OutLength;
+    uLong Adler; // Adler-32 of the block.
+    
+    SUz3BlockSlot(): InData(UZ3_PARALLEL_BLOCK_SIZE), InLength(0), InOffset(0), bFlushPoint(false), bLast(false), OutLength(0), Adler(0)
+    { }
+  };
+  
+  // Deflates the blocks of one worker thread with its own raw deflate stream. Each block (except the last one) ends with
+  // a sync flush, i.e. on a byte boundary and without the final-block bit, so that the blocks can simply be appended.
+  class Uz3BlockWorker
+  {
+    public:
+      Uz3BlockWorker(): m_Deflate(true)
+      { }
+      
+      void Process(SUz3BlockSlot& Slot)
+      {
+        int StatusCode = m_Deflate.Reset();
+        z_stream& ZStream = m_Deflate.GetZStream();
+        if (StatusCode == Z_OK && !Slot.Dictionary.empty())
+          StatusCode = deflateSetDictionary(&ZStream, &Slot.Dictionary[0], static_cast<uInt>(Slot.Dictionary.size()));
+        if (StatusCode != Z_OK)
+          ThrowZlibError("Couldn't initialize the uz3 compression", StatusCode);
+        
+        // Room for the worst case (plus the sync flush marker), so that a single call is enough.
+        const size_t MinOutSize = deflateBound(&ZStream, static_cast<uLong>(Slot.InLength)) + 16;
+        if (Slot.OutData.size() < MinOutSize)
+          Slot.OutData.resize(MinOutSize);
+        
+        ZStream.next_in = &Slot.InData[0];
+        ZStream.avail_in = static_cast<uInt>(Slot.InLength);
+        Slot.OutLength = 0;
+        for (;;)
+        {
+          ZStream.next_out = &Slot.OutData[Slot.OutLength];
+          ZStream.avail_out = static_cast<uInt>(Slot.OutData.size() - Slot.OutLength);
+          StatusCode = deflate(&ZStream, Slot.bLast ? Z_FINISH : Z_SYNC_FLUSH);
+          if (StatusCode != Z_OK && StatusCode != Z_STREAM_END && StatusCode != Z_BUF_ERROR)
+            ThrowZlibError("Couldn't compress the uz3 data", StatusCode);
+          Slot.OutLength = Slot.OutData.size() - ZStream.avail_out;
+          
+          // The block is complete if the stream ended (last block) or if output space is left (sync flush).
+          if (StatusCode == Z_STREAM_END || (!Slot.bLast && ZStream.avail_out > 0))
+            break;
+          else if (ZStream.avail_out > 0)
+            ThrowZlibError("Couldn't compress the uz3 data", StatusCode);
+          Slot.OutData.resize(Slot.OutData.size() * 2);
+        }
+        
+        Slot.Adler = adler32(adler32(0, NULL, 0), &Slot.InData[0], static_cast<uInt>(Slot.InLength));
+      }
+    
+    private:
+      DeflateStream m_Deflate;
+  };
+}
+
+void uzLib::CompressToUz3Parallel(in_stream& InStream, out_stream& OutStream, unsigned int NumThreads, 
+    unsigned int FlushIntervalMiB, uz3FlushIndex* pIndex)
+{
+  if (NumThreads == 0)
+    NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  
+  OutStream.exceptions(std::ios::badbit | std::ios::failbit);
+  
+  const size_t InSize = GetInputSize(InStream);
+  WriteHeader(OutStream, InSize);
+  OutStream.write(reinterpret_cast<const char*>(ZLIB_HEADER), ZLIB_HEADER_SIZE);
+  
+  // A MiB is a multiple of the block size, so the flush points are always at the beginning of a block.
+  const size_t FlushInterval = static_cast<size_t>(FlushIntervalMiB) * 0x100000;
+  if (pIndex != NULL)
+    pIndex->Clear();
+  
+  // The calling thread reads ahead into the free slots and writes the deflated blocks in order.
+  std::streambuf& Source = *InStream.rdbuf();
+  size_t RemainingBytes = InSize;
+  size_t ComprOffset = UZ3_HEADER_SIZE + ZLIB_HEADER_SIZE;
+  ByteVector Dictionary;
+  uLong Adler = adler32(0, NULL, 0);
+  OrderedWorkers<SUz3BlockSlot, Uz3BlockWorker> Workers(NumThreads, NumThreads * UZ3_SLOTS_PER_THREAD);
+  Workers.Run([&](SUz3BlockSlot& Slot)
+  {
+    if (RemainingBytes == 0)
+      return false;
+    
+    Slot.InOffset = InSize - RemainingBytes;
+    Slot.InLength = std::min(RemainingBytes, UZ3_PARALLEL_BLOCK_SIZE);
+    if (Source.sgetn(reinterpret_cast<char*>(&Slot.InData[0]), Slot.InLength) != static_cast<std::streamsize>(Slot.InLength))
+      throw std::runtime_error("The input ended before its size was reached.");
+    RemainingBytes -= Slot.InLength;
+    Slot.bLast = RemainingBytes == 0;
+    
+    Slot.bFlushPoint = Slot.InOffset == 0 || (FlushInterval > 0 && Slot.InOffset % FlushInterval == 0);
+    if (Slot.bFlushPoint)
+      Slot.Dictionary.clear();
+    else
+      Slot.Dictionary = Dictionary;
+    const size_t DictionarySize = std::min(Slot.InLength, UZ3_DICTIONARY_SIZE);
+    Dictionary.assign(Slot.InData.begin() + (Slot.InLength - DictionarySize), Slot.InData.begin() + Slot.InLength);
+    return true;
+  },
+  [&](SUz3BlockSlot& Slot)
+  {
+    if (Slot.bFlushPoint && pIndex != NULL)
+      pIndex->AddFlushPoint(ComprOffset, Slot.InOffset);
+    
+    OutStream.write(reinterpret_cast<const char*>(&Slot.OutData[0]), Slot.OutLength);
+    ComprOffset += Slot.OutLength;
+    Adler = adler32_combine(Adler, Slot.Adler, static_cast<z_off_t>(Slot.InLength));
+  });
+  
+  if (pIndex != NULL)
+    pIndex->AddFlushPoint(ComprOffset, InSize);
+  
+  // The Adler-32 of the complete data ends the zlib stream (big-endian).
+  const unsigned char Trailer[ZLIB_TRAILER_SIZE] = { static_cast<unsigned char>(Adler >> 24), static_cast<unsigned char>(Adler >> 16), 
+      static_cast<unsigned char>(Adler >> 8), static_cast<unsigned char>(Adler) };
+  OutStream.write(reinterpret_cast<const char*>(Trailer), sizeof(Trailer));
+}
+
+
+//-----------------------------------------------------------------------------------------
+// Parallel decompression
+//-----------------------------------------------------------------------------------------
+
+namespace
+{
+  // Checks the uz3 header and the zlib header behind it (deflate with max. 32 KiB window and no preset dictionary) and
+  // returns the size of the package.
+  size_t CheckHeaders(const SByteSpan& Uz3Data)
+  {
+    if (Uz3Data.Length < UZ3_HEADER_SIZE || GetInt(Uz3Data.Data) != UZ3_MAGIC_NUMBER)
+      throw std::runtime_error("Input is not a valid uz3 file.");
+    
+    const int OrigSize = GetInt(Uz3Data.Data + sizeof(int));
+    if (OrigSize <= 0)
+      throw std::runtime_error("The read value for the uncompressed filesize is invalid.");
+    
+    if (Uz3Data.Length < UZ3_HEADER_SIZE + ZLIB_HEADER_SIZE + ZLIB_TRAILER_SIZE)
+      throw std::runtime_error("The uz3 data ends too early. Damaged file?");
+    
+    const unsigned int CMF = Uz3Data.Data[UZ3_HEADER_SIZE];
+    const unsigned int FLG = Uz3Data.Data[UZ3_HEADER_SIZE + 1];
+    if ((CMF & 0x0F) != Z_DEFLATED || (CMF >> 4) > 7 || (FLG & 0x20) != 0 || ((CMF << 8) | FLG) % 31 != 0)
+      throw std::runtime_error("The uz3 data doesn't begin with a valid zlib header. Damaged file?");
+    
+    return static_cast<size_t>(OrigSize);
+  }
+  
+  // Fills the index from the sidecar file IndexFilename (if not empty and matching the uz3 data), else with a single
+  // region (see uz3FlushIndex::Build).
+  void LoadFlushIndex(uz3FlushIndex& Index, const SByteSpan& Uz3Data, const std::string& IndexFilename)
+  {
+    Index.Build(Uz3Data);
+    const size_t PackageSize = Index.GetPackageSize();
+    if (!IndexFilename.empty() && Index.Load(IndexFilename, Uz3Data.Length) && Index.GetPackageSize() != PackageSize)
+      Index.Build(Uz3Data); // A stale or foreign index: Inflate on one thread.
+  }
+  
+  // Inflates the raw deflate data of the region into Target, which holds the data of the region. Only the last region
+  // ends with the final deflate block; the others end at a flush point.
+  void InflateRegion(InflateStream& Inflate, const SByteSpan& Uz3Data, const uz3FlushIndex& Index, size_t RegionIndex, 
+      unsigned char* Target)
+  {
+    int StatusCode = Inflate.Reset();
+    if (StatusCode != Z_OK)
+      ThrowZlibError("Couldn't initialize the uz3 decompression", StatusCode);
+    
+    z_stream& ZStream = Inflate.GetZStream();
+    ZStream.next_in = const_cast<unsigned char*>(Uz3Data.Data + Index.GetComprOffset(RegionIndex));
+    ZStream.avail_in = static_cast<uInt>(Index.GetComprSize(RegionIndex));
+    ZStream.next_out = Target;
+    ZStream.avail_out = static_cast<uInt>(Index.GetUnComprSize(RegionIndex));
+    
+    StatusCode = inflate(&ZStream, Z_SYNC_FLUSH);
+    if (StatusCode != Z_OK && StatusCode != Z_STREAM_END && StatusCode != Z_BUF_ERROR)
+      ThrowZlibError("Couldn't decompress the uz3 data", StatusCode);
+    
+    const bool bLastRegion = RegionIndex + 1 == Index.GetNumRegions();
+    if (ZStream.avail_in > 0 || ZStream.avail_out > 0 || (StatusCode == Z_STREAM_END) != bLastRegion)
+      throw std::runtime_error("A region of the uz3 data doesn't match the flush index. Damaged file?");
+  }
+  
+  // Inflater of the raw deflate data of a region, default-constructible for ProcessIndicesParallel.
+  class RawInflateStream: public InflateStream
+  {
+    public:
+      RawInflateStream(): InflateStream(true) { }
+  };
+  
+  // Inflates the regions into Target on NumThreads threads (the calling one included, see ProcessIndicesParallel) and
+  // saves the Adler-32 of each region in Adlers.
+  void InflateRegionsParallel(const SByteSpan& Uz3Data, const uz3FlushIndex& Index, unsigned char* Target, 
+      unsigned int NumThreads, std::vector<uLong>& Adlers)
+  {
+    ProcessIndicesParallel<RawInflateStream>(Index.GetNumRegions(), NumThreads, 
+        [&](InflateStream& Inflate, size_t CurIndex)
+    {
+      unsigned char* const pRegion = Target + Index.GetUnComprOffset(CurIndex);
+      InflateRegion(Inflate, Uz3Data, Index, CurIndex, pRegion);
+      Adlers[CurIndex] = adler32(adler32(0, NULL, 0), pRegion, static_cast<uInt>(Index.GetUnComprSize(CurIndex)));
+    });
+  }
+}
+
+void uzLib::DecompressFileFromUz3Parallel(const std::string& InFilename, const std::string& IndexFilename, 
+    const std::string& OutFilename, unsigned int NumThreads)
+{
+  if (NumThreads == 0)
+    NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  
+  const MappedInputFile InFile(InFilename);
+  const SByteSpan InData(InFile.GetData(), InFile.GetSize());
+  
+  uz3FlushIndex Index;
+  LoadFlushIndex(Index, InData, IndexFilename);
+  
+  const size_t PackageSize = Index.GetPackageSize();
+  MappedOutputFile OutFile(OutFilename, PackageSize);
+  std::vector<uLong> Adlers(Index.GetNumRegions());
+  InflateRegionsParallel(InData, Index, OutFile.Extend(PackageSize), NumThreads, Adlers);
+  
+  // Combine the checksums of the regions and compare them with the one at the end of the zlib stream (big-endian).
+  uLong Adler = adler32(0, NULL, 0);
+  for (size_t CurIndex = 0; CurIndex < Adlers.size(); ++CurIndex)
+    Adler = adler32_combine(Adler, Adlers[CurIndex], static_cast<z_off_t>(Index.GetUnComprSize(CurIndex)));
+  
+  const unsigned char* const pTrailer = InData.Data + InData.Length - ZLIB_TRAILER_SIZE;
+  const uLong SavedAdler = (static_cast<uLong>(pTrailer[0]) << 24) | (static_cast<uLong>(pTrailer[1]) << 16) | 
+      (static_cast<uLong>(pTrailer[2]) << 8) | pTrailer[3];
+  if (Adler != SavedAdler)
+    throw std::runtime_error("The checksum of the decompressed file is wrong. Damaged file?");
+  
+  OutFile.Close();
+}
+
+
+//-----------------------------------------------------------------------------------------
+// Buffer functions: Each thread has its own codec.
+//-----------------------------------------------------------------------------------------
+
+void uzLib::CompressBufferToUz3(const SByteSpan& InData, ByteVector& OutData)
+{
+  GetThreadCodec<uz3Codec>().Compress(InData, OutData);
+}
+
+void uzLib::DecompressBufferFromUz3(const SByteSpan& InData, ByteVector& OutData)
+{
+  GetThreadCodec<uz3Codec>().Decompress(InData, OutData);
+}
+
+void uzLib::CompressToUz3(in_stream& InStream, out_stream& OutStream)
+{
+  GetThreadCodec<uz3Codec>().Compress(InStream, OutStream);
+}
+
+void uzLib::DecompressFromUz3(in_stream& InStream, out_stream& OutStream)
+{
+  GetThreadCodec<uz3Codec>().Decompress(InStream, OutStream);
+}
+
+
+//============================================================================================================================
+// uz3FlushIndex
+//============================================================================================================================
+
+namespace
+{
+  // Sidecar file (see IndexedChunks.h) with the size of the uz3 data and one entry per flush point: Its position in the
+  // uz3 data and in the package (8 bytes each).
+  const uint32_t UZ3_INDEX_MAGIC_NUMBER = 0x49335A55; // "UZ3I"
+  const uint32_t UZ3_INDEX_VERSION = 1;
+  const size_t UZ3_INDEX_ENTRY_SIZE = 2*sizeof(uint64_t);
+}
+
+void uzLib::uz3FlushIndex::Build(const SByteSpan& Uz3Data)
+{
+  const size_t PackageSize = CheckHeaders(Uz3Data);
+  Clear();
+  AddFlushPoint(UZ3_HEADER_SIZE + ZLIB_HEADER_SIZE, 0);
+  AddFlushPoint(Uz3Data.Length - ZLIB_TRAILER_SIZE, PackageSize);
+}
+
+void uzLib::uz3FlushIndex::Clear()
+{
+  m_ComprOffsets.clear();
+  m_UnComprOffsets.clear();
+}
+
+void uzLib::uz3FlushIndex::AddFlushPoint(size_t ComprOffset, size_t UnComprOffset)
+{
+  m_ComprOffsets.push_back(ComprOffset);
+  m_UnComprOffsets.push_back(UnComprOffset);
+}
+
+void uzLib::uz3FlushIndex::Save(const std::string& Filename)const
+{
+  if (GetNumRegions() == 0)
+    throw std::runtime_error("The uz3 flush index is empty.");
+  
+  ByteVector Data = BeginIndexFile(UZ3_INDEX_MAGIC_NUMBER, UZ3_INDEX_VERSION, m_ComprOffsets.back() + ZLIB_TRAILER_SIZE, 
+      m_ComprOffsets.size(), UZ3_INDEX_ENTRY_SIZE);
+  for (size_t CurIndex = 0; CurIndex < m_ComprOffsets.size(); ++CurIndex)
+  {
+    AppendValue<uint64_t>(Data, m_ComprOffsets[CurIndex]);
+    AppendValue<uint64_t>(Data, m_UnComprOffsets[CurIndex]);
+  }
+  
+  SaveIndexFile(Filename, Data, "uz3");
+}
+
+bool uzLib::uz3FlushIndex::Load(const std::string& Filename, size_t Uz3Size)
+{
+  ByteVector Data;
+  size_t Pos;
+  uint32_t NumFlushPoints = 0;
+  if (!LoadIndexFile(Filename, UZ3_INDEX_MAGIC_NUMBER, UZ3_INDEX_VERSION, Uz3Size, UZ3_INDEX_ENTRY_SIZE, Data, Pos, 
+      NumFlushPoints) || NumFlushPoints < 2)
+    return false;
+  
+  // The first region begins behind the zlib header and the last one ends in front of the Adler-32; each region holds
+  // data.
+  std::vector<size_t> ComprOffsets;
+  std::vector<size_t> UnComprOffsets;
+  ComprOffsets.reserve(NumFlushPoints);
+  UnComprOffsets.reserve(NumFlushPoints);
+  for (uint32_t CurIndex = 0; CurIndex < NumFlushPoints; ++CurIndex)
+  {
+    const uint64_t ComprOffset = ReadValue<uint64_t>(Data, Pos);
+    const uint64_t UnComprOffset = ReadValue<uint64_t>(Data, Pos);
+    if (CurIndex == 0 ? (ComprOffset != UZ3_HEADER_SIZE + ZLIB_HEADER_SIZE || UnComprOffset != 0) : 
+        (ComprOffset <= ComprOffsets.back() || UnComprOffset <= UnComprOffsets.back()))
+      return false;
+    
+    ComprOffsets.push_back(static_cast<size_t>(ComprOffset));
+    UnComprOffsets.push_back(static_cast<size_t>(UnComprOffset));
+  }
+  
+  if (ComprOffsets.back() + ZLIB_TRAILER_SIZE != Uz3Size)
+    return false;
+  
+  m_ComprOffsets.swap(ComprOffsets);
+  m_UnComprOffsets.swap(UnComprOffsets);
+  return true;
+}
+
+size_t uzLib::uz3FlushIndex::FindRegion(size_t Offset)const
+{
+  // The first region which begins behind Offset follows the searched one.
+  return std::upper_bound(m_UnComprOffsets.begin(), m_UnComprOffsets.end(), Offset) - m_UnComprOffsets.begin() - 1;
+}
+
+
+//============================================================================================================================
+// uz3RandomAccessFile
+//============================================================================================================================
+
+uzLib::uz3RandomAccessFile::uz3RandomAccessFile(const std::string& Filename, const std::string& IndexFilename, 
+    size_t NumCachedRegions):
+  m_File(Filename, false), m_Inflate(true), m_Cache(NumCachedRegions)
+{
+  LoadFlushIndex(m_Index, SByteSpan(m_File.GetData(), m_File.GetSize()), IndexFilename);
+}
+
+size_t uzLib::uz3RandomAccessFile::ReadAt(size_t Offset, unsigned char* Target, size_t Length)
+{
+  if (Offset >= GetPackageSize())
+    return 0;
+  Length = std::min(Length, GetPackageSize() - Offset);
+  
+  size_t NumCopied = 0;
+  for (size_t RegionIndex = m_Index.FindRegion(Offset); NumCopied < Length; ++RegionIndex)
+  {
+    const ByteVector& Region = GetRegion(RegionIndex);
+    const size_t PosInRegion = Offset + NumCopied - m_Index.GetUnComprOffset(RegionIndex);
+    const size_t Count = std::min(Region.size() - PosInRegion, Length - NumCopied);
+    memcpy(Target + NumCopied, &Region[PosInRegion], Count);
+    NumCopied += Count;
+  }
+  
+  return NumCopied;
+}
+
+const ByteVector& uzLib::uz3RandomAccessFile::GetRegion(size_t RegionIndex)
+{
+  return m_Cache.Get(RegionIndex, m_Index.GetUnComprSize(RegionIndex), [&](unsigned char* Target)
+  {
+    InflateRegion(m_Inflate, SByteSpan(m_File.GetData(), m_File.GetSize()), m_Index, RegionIndex, Target);
+  });
+}
+
+
+//============================================================================================================================
+// uz3DecompressStreamBuf
+//============================================================================================================================
+
+uzLib::uz3DecompressStreamBuf::uz3DecompressStreamBuf(in_stream& Source):
+    m_Source(*Source.rdbuf()), m_OrigSize(0), m_bEnd(false), m_InBuffer(UZ3_WINDOW_SIZE), m_OutBuffer(UZ3_WINDOW_SIZE)
+{
+  // Read the magic number and the original size.
+  unsigned char Header[UZ3_HEADER_SIZE];
+  if (m_Source.sgetn(reinterpret_cast<char*>(Header), UZ3_HEADER_SIZE) != static_cast<std::streamsize>(UZ3_HEADER_SIZE) ||
+      GetInt(Header) != UZ3_MAGIC_NUMBER)
+    throw std::runtime_error("Input is not a valid uz3 file.");
+  
+  const int OrigSize = GetInt(Header + sizeof(int));
+  if (OrigSize <= 0)
+    throw std::runtime_error("The read value for the uncompressed filesize is invalid.");
+  m_OrigSize = OrigSize;
+  
+  memset(&m_ZStream, 0, sizeof(m_ZStream));
+  const int StatusCode = inflateInit(&m_ZStream);
+  if (StatusCode != Z_OK)
+    ThrowZlibError("Couldn't initialize the uz3 decompression", StatusCode);
+}
+
+uzLib::uz3DecompressStreamBuf::~uz3DecompressStreamBuf()
+{
+  inflateEnd(&m_ZStream);
+}
+
+uzLib::uz3DecompressStreamBuf::int_type uzLib::uz3DecompressStreamBuf::underflow()
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  
+  if (m_bEnd)
+    return traits_type::eof();
+  
+  // Inflate until the output buffer contains something (or the end of the zlib stream is reached).
+  m_ZStream.next_out = &m_OutBuffer[0];
+  m_ZStream.avail_out = static_cast<uInt>(m_OutBuffer.size());
+  while (m_ZStream.avail_out == m_OutBuffer.size())
+  {
+    if (m_ZStream.avail_in == 0)
+    {
+      const std::streamsize ReadCount = m_Source.sgetn(reinterpret_cast<char*>(&m_InBuffer[0]), m_InBuffer.size());
+      if (ReadCount <= 0)
+        throw std::runtime_error("The uz3 data ends too early. Damaged file?");
+      
+      m_ZStream.next_in = &m_InBuffer[0];
+      m_ZStream.avail_in = static_cast<uInt>(ReadCount);
+    }
+    
+    const int StatusCode = inflate(&m_ZStream, Z_NO_FLUSH);
+    if (StatusCode == Z_STREAM_END)
+    {
+      if (m_ZStream.total_out != m_OrigSize)
+        throw std::runtime_error("The decompressed file has a different size than the saved filesize. Damaged file?");
+      m_bEnd = true;
+      break;
+    }
+    else if (StatusCode != Z_OK)
+      ThrowZlibError("Couldn't decompress the uz3 data", StatusCode);
+    else if (m_ZStream.total_out > m_OrigSize)
+      throw std::runtime_error("The decompressed file is bigger than the saved filesize. Damaged file?");
+  }
+  
+  const size_t Count = m_OutBuffer.size() - m_ZStream.avail_out;
+  if (Count == 0)
+    return traits_type::eof();
+  
+  char* const pBuffer = reinterpret_cast<char*>(&m_OutBuffer[0]);
+  setg(pBuffer, pBuffer, pBuffer + Count);
+  return traits_type::to_int_type(*gptr());
+}
@@ -0,0 +1,214 @@
+/*
+uz3Impl.h: Contains the native (standard C++) classes for the uz3-format.
+
+Language: C++
+*/
+
+#pragma once
+
+#include "uz1Impl.h"
+#include "ZlibStream.h"
+#include "FileMapping.h"
+#include "IndexedChunks.h"
+
+
+//===========================================================================
+// The uz3-format begins with the magic number UZ3_MAGIC_NUMBER and the size
+// of the original file (both 4-byte ints), followed by the output of zlib's
+// compress() function for the complete file. See also uz3Lib in uzLib.h.
+//===========================================================================
+namespace uzLib
+{
+  const int UZ3_MAGIC_NUMBER = 0x0000162E; // Every uz3 package begins with this number.
+  const size_t UZ3_HEADER_SIZE = 2*sizeof(int); // Magic number and original size.
+  
+  // Compresses the complete package in InData to the uz3-format (same output as uz3Lib::CompressFile) and saves the
+  // result in OutData. Exceptions are thrown in case of errors (derived from std::exception).
+  void CompressBufferToUz3(const SByteSpan& InData, ByteVector& OutData);
+  
+  // Decompresses the complete uz3 data in InData and saves the package in OutData. A std::runtime_error is thrown if
+  // the data is invalid.
+  void DecompressBufferFromUz3(const SByteSpan& InData, ByteVector& OutData);
+  
+  // Compresses the data in InStream (from its current position to the end) to the uz3-format and writes it to OutStream
+  // while it is compressed; the output is the same as the one of CompressBufferToUz3. Only 2 windows of
+  // UZ3_WINDOW_SIZE bytes are used, independent of the size of the package. The size is written in front of the data, so
+  // InStream must be seekable. OutStream will have its exceptions-flags set for the fail and bad-bits. Exceptions are
+  // thrown in case of errors (derived from std::exception).
+  const size_t UZ3_WINDOW_SIZE = 0x10000;
+  void CompressToUz3(in_stream& InStream, out_stream& OutStream);
+  
+  // Decompresses the uz3 data in InStream (from its current position) and writes the package to OutStream while it
+  // is inflated, using 2 windows of UZ3_WINDOW_SIZE bytes (independent of the size of the package). The length of the
+  // package is checked against the size in the header; more data than announced is rejected before it's written.
+  // OutStream will have its exceptions-flags set for the fail and bad-bits. Exceptions are thrown in case of errors
+  // (derived from std::exception); OutStream contains the data up to the error then.
+  void DecompressFromUz3(in_stream& InStream, out_stream& OutStream);
+  
+  class uz3FlushIndex;
+  
+  // Same as CompressToUz3, but the data is split into blocks of UZ3_PARALLEL_BLOCK_SIZE bytes, which are deflated by
+  // NumThreads worker threads (0: one per core) with the previous 32 KiB as dictionary (as pigz does). The blocks are
+  // joined into a single standard zlib stream (the Adler-32 checksums of the blocks are combined), which can be
+  // decompressed with uncompress() and thus by the games. The output is slightly bigger than (and not the same as) the
+  // one of CompressToUz3. At most UZ3_SLOTS_PER_THREAD blocks per thread are held in memory.
+  // If FlushIntervalMiB isn't 0, a flush point is inserted every FlushIntervalMiB MiB of the package: The block there
+  // doesn't use the previous data as dictionary (same as a Z_FULL_FLUSH), so inflating can start at it. The flush
+  // points are saved in *pIndex (if not NULL), which can be written to a sidecar file for
+  // DecompressFileFromUz3Parallel and uz3RandomAccessFile.
+  const size_t UZ3_PARALLEL_BLOCK_SIZE = 0x20000;
+  const size_t UZ3_SLOTS_PER_THREAD = 4;
+  void CompressToUz3Parallel(in_stream& InStream, out_stream& OutStream, unsigned int NumThreads = 0, 
+      unsigned int FlushIntervalMiB = 0, uz3FlushIndex* pIndex = NULL);
+  
+  // Decompresses the uz3-file InFilename into OutFilename (POSIX only). The flush index is loaded from the sidecar file
+  // IndexFilename and the regions between the flush points are inflated on NumThreads threads (0: one per core)
+  // directly into the mapped output file; the Adler-32 of the package is checked at the end. Without a (matching)
+  // index, the file is inflated on one thread.
+  // A std::runtime_error is thrown if a file can't be opened or mapped or if the data is invalid (the output file is
+  // left incomplete then).
+  void DecompressFileFromUz3Parallel(const std::string& InFilename, const std::string& IndexFilename, 
+      const std::string& OutFilename, unsigned int NumThreads = 0);
+  
+  
+  //==================================================
+  // Reusable uz3 compression/decompression context: The deflate and the inflate state are kept between files instead of
+  // initializing zlib for every file. The buffer functions above use one codec per thread.
+  // An object must only be used by one thread at a time. Exceptions are thrown in case of errors.
+  //==================================================
+  class uz3Codec
+  {
+    public:
+      uz3Codec() { }
+      
+      // Same as CompressBufferToUz3 and DecompressBufferFromUz3.
+      void Compress(const SByteSpan& InData, ByteVector& OutData);
+      void Decompress(const SByteSpan& InData, ByteVector& OutData);
+      
+      // Same as CompressToUz3 and DecompressFromUz3.
+      void Compress(in_stream& InStream, out_stream& OutStream);
+      void Decompress(in_stream& InStream, out_stream& OutStream);
+    
+    private:
+      uz3Codec(const uz3Codec&); // Not copyable.
+      uz3Codec& operator=(const uz3Codec&);
+    
+    private:
+      DeflateStream m_Deflate;
+      InflateStream m_Inflate;
+      ByteVector m_InWindow;
+      ByteVector m_OutWindow;
+  };
+  
+  //==================================================
+  // Flush points of a uz3-file written by CompressToUz3Parallel: Inflating (raw deflate data) can start at each of them,
+  // so the regions between them can be inflated independently. Each flush point is the position in the uz3 data and
+  // the one in the package; the last one marks the end of the deflate data (the position of the Adler-32) and of the
+  // package. The index can be saved to a small sidecar file (16 bytes per flush point).
+  //==================================================
+  class uz3FlushIndex
+  {
+    public:
+      uz3FlushIndex() { }
+      
+      // Creates the index without flush points: A single region with all of the deflate data. A std::runtime_error is
+      // thrown if the headers are invalid.
+      void Build(const SByteSpan& Uz3Data);
+      
+      // Used by CompressToUz3Parallel.
+      void Clear();
+      void AddFlushPoint(size_t ComprOffset, size_t UnComprOffset);
+      
+      // Saves the index to the sidecar file. A std::runtime_error is thrown if the file can't be written.
+      void Save(const std::string& Filename)const;
+      
+      // Loads the index from the sidecar file. Returns false (and leaves the index unchanged) if the file doesn't
+      // exist, is damaged or belongs to uz3 data of another size than Uz3Size (e.g. the uz3-file was replaced).
+      bool Load(const std::string& Filename, size_t Uz3Size);
+      
+      size_t GetNumRegions()const { return m_ComprOffsets.empty() ? 0 : m_ComprOffsets.size() - 1; }
+      size_t GetPackageSize()const { return m_UnComprOffsets.empty() ? 0 : m_UnComprOffsets.back(); }
+      
+      // Returns the index of the region which contains the byte at Offset (< GetPackageSize()) of the package.
+      size_t FindRegion(size_t Offset)const;
+      
+      // Position of the deflate data of the region in the uz3 data.
+      size_t GetComprOffset(size_t RegionIndex)const { return m_ComprOffsets[RegionIndex]; }
+      size_t GetComprSize(size_t RegionIndex)const { return m_ComprOffsets[RegionIndex+1] - m_ComprOffsets[RegionIndex]; }
+      
+      // Position of the data of the region in the package.
+      size_t GetUnComprOffset(size_t RegionIndex)const { return m_UnComprOffsets[RegionIndex]; }
+      size_t GetUnComprSize(size_t RegionIndex)const
+      {
+        return m_UnComprOffsets[RegionIndex+1] - m_UnComprOffsets[RegionIndex];
+      }
+    
+    private:
+      std::vector<size_t> m_ComprOffsets; // One entry per flush point (NumRegions+1).
+      std::vector<size_t> m_UnComprOffsets; // Same for the package.
+  };
+  
+  
+  //==================================================
+  // Random access to the package in a uz3-file (POSIX only) through its flush index: A read only inflates the regions
+  // which cover the requested range. The last decoded regions are kept (least recently used ones are replaced). Without
+  // a (matching) index, the whole package is a single region, which is inflated by the first read.
+  // An object must only be used by one thread at a time. Exceptions are thrown in case of errors.
+  //==================================================
+  class uz3RandomAccessFile
+  {
+    public:
+      // Maps the uz3-file and loads the flush index from the sidecar file IndexFilename (if not empty).
+      explicit uz3RandomAccessFile(const std::string& Filename, const std::string& IndexFilename = std::string(), 
+          size_t NumCachedRegions = 2);
+      
+      size_t GetPackageSize()const { return m_Index.GetPackageSize(); }
+      const uz3FlushIndex& GetIndex()const { return m_Index; }
+      
+      // Copies Length bytes beginning at Offset of the package to Target. Returns the number of copied bytes, which is
+      // less than Length at the end of the package.
+      size_t ReadAt(size_t Offset, unsigned char* Target, size_t Length);
+    
+    private:
+      uz3RandomAccessFile(const uz3RandomAccessFile&); // Not copyable.
+      uz3RandomAccessFile& operator=(const uz3RandomAccessFile&);
+      
+      // Returns the decoded region (from the cache, if possible).
+      const ByteVector& GetRegion(size_t RegionIndex);
+    
+    private:
+      MappedInputFile m_File;
+      uz3FlushIndex m_Index;
+      InflateStream m_Inflate;
+      ChunkCache m_Cache;
+  };
+  
+  // Read-only stream buffer, which inflates the uz3 data in Source lazily, i.e. only as far as the reader gets.
+  // Source is read sequentially from its current position and must stay valid as long as the object is used.
+  // The constructor reads the header and throws in case of errors. Later errors set the badbit of the reading
+  // istream (see DecompressStream.h), which rethrows them if requested by its exception mask.
+  class uz3DecompressStreamBuf : public std::streambuf
+  {
+    public:
+      explicit uz3DecompressStreamBuf(in_stream& Source);
+      virtual ~uz3DecompressStreamBuf();
+      
+      // Returns the size of the original file as saved in the header.
+      size_t GetOrigSize()const { return m_OrigSize; }
+    
+    protected:
+      virtual int_type underflow();
+    
+    private:
+      uz3DecompressStreamBuf(const uz3DecompressStreamBuf&); // Not copyable.
+      uz3DecompressStreamBuf& operator=(const uz3DecompressStreamBuf&);
+    
+    private:
+      std::streambuf& m_Source;
+      z_stream m_ZStream;
+      size_t m_OrigSize;
+      bool m_bEnd;
+      ByteVector m_InBuffer;
+      ByteVector m_OutBuffer;
+  };
+}